@@ -0,0 +1,732 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Frame time benchmark, built by "make frame-bench". A minimal headless
+// libretro frontend: it loads the core with dlopen(), renders into a
+// framebuffer object of a surfaceless EGL context (Mesa llvmpipe does
+// fine, no GPU or display needed) and flies the view along a scripted path
+// for a number of frames. Per frame it measures
+//
+//    run     wall time of retro_run()
+//    cpu     CPU time of the calling thread in retro_run()
+//    frame   retro_run() and a glFinish(), everything the frame cost
+//    gpu     GL_TIME_ELAPSED around retro_run(), read back a few frames
+//            late; where timer queries are available
+//
+// and prints mean, p50, p95, p99 and max of each after the warm-up frames,
+// followed by the core's perf counters (see perf.hpp) per frame.
+//
+// Core options are given as -o key=value. The camera feed of the camera
+// options comes from the core's synthetic source, e.g.
+//
+//    -o camera-use=true -o camera-type=synthetic -o camera_synthetic_size=1920x1080
+//
+// The path (-p) is a comma separated list of count*step, looped over the
+// run, where a step is idle, up, down, left, right (the D-pad) or
+// look=dx/dy (mouse motion per frame).
+
+#include "../libretro.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define DEFAULT_PATH "120*up,90*look=4/0,60*left,45*look=0/3,120*down,45*look=0/-3,90*look=-4/0,60*right"
+
+// Timer queries in flight; results are read this many frames late.
+#define GPU_QUERIES 4
+
+struct path_step
+{
+   unsigned frames;
+   unsigned joypad; // Mask of RETRO_DEVICE_ID_JOYPAD_*.
+   int mouse_x;
+   int mouse_y;
+};
+
+struct frame_times
+{
+   double run;
+   double cpu;
+   double frame;
+   double gpu; // < 0 if not measured.
+};
+
+struct core_symbols
+{
+   void (*set_environment)(retro_environment_t);
+   void (*set_video_refresh)(retro_video_refresh_t);
+   void (*set_audio_sample)(retro_audio_sample_t);
+   void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+   void (*set_input_poll)(retro_input_poll_t);
+   void (*set_input_state)(retro_input_state_t);
+   void (*init)(void);
+   void (*deinit)(void);
+   void (*get_system_av_info)(struct retro_system_av_info *);
+   bool (*load_game)(const struct retro_game_info *);
+   void (*unload_game)(void);
+   void (*run)(void);
+};
+
+static std::map<std::string, std::string> options;
+static const char *system_dir = ".";
+static bool verbose;
+
+static struct retro_hw_render_callback hw_render;
+static bool hw_render_set;
+static GLuint fbo;
+static unsigned frames_shown;
+
+static std::vector<struct path_step> path;
+static const struct path_step *step;
+
+static std::vector<struct retro_perf_counter*> counters;
+
+static PFNGLGENQUERIESPROC gen_queries;
+static PFNGLBEGINQUERYPROC begin_query;
+static PFNGLENDQUERYPROC end_query;
+static PFNGLGETQUERYOBJECTUI64VPROC get_query_objectui64v;
+
+static double now_ms(clockid_t clock)
+{
+   struct timespec tv;
+   clock_gettime(clock, &tv);
+   return tv.tv_sec * 1000.0 + tv.tv_nsec / 1000000.0;
+}
+
+static void core_log(enum retro_log_level level, const char *fmt, ...)
+{
+   if (!verbose && level < RETRO_LOG_WARN)
+      return;
+
+   va_list ap;
+   va_start(ap, fmt);
+   fprintf(stderr, "[core] ");
+   vfprintf(stderr, fmt, ap);
+   va_end(ap);
+}
+
+static retro_time_t perf_get_time_usec(void)
+{
+   return (retro_time_t)(now_ms(CLOCK_MONOTONIC) * 1000.0);
+}
+
+static retro_perf_tick_t perf_get_counter(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (retro_perf_tick_t)tv.tv_sec * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t perf_get_cpu_features(void)
+{
+   return 0;
+}
+
+static void perf_register(struct retro_perf_counter *counter)
+{
+   counter->registered = true;
+   counters.push_back(counter);
+}
+
+static void perf_start(struct retro_perf_counter *counter)
+{
+   counter->start = perf_get_counter();
+}
+
+static void perf_stop(struct retro_perf_counter *counter)
+{
+   counter->total += perf_get_counter() - counter->start;
+   counter->call_cnt++;
+}
+
+// Counters are printed at the end.
+static void perf_log(void)
+{
+}
+
+static uintptr_t get_current_framebuffer(void)
+{
+   return fbo;
+}
+
+static retro_proc_address_t get_proc_address(const char *sym)
+{
+   return (retro_proc_address_t)eglGetProcAddress(sym);
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback*)data)->log = core_log;
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+      {
+         struct retro_perf_callback *perf = (struct retro_perf_callback*)data;
+         perf->get_time_usec    = perf_get_time_usec;
+         perf->get_cpu_features = perf_get_cpu_features;
+         perf->get_perf_counter = perf_get_counter;
+         perf->perf_register    = perf_register;
+         perf->perf_start       = perf_start;
+         perf->perf_stop        = perf_stop;
+         perf->perf_log         = perf_log;
+         return true;
+      }
+
+      // "Description; default|other|..." sets the default unless given.
+      case RETRO_ENVIRONMENT_SET_VARIABLES:
+      {
+         const struct retro_variable *var = (const struct retro_variable*)data;
+         for (; var->key; var++)
+         {
+            const char *values = strchr(var->value, ';');
+            if (!values || options.count(var->key))
+               continue;
+
+            values += 2;
+            const char *end = strchr(values, '|');
+            options[var->key] = end ? std::string(values, end) : std::string(values);
+         }
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE:
+      {
+         struct retro_variable *var = (struct retro_variable*)data;
+         std::map<std::string, std::string>::const_iterator itr = options.find(var->key);
+         var->value = itr != options.end() ? itr->second.c_str() : NULL;
+         return var->value != NULL;
+      }
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *(bool*)data = false;
+         return true;
+
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+         return *(const enum retro_pixel_format*)data == RETRO_PIXEL_FORMAT_XRGB8888;
+
+      case RETRO_ENVIRONMENT_SET_HW_RENDER:
+      {
+         struct retro_hw_render_callback *cb = (struct retro_hw_render_callback*)data;
+         if (cb->context_type != RETRO_HW_CONTEXT_OPENGL &&
+               cb->context_type != RETRO_HW_CONTEXT_OPENGLES2)
+            return false;
+
+         cb->get_current_framebuffer = get_current_framebuffer;
+         cb->get_proc_address        = get_proc_address;
+         hw_render     = *cb;
+         hw_render_set = true;
+         return true;
+      }
+
+      case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+         *(const char**)data = system_dir;
+         return true;
+
+      case RETRO_ENVIRONMENT_SET_MESSAGE:
+         if (verbose)
+            fprintf(stderr, "[message] %s\n", ((const struct retro_message*)data)->msg);
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   (void)width;
+   (void)height;
+   (void)pitch;
+   if (data == RETRO_HW_FRAME_BUFFER_VALID)
+      frames_shown++;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   (void)index;
+   if (port || !step)
+      return 0;
+
+   switch (device)
+   {
+      case RETRO_DEVICE_JOYPAD:
+         return (step->joypad >> id) & 1;
+      case RETRO_DEVICE_MOUSE:
+         if (id == RETRO_DEVICE_ID_MOUSE_X)
+            return step->mouse_x;
+         if (id == RETRO_DEVICE_ID_MOUSE_Y)
+            return step->mouse_y;
+         return 0;
+      default:
+         return 0;
+   }
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+   (void)left;
+   (void)right;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+   (void)data;
+   return frames;
+}
+
+static bool parse_path(const char *str)
+{
+   path.clear();
+   while (*str)
+   {
+      struct path_step step;
+      memset(&step, 0, sizeof(step));
+
+      char name[32];
+      int len = 0;
+      if (sscanf(str, "%u*%31[a-z=0-9/-]%n", &step.frames, name, &len) != 2 || !step.frames)
+         return false;
+      str += len;
+
+      if (!strcmp(name, "up"))
+         step.joypad = 1 << RETRO_DEVICE_ID_JOYPAD_UP;
+      else if (!strcmp(name, "down"))
+         step.joypad = 1 << RETRO_DEVICE_ID_JOYPAD_DOWN;
+      else if (!strcmp(name, "left"))
+         step.joypad = 1 << RETRO_DEVICE_ID_JOYPAD_LEFT;
+      else if (!strcmp(name, "right"))
+         step.joypad = 1 << RETRO_DEVICE_ID_JOYPAD_RIGHT;
+      else if (sscanf(name, "look=%d/%d", &step.mouse_x, &step.mouse_y) != 2 &&
+            strcmp(name, "idle"))
+         return false;
+
+      path.push_back(step);
+      if (*str == ',')
+         str++;
+      else if (*str)
+         return false;
+   }
+   return !path.empty();
+}
+
+static const struct path_step *path_at(unsigned frame)
+{
+   unsigned length = 0;
+   for (unsigned i = 0; i < path.size(); i++)
+      length += path[i].frames;
+
+   frame %= length;
+   for (unsigned i = 0; i < path.size(); i++)
+   {
+      if (frame < path[i].frames)
+         return &path[i];
+      frame -= path[i].frames;
+   }
+   return NULL;
+}
+
+static bool load_core(const char *path, struct core_symbols *core)
+{
+   void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+   if (!lib)
+   {
+      fprintf(stderr, "%s\n", dlerror());
+      return false;
+   }
+
+#define SYMBOL(name) \
+   if (!(*(void**)&core->name = dlsym(lib, "retro_" #name))) \
+   { \
+      fprintf(stderr, "No retro_" #name " in %s.\n", path); \
+      return false; \
+   }
+   SYMBOL(set_environment);
+   SYMBOL(set_video_refresh);
+   SYMBOL(set_audio_sample);
+   SYMBOL(set_audio_sample_batch);
+   SYMBOL(set_input_poll);
+   SYMBOL(set_input_state);
+   SYMBOL(init);
+   SYMBOL(deinit);
+   SYMBOL(get_system_av_info);
+   SYMBOL(load_game);
+   SYMBOL(unload_game);
+   SYMBOL(run);
+#undef SYMBOL
+   return true;
+}
+
+// The EXT names are GLES's (GL_EXT_disjoint_timer_query).
+static retro_proc_address_t query_proc(const char *name, const char *suffix)
+{
+   std::string sym = std::string(name) + suffix;
+   return (retro_proc_address_t)eglGetProcAddress(sym.c_str());
+}
+
+static bool create_context(bool gles)
+{
+   EGLDisplay display = EGL_NO_DISPLAY;
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+   if (get_platform_display)
+      display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+   if (display == EGL_NO_DISPLAY)
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+   {
+      fprintf(stderr, "Couldn't initialize EGL.\n");
+      return false;
+   }
+
+   eglBindAPI(gles ? EGL_OPENGL_ES_API : EGL_OPENGL_API);
+
+   const EGLint config_attribs[] = {
+      EGL_RENDERABLE_TYPE, gles ? EGL_OPENGL_ES2_BIT : EGL_OPENGL_BIT,
+      EGL_NONE
+   };
+   EGLConfig config = NULL;
+   EGLint configs = 0;
+   eglChooseConfig(display, config_attribs, &config, 1, &configs);
+
+   const EGLint context_attribs[] = {
+      EGL_CONTEXT_CLIENT_VERSION, 2,
+      EGL_NONE
+   };
+   EGLContext context = eglCreateContext(display, configs ? config : EGL_NO_CONFIG_KHR,
+         EGL_NO_CONTEXT, gles ? context_attribs : NULL);
+   if (context == EGL_NO_CONTEXT ||
+         !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+   {
+      fprintf(stderr, "Couldn't create a surfaceless context (0x%x).\n", eglGetError());
+      return false;
+   }
+
+   const char *version = (const char*)glGetString(GL_VERSION);
+   fprintf(stderr, "GL: %s, %s.\n", version, glGetString(GL_RENDERER));
+
+   unsigned major = 0, minor = 0;
+   if (version && !gles)
+      sscanf(version, "%u.%u", &major, &minor);
+
+   const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+   bool timer_queries = gles ?
+      extensions && strstr(extensions, "GL_EXT_disjoint_timer_query") :
+      major > 3 || (major == 3 && minor >= 3) ||
+      (extensions && strstr(extensions, "GL_ARB_timer_query"));
+
+   if (timer_queries)
+   {
+      const char *suffix = gles ? "EXT" : "";
+      gen_queries = (PFNGLGENQUERIESPROC)query_proc("glGenQueries", suffix);
+      begin_query = (PFNGLBEGINQUERYPROC)query_proc("glBeginQuery", suffix);
+      end_query   = (PFNGLENDQUERYPROC)query_proc("glEndQuery", suffix);
+      get_query_objectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)query_proc("glGetQueryObjectui64v", suffix);
+      if (!begin_query || !end_query || !get_query_objectui64v)
+         gen_queries = NULL;
+   }
+   return true;
+}
+
+static bool create_framebuffer(unsigned width, unsigned height)
+{
+   GLuint renderbuffers[2];
+   glGenFramebuffers(1, &fbo);
+   glGenRenderbuffers(2, renderbuffers);
+
+   glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+   glRenderbufferStorage(GL_RENDERBUFFER, hw_render.context_type == RETRO_HW_CONTEXT_OPENGLES2 ?
+         GL_RGBA4 : GL_RGBA8, width, height);
+   glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+   glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+   bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+   if (!complete)
+      fprintf(stderr, "Framebuffer is incomplete.\n");
+   return complete;
+}
+
+static void print_stat(const char *name, std::vector<double> values)
+{
+   if (values.empty())
+   {
+      printf("%-8s %10s\n", name, "-");
+      return;
+   }
+
+   std::sort(values.begin(), values.end());
+   double sum = 0.0;
+   for (size_t i = 0; i < values.size(); i++)
+      sum += values[i];
+
+#define RANK(p) values[std::max<size_t>((values.size() * p + 99) / 100, 1) - 1]
+   printf("%-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, sum / values.size(),
+         RANK(50), RANK(95), RANK(99), values.back());
+#undef RANK
+}
+
+static void usage(const char *argv0)
+{
+   fprintf(stderr,
+         "Usage: %s [options] content\n"
+         "  -L core       Core to load (./instancingviewer_libretro.so).\n"
+         "  -n frames     Frames to measure (600).\n"
+         "  -w frames     Warm-up frames before those (60).\n"
+         "  -p path       Camera path, count*step,... (" DEFAULT_PATH ").\n"
+         "  -o key=value  Core option; may be repeated.\n"
+         "  -s dir        System directory (.).\n"
+         "  -c file       Per-frame times as CSV.\n"
+         "  -v            Show the core's log.\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+   const char *core_path = "./instancingviewer_libretro.so";
+   const char *content = NULL;
+   const char *csv_path = NULL;
+   const char *path_str = DEFAULT_PATH;
+   unsigned frames = 600;
+   unsigned warmup = 60;
+
+   for (int i = 1; i < argc; i++)
+   {
+      const char *arg = argv[i];
+      const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+      if (!strcmp(arg, "-v"))
+         verbose = true;
+      else if (arg[0] == '-' && value && strchr("Lnwposc", arg[1]) && !arg[2])
+      {
+         i++;
+         switch (arg[1])
+         {
+            case 'L': core_path = value; break;
+            case 'n': frames = strtoul(value, NULL, 0); break;
+            case 'w': warmup = strtoul(value, NULL, 0); break;
+            case 'p': path_str = value; break;
+            case 's': system_dir = value; break;
+            case 'c': csv_path = value; break;
+            case 'o':
+            {
+               const char *eq = strchr(value, '=');
+               if (!eq)
+               {
+                  usage(argv[0]);
+                  return 1;
+               }
+               options[std::string(value, eq)] = eq + 1;
+               break;
+            }
+         }
+      }
+      else if (arg[0] != '-' && !content)
+         content = arg;
+      else
+      {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (!content || !frames)
+   {
+      usage(argv[0]);
+      return 1;
+   }
+   if (!parse_path(path_str))
+   {
+      fprintf(stderr, "Bad camera path: %s\n", path_str);
+      return 1;
+   }
+
+   struct core_symbols core;
+   if (!load_core(core_path, &core))
+      return 1;
+
+   core.set_environment(environment);
+   core.set_video_refresh(video_refresh);
+   core.set_audio_sample(audio_sample);
+   core.set_audio_sample_batch(audio_sample_batch);
+   core.set_input_poll(input_poll);
+   core.set_input_state(input_state);
+   core.init();
+
+   struct retro_game_info info = { content, NULL, 0, NULL };
+   if (!core.load_game(&info) || !hw_render_set)
+   {
+      fprintf(stderr, "Couldn't load %s.\n", content);
+      return 1;
+   }
+
+   struct retro_system_av_info av_info;
+   core.get_system_av_info(&av_info);
+   if (!create_context(hw_render.context_type == RETRO_HW_CONTEXT_OPENGLES2) ||
+         !create_framebuffer(av_info.geometry.max_width, av_info.geometry.max_height))
+      return 1;
+   hw_render.context_reset();
+
+   GLuint queries[GPU_QUERIES];
+   if (gen_queries)
+      gen_queries(GPU_QUERIES, queries);
+
+   std::vector<struct frame_times> times(frames);
+   std::vector<retro_perf_tick_t> counter_total, counter_calls;
+   double start = 0.0;
+   unsigned warmup_shown = 0;
+
+   for (unsigned i = 0; i < warmup + frames; i++)
+   {
+      if (i == warmup)
+      {
+         // Counters only count from here on.
+         for (unsigned c = 0; c < counters.size(); c++)
+         {
+            counter_total.push_back(counters[c]->total);
+            counter_calls.push_back(counters[c]->call_cnt);
+         }
+         warmup_shown = frames_shown;
+         glFinish();
+         start = now_ms(CLOCK_MONOTONIC);
+      }
+
+      step = path_at(i);
+      unsigned query = i % GPU_QUERIES;
+
+      // The query of this slot is GPU_QUERIES frames old, long done.
+      if (gen_queries && i >= GPU_QUERIES && i - GPU_QUERIES >= warmup)
+      {
+         GLuint64 elapsed = 0;
+         get_query_objectui64v(queries[query], GL_QUERY_RESULT, &elapsed);
+         times[i - GPU_QUERIES - warmup].gpu = elapsed / 1000000.0;
+      }
+
+      double wall = now_ms(CLOCK_MONOTONIC);
+      double cpu  = now_ms(CLOCK_THREAD_CPUTIME_ID);
+      if (gen_queries)
+         begin_query(GL_TIME_ELAPSED, queries[query]);
+      core.run();
+      if (gen_queries)
+         end_query(GL_TIME_ELAPSED);
+      double run_end = now_ms(CLOCK_MONOTONIC);
+      double cpu_end = now_ms(CLOCK_THREAD_CPUTIME_ID);
+      glFinish();
+      double frame_end = now_ms(CLOCK_MONOTONIC);
+
+      if (i >= warmup)
+      {
+         struct frame_times *t = &times[i - warmup];
+         t->run   = run_end - wall;
+         t->cpu   = cpu_end - cpu;
+         t->frame = frame_end - wall;
+         t->gpu   = -1.0;
+      }
+   }
+
+   double elapsed = now_ms(CLOCK_MONOTONIC) - start;
+
+   // The last few queries are still unread.
+   for (unsigned i = warmup + frames; gen_queries && i < warmup + frames + GPU_QUERIES; i++)
+   {
+      if (i < GPU_QUERIES || i - GPU_QUERIES < warmup)
+         continue;
+      GLuint64 ns = 0;
+      get_query_objectui64v(queries[i % GPU_QUERIES], GL_QUERY_RESULT, &ns);
+      times[i - GPU_QUERIES - warmup].gpu = ns / 1000000.0;
+   }
+
+   GLenum error = glGetError();
+   if (error != GL_NO_ERROR)
+      fprintf(stderr, "GL error 0x%x.\n", error);
+
+   std::vector<double> run, cpu, frame, gpu;
+   for (unsigned i = 0; i < frames; i++)
+   {
+      run.push_back(times[i].run);
+      cpu.push_back(times[i].cpu);
+      frame.push_back(times[i].frame);
+      if (times[i].gpu >= 0.0)
+         gpu.push_back(times[i].gpu);
+   }
+
+   printf("%u frames (%u shown) in %.1f ms, %.1f fps\n", frames,
+         frames_shown - warmup_shown, elapsed, frames * 1000.0 / elapsed);
+   printf("%-8s %10s %10s %10s %10s %10s\n", "ms", "mean", "p50", "p95", "p99", "max");
+   print_stat("run", run);
+   print_stat("cpu", cpu);
+   print_stat("frame", frame);
+   print_stat("gpu", gpu);
+
+   if (!counters.empty())
+      printf("\n%-16s %10s %10s\n", "counter", "us/frame", "calls");
+   for (unsigned c = 0; c < counters.size(); c++)
+   {
+      retro_perf_tick_t total = counters[c]->total - counter_total[c];
+      retro_perf_tick_t calls = counters[c]->call_cnt - counter_calls[c];
+      printf("%-16s %10.2f %10llu\n", counters[c]->ident,
+            total / 1000.0 / frames, (unsigned long long)calls);
+   }
+
+   if (csv_path)
+   {
+      FILE *csv = fopen(csv_path, "w");
+      if (!csv)
+         fprintf(stderr, "Couldn't write %s.\n", csv_path);
+      else
+      {
+         fprintf(csv, "frame,run_ms,cpu_ms,frame_ms,gpu_ms\n");
+         for (unsigned i = 0; i < frames; i++)
+         {
+            fprintf(csv, "%u,%.4f,%.4f,%.4f,", i, times[i].run, times[i].cpu, times[i].frame);
+            if (times[i].gpu >= 0.0)
+               fprintf(csv, "%.4f", times[i].gpu);
+            fputc('\n', csv);
+         }
+         fclose(csv);
+      }
+   }
+
+   core.unload_game();
+   core.deinit();
+   return error != GL_NO_ERROR;
+}
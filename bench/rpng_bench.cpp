@@ -0,0 +1,519 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// PNG decode benchmark, built by "make bench" once per inflate backend and
+// SIMD level. Decodes a generated corpus and prints one CSV row per image and
+// stage:
+//
+//    parse     reading the chunks and checking CRCs, MB/s of file
+//    inflate   rinflate_buffer(), MB/s of filtered scanlines
+//    unfilter  png_unfilter_line(), MB/s of filtered scanlines
+//    copy      png_convert_line() to the native format, MB/s of output
+//    total     rpng_decoder_load_image(), MB/s of output
+//
+// plus a crc32 row for crc32_update() on its own. Each figure is the best of
+// several runs. rpng.cpp is compiled into this file to reach the stages.
+
+#include "../rpng.cpp"
+#include "../crc32.h"
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+struct bench_color
+{
+   const char *name;
+   unsigned color_type;
+   unsigned depth;
+};
+
+static const struct bench_color bench_colors[] = {
+   { "gray8",  0, 8 },
+   { "rgb8",   2, 8 },
+   { "rgba8",  6, 8 },
+   { "index8", 3, 8 },
+   { "rgba16", 6, 16 },
+};
+
+// Filter types 0-4 for every row, or the per-row choice of an encoder.
+#define FILTER_MIXED 5
+static const char *filter_names[] = { "none", "sub", "up", "avg", "paeth", "mixed" };
+
+struct bench_image
+{
+   const struct bench_color *color;
+   unsigned width;
+   unsigned height;
+   unsigned filter;
+   unsigned idat_chunk; // 0 for a single IDAT.
+   std::string name;
+};
+
+static std::vector<bench_image> bench_corpus(void)
+{
+   std::vector<bench_image> corpus;
+   static const unsigned sizes[] = { 256, 1024, 2048 };
+
+   for (unsigned c = 0; c < sizeof(bench_colors) / sizeof(bench_colors[0]); c++)
+   {
+      // Size, filter and chunking are varied one at a time around
+      // 1024x1024, mixed filters and 8 KiB IDATs (what libpng writes).
+      std::vector<bench_image> images;
+      for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+      {
+         bench_image image = { &bench_colors[c], sizes[s], sizes[s], FILTER_MIXED, 8192 };
+         images.push_back(image);
+      }
+      for (unsigned f = 0; f < FILTER_MIXED; f++)
+      {
+         bench_image image = { &bench_colors[c], 1024, 1024, f, 8192 };
+         images.push_back(image);
+      }
+      bench_image single = { &bench_colors[c], 1024, 1024, FILTER_MIXED, 0 };
+      images.push_back(single);
+
+      for (unsigned i = 0; i < images.size(); i++)
+      {
+         char name[64];
+         snprintf(name, sizeof(name), "%s-%ux%u-%s-%s", images[i].color->name,
+               images[i].width, images[i].height, filter_names[images[i].filter],
+               images[i].idat_chunk ? "8k" : "one");
+         images[i].name = name;
+         corpus.push_back(images[i]);
+      }
+   }
+
+   return corpus;
+}
+
+static double bench_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static std::string bench_simd(void)
+{
+#if defined(RPNG_SSE2)
+   std::string simd = "sse2";
+#elif defined(RPNG_NEON)
+   std::string simd = "neon";
+#else
+   std::string simd = "scalar";
+#endif
+#if !defined(CRC32_NO_SIMD) && defined(__PCLMUL__) && defined(__SSE4_1__)
+   simd += "+pclmul";
+#elif !defined(CRC32_NO_SIMD) && defined(__ARM_FEATURE_CRC32)
+   simd += "+crc";
+#endif
+#if !defined(RPNG_NO_SIMD) && defined(__AVX2__)
+   simd += "+avx2";
+#endif
+   return simd;
+}
+
+// Generation. Smooth gradients with a little noise, roughly as compressible
+// as a photo.
+
+static uint32_t bench_rand(uint32_t *state)
+{
+   *state = *state * 1664525u + 1013904223u;
+   return *state >> 16;
+}
+
+static void generate_rows(const bench_image &image, const struct png_ihdr *ihdr,
+      std::vector<uint8_t> &pixels, size_t pitch)
+{
+   unsigned channels = png_channels(ihdr);
+   unsigned bytes = image.color->depth / 8;
+   uint32_t seed = 12345;
+
+   std::vector<float> col(image.width * 4), row(image.height * 4);
+   for (unsigned c = 0; c < 4; c++)
+   {
+      for (unsigned x = 0; x < image.width; x++)
+         col[x * 4 + c] = 60.0f * sinf(x * 0.013f * (c + 1));
+      for (unsigned y = 0; y < image.height; y++)
+         row[y * 4 + c] = 50.0f * cosf(y * 0.021f + c);
+   }
+
+   pixels.resize(pitch * image.height);
+   for (unsigned y = 0; y < image.height; y++)
+   {
+      uint8_t *line = &pixels[y * pitch];
+      for (unsigned x = 0; x < image.width; x++)
+      {
+         for (unsigned c = 0; c < channels; c++)
+         {
+            int v = 128 + (int)(col[x * 4 + c] + row[y * 4 + c]) + (int)(bench_rand(&seed) & 15) - 8;
+            if (image.color->color_type == 3)
+               v = (x / 8 + y / 8) * 7 + (bench_rand(&seed) & 3);
+            v = v < 0 ? 0 : v > 255 ? 255 : v;
+
+            uint8_t *sample = line + (x * channels + c) * bytes;
+            sample[0] = v;
+            if (bytes == 2)
+               sample[1] = bench_rand(&seed);
+         }
+      }
+   }
+}
+
+static void filter_row(unsigned filter, uint8_t *out, const uint8_t *line, const uint8_t *prev,
+      size_t pitch, unsigned bpp)
+{
+   for (size_t i = 0; i < pitch; i++)
+   {
+      int a = i >= bpp ? line[i - bpp] : 0;
+      int b = prev[i];
+      int c = i >= bpp ? prev[i - bpp] : 0;
+      int pred = 0;
+      switch (filter)
+      {
+         case 1: pred = a; break;
+         case 2: pred = b; break;
+         case 3: pred = (a + b) >> 1; break;
+         case 4: pred = paeth(a, b, c); break;
+      }
+      out[i] = line[i] - pred;
+   }
+}
+
+static void bench_write_chunk(FILE *file, const char *type, const uint8_t *data, size_t size)
+{
+   uint8_t header[8];
+   header[0] = size >> 24;
+   header[1] = size >> 16;
+   header[2] = size >> 8;
+   header[3] = size;
+   memcpy(header + 4, type, 4);
+
+   uint32_t crc = crc32_update(0, header + 4, 4);
+   crc = crc32_update(crc, data, size);
+   uint8_t trailer[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+
+   fwrite(header, 1, sizeof(header), file);
+   fwrite(data, 1, size, file);
+   fwrite(trailer, 1, sizeof(trailer), file);
+}
+
+static bool generate_image(const bench_image &image, const char *path)
+{
+   struct png_ihdr ihdr = {0};
+   ihdr.width = image.width;
+   ihdr.height = image.height;
+   ihdr.depth = image.color->depth;
+   ihdr.color_type = image.color->color_type;
+
+   size_t pitch = png_pitch(&ihdr);
+   unsigned bpp = png_filter_bpp(&ihdr);
+
+   std::vector<uint8_t> pixels;
+   generate_rows(image, &ihdr, pixels, pitch);
+
+   std::vector<uint8_t> filtered((pitch + 1) * image.height);
+   std::vector<uint8_t> zero(pitch), trial(pitch);
+   for (unsigned y = 0; y < image.height; y++)
+   {
+      const uint8_t *line = &pixels[y * pitch];
+      const uint8_t *prev = y ? line - pitch : &zero[0];
+      uint8_t *out = &filtered[y * (pitch + 1)];
+
+      unsigned filter = image.filter;
+      if (filter == FILTER_MIXED)
+      {
+         // Smallest sum of absolute differences, as libpng does.
+         unsigned long best = ~0ul;
+         for (unsigned f = 0; f < 5; f++)
+         {
+            filter_row(f, &trial[0], line, prev, pitch, bpp);
+            unsigned long sum = 0;
+            for (size_t i = 0; i < pitch; i++)
+               sum += trial[i] < 128 ? trial[i] : 256 - trial[i];
+            if (sum < best)
+            {
+               best = sum;
+               filter = f;
+            }
+         }
+      }
+
+      out[0] = filter;
+      filter_row(filter, out + 1, line, prev, pitch, bpp);
+   }
+
+   uLongf zsize = compressBound(filtered.size());
+   std::vector<uint8_t> zdata(zsize);
+   if (compress2(&zdata[0], &zsize, &filtered[0], filtered.size(), 6) != Z_OK)
+      return false;
+
+   FILE *file = fopen(path, "wb");
+   if (!file)
+      return false;
+
+   fwrite(png_magic, 1, sizeof(png_magic), file);
+
+   uint8_t header[13] = {
+      (uint8_t)(image.width >> 24), (uint8_t)(image.width >> 16), (uint8_t)(image.width >> 8), (uint8_t)image.width,
+      (uint8_t)(image.height >> 24), (uint8_t)(image.height >> 16), (uint8_t)(image.height >> 8), (uint8_t)image.height,
+      (uint8_t)image.color->depth, (uint8_t)image.color->color_type, 0, 0, 0,
+   };
+   bench_write_chunk(file, "IHDR", header, sizeof(header));
+
+   if (image.color->color_type == 3)
+   {
+      uint8_t palette[256 * 3];
+      for (unsigned i = 0; i < 256; i++)
+      {
+         palette[i * 3 + 0] = i;
+         palette[i * 3 + 1] = 255 - i;
+         palette[i * 3 + 2] = i * 7;
+      }
+      bench_write_chunk(file, "PLTE", palette, sizeof(palette));
+   }
+
+   size_t chunk = image.idat_chunk ? image.idat_chunk : zsize;
+   for (size_t pos = 0; pos < zsize; pos += chunk)
+      bench_write_chunk(file, "IDAT", &zdata[pos], zsize - pos < chunk ? zsize - pos : chunk);
+   bench_write_chunk(file, "IEND", NULL, 0);
+
+   return fclose(file) == 0;
+}
+
+// Measurement.
+
+enum bench_stage
+{
+   STAGE_PARSE = 0,
+   STAGE_INFLATE,
+   STAGE_UNFILTER,
+   STAGE_COPY,
+   STAGE_TOTAL,
+   STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = { "parse", "inflate", "unfilter", "copy", "total" };
+
+struct bench_result
+{
+   double seconds[STAGE_COUNT];
+   size_t bytes[STAGE_COUNT];
+};
+
+static uint8_t *bench_alloc(const struct rpng_image *image, void *userdata)
+{
+   std::vector<uint8_t> *pixels = (std::vector<uint8_t>*)userdata;
+   pixels->resize((size_t)image->width * image->height * rpng_format_bpp(image->format));
+   return &(*pixels)[0];
+}
+
+static const unsigned bench_formats = RPNG_FORMAT_BIT(RPNG_FORMAT_RGBA8) |
+   RPNG_FORMAT_BIT(RPNG_FORMAT_L8) | RPNG_FORMAT_BIT(RPNG_FORMAT_LA8) |
+   RPNG_FORMAT_BIT(RPNG_FORMAT_INDEX8);
+
+static bool bench_run(rpng_decoder_t *decoder, const char *path, struct bench_result *result)
+{
+   struct png_ihdr ihdr = {0};
+   struct png_colors colors;
+   struct png_restarts restarts;
+   memset(&colors, 0, sizeof(colors));
+   restarts.count = 0;
+
+   double start = bench_time();
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+   setvbuf(file, decoder->io, _IOFBF, sizeof(decoder->io));
+   unsigned factor = 1;
+   decoder->idat.size = 0;
+   bool ok = png_read_chunks(decoder, file, 0, &ihdr, &colors, &restarts, &factor);
+   long file_size = ftell(file);
+   fclose(file);
+   if (!ok)
+      return false;
+   result->seconds[STAGE_PARSE] = bench_time() - start;
+   result->bytes[STAGE_PARSE] = file_size;
+
+   size_t pitch = png_pitch(&ihdr);
+   size_t inflate_buf_size = (pitch + 1) * ihdr.height;
+   if (!png_buffer_reserve(&decoder->inflated, inflate_buf_size))
+      return false;
+   if (!decoder->inflater)
+      decoder->inflater = rinflate_new();
+
+   start = bench_time();
+   size_t inflated = 0;
+   if (!rinflate_buffer(decoder->inflater, decoder->idat.data, decoder->idat.size,
+            decoder->inflated.data, inflate_buf_size, &inflated) || inflated != inflate_buf_size)
+      return false;
+   result->seconds[STAGE_INFLATE] = bench_time() - start;
+   result->bytes[STAGE_INFLATE] = inflated;
+
+   // Unfiltered rows are kept whole so that copy can be timed on its own.
+   std::vector<uint8_t> rows(pitch * (ihdr.height + 1));
+   unsigned bpp = png_filter_bpp(&ihdr);
+   start = bench_time();
+   for (unsigned y = 0; y < ihdr.height; y++)
+   {
+      const uint8_t *src = decoder->inflated.data + y * (pitch + 1);
+      if (!png_unfilter_line(src[0], &rows[(y + 1) * pitch], &rows[y * pitch], src + 1, pitch, bpp))
+         return false;
+   }
+   result->seconds[STAGE_UNFILTER] = bench_time() - start;
+   result->bytes[STAGE_UNFILTER] = inflated;
+
+   enum rpng_format format = png_native_format(&ihdr, &colors);
+   size_t out_pitch = (size_t)ihdr.width * rpng_format_bpp(format);
+   std::vector<uint8_t> out(out_pitch * ihdr.height);
+   start = bench_time();
+   for (unsigned y = 0; y < ihdr.height; y++)
+      png_convert_line(&out[(ihdr.height - 1 - y) * out_pitch], &rows[(y + 1) * pitch],
+            &ihdr, &colors, format);
+   result->seconds[STAGE_COPY] = bench_time() - start;
+   result->bytes[STAGE_COPY] = out.size();
+
+   std::vector<uint8_t> pixels;
+   uint8_t *data = NULL;
+   struct rpng_image image;
+   start = bench_time();
+   if (!rpng_decoder_load_image(decoder, path, bench_formats, 0, bench_alloc, &pixels, &data, &image))
+      return false;
+   result->seconds[STAGE_TOTAL] = bench_time() - start;
+   result->bytes[STAGE_TOTAL] = pixels.size();
+
+   return pixels == out;
+}
+
+static void print_row(const char *image, const char *stage, size_t bytes, double seconds)
+{
+   printf("%s,%s,%s,%s,%lu,%.3f,%.1f\n", rinflate_backend(), bench_simd().c_str(), image, stage,
+         (unsigned long)bytes, seconds * 1e3, bytes / seconds * 1e-6);
+}
+
+static void bench_crc32(unsigned reps)
+{
+   std::vector<uint8_t> data(16 << 20);
+   uint32_t seed = 1;
+   for (size_t i = 0; i < data.size(); i++)
+      data[i] = bench_rand(&seed);
+
+   double best = 0.0;
+   volatile uint32_t sink = 0;
+   for (unsigned r = 0; r < reps; r++)
+   {
+      double start = bench_time();
+      sink = sink + crc32_update(0, &data[0], data.size());
+      double seconds = bench_time() - start;
+      if (!r || seconds < best)
+         best = seconds;
+   }
+   print_row("-", "crc32", data.size(), best);
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+         "Usage: rpng_bench [-g] [-H] [-r reps] corpus_dir\n"
+         "  -g  Generate missing corpus images first.\n"
+         "  -H  Print the CSV header.\n"
+         "  -r  Runs per image, the best one is reported (default 5).\n");
+}
+
+int main(int argc, char **argv)
+{
+   bool generate = false;
+   bool header = false;
+   unsigned reps = 5;
+   int opt;
+   while ((opt = getopt(argc, argv, "gHr:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'g': generate = true; break;
+         case 'H': header = true; break;
+         case 'r': reps = strtoul(optarg, NULL, 0); break;
+         default: usage(); return 1;
+      }
+   }
+   if (optind + 1 != argc || !reps)
+   {
+      usage();
+      return 1;
+   }
+
+   std::string dir = argv[optind];
+   std::vector<bench_image> corpus = bench_corpus();
+
+   if (generate)
+   {
+      for (unsigned i = 0; i < corpus.size(); i++)
+      {
+         std::string path = dir + "/" + corpus[i].name + ".png";
+         if (access(path.c_str(), R_OK) == 0)
+            continue;
+
+         fprintf(stderr, "Generating %s\n", path.c_str());
+         if (!generate_image(corpus[i], path.c_str()))
+         {
+            fprintf(stderr, "Can't write %s\n", path.c_str());
+            return 1;
+         }
+      }
+   }
+
+   if (header)
+      printf("backend,simd,image,stage,bytes,ms,mb_per_s\n");
+
+   bench_crc32(reps);
+
+   rpng_decoder_t *decoder = rpng_decoder_new();
+   for (unsigned i = 0; i < corpus.size(); i++)
+   {
+      std::string path = dir + "/" + corpus[i].name + ".png";
+
+      struct bench_result best;
+      for (unsigned r = 0; r < reps; r++)
+      {
+         struct bench_result result;
+         if (!bench_run(decoder, path.c_str(), &result))
+         {
+            fprintf(stderr, "Failed to decode %s\n", path.c_str());
+            rpng_decoder_free(decoder);
+            return 1;
+         }
+
+         for (unsigned s = 0; s < STAGE_COUNT; s++)
+         {
+            if (!r || result.seconds[s] < best.seconds[s])
+               best.seconds[s] = result.seconds[s];
+            best.bytes[s] = result.bytes[s];
+         }
+      }
+
+      for (unsigned s = 0; s < STAGE_COUNT; s++)
+         print_row(corpus[i].name.c_str(), stage_names[s], best.bytes[s], best.seconds[s]);
+      fflush(stdout);
+   }
+   rpng_decoder_free(decoder);
+
+   return 0;
+}
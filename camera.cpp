@@ -0,0 +1,914 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "camera.hpp"
+#include "rthreads.h"
+#include "stats.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CAMERA_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CAMERA_NEON
+#endif
+
+#ifndef GL_BGRA_EXT
+#define GL_BGRA_EXT 0x80E1
+#endif
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8 0x8058
+#endif
+#ifndef GL_LUMINANCE8
+#define GL_LUMINANCE8 0x8040
+#endif
+#ifndef GL_LUMINANCE8_ALPHA8
+#define GL_LUMINANCE8_ALPHA8 0x8045
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+
+// How long to wait for the GPU to release the oldest buffer, in nanoseconds.
+#define FENCE_TIMEOUT 100000000
+
+// Frames smaller than this are converted on the calling thread alone;
+// starting threads would cost more than it saves.
+#define CONVERT_SPLIT_BYTES (1 << 20)
+#define CONVERT_BAND_ROWS_MIN 64
+#define CONVERT_BANDS_MAX 16
+
+// Spare frame buffers kept by the producer, enough to cover a camera
+// going back and forth between a couple of modes.
+#define FRAME_POOL_SIZE 4
+
+// A frame as the frontend handed it over, XRGB8888 rows pitch bytes apart,
+// or NV12 with tightly packed planes: luma, then interleaved chroma at half
+// resolution. pitch is the width then.
+struct camera_frame
+{
+   uint8_t *data;
+   unsigned width;
+   unsigned height;
+   size_t pitch;
+   bool yuv;
+   retro_time_t arrived; // When it was submitted.
+   unsigned sequence;    // Counts submitted frames, to tell drops.
+};
+
+// Set in the mailbox next to a slot index the consumer hasn't seen.
+#define MAILBOX_NEW 4
+
+struct camera_pbo
+{
+   GLuint buffer;
+   size_t size;
+#ifndef GLES
+   GLsync fence; // Set after the upload sourcing from buffer.
+#endif
+};
+
+static bool support_unpack_row_length;
+static bool swizzle; // No BGRA textures, frames are converted to RGBA.
+static GLenum internal_format;
+static GLenum tex_type;
+static GLenum tex_format;
+static bool pbo_supported;
+static bool fences_supported; // Fences and glMapBufferRange().
+static bool storage_supported; // glTexStorage2D().
+static GLuint tex;
+static GLuint tex_chroma; // With YUV frames, tex holds luma.
+static unsigned tex_width;
+static unsigned tex_height;
+static struct camera_pbo ring[CAMERA_PBO_COUNT];
+static unsigned ring_next;
+static uint8_t *convert_buffer;
+static size_t convert_buffer_size;
+
+// Workers for convert_frame(), started with the first frame worth splitting
+// and kept until camera_unload(). Each frame bumps convert_generation and
+// wakes them; the caller waits until all of them have run out of bands.
+static sthread_t *convert_workers[CONVERT_BANDS_MAX - 1];
+static unsigned convert_worker_count;
+static slock_t *convert_lock;         // Guards everything below.
+static scond_t *convert_wake;
+static scond_t *convert_done;
+static struct convert_job *convert_current;
+static unsigned convert_generation;
+static unsigned convert_start_generation; // Before the workers' first frame.
+static unsigned convert_busy;         // Workers still on the current frame.
+static bool convert_quit;
+
+// Latest-frame mailbox, a triple buffer. Each slot is owned by either the
+// producer, the consumer or the mailbox, and ownership only changes hands
+// by atomically swapping indices, so neither side ever waits. A frame the
+// consumer didn't get to is overwritten by the next one.
+static struct camera_frame slots[3];
+static unsigned mailbox;          // Slot index, | MAILBOX_NEW once filled.
+static unsigned producer_slot = 1;
+static unsigned consumer_slot = 2;
+static bool consumer_dirty;       // Consumer's frame isn't in tex yet.
+static unsigned producer_sequence;
+
+// Latency of the frames the consumer uploads, in milliseconds.
+static struct stats_window latency_upload;
+static struct stats_window latency_present;
+static unsigned last_sequence;    // 0 before the first frame.
+static unsigned frames_shown;
+static unsigned frames_dropped;
+static bool present_pending;      // Uploaded, but not in a video_cb yet.
+static retro_time_t pending_arrived;
+
+// Only the producer touches the pool. Oldest entries are evicted first.
+static struct camera_frame pool[FRAME_POOL_SIZE];
+static unsigned pool_next;
+
+static bool query_extension(const char *ext)
+{
+   const char *str = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   return str && strstr(str, ext);
+}
+
+static void query_support(void)
+{
+#ifdef GLES
+   support_unpack_row_length = query_extension("GL_EXT_unpack_subimage");
+   swizzle          = !query_extension("BGRA8888");
+   internal_format  = swizzle ? GL_RGBA : GL_BGRA_EXT;
+   tex_type         = swizzle ? GL_RGBA : GL_BGRA_EXT;
+   tex_format       = GL_UNSIGNED_BYTE;
+   pbo_supported     = false;
+   fences_supported  = false;
+   storage_supported = false;
+#else
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   unsigned major = 0, minor = 0;
+   if (version)
+      sscanf(version, "%u.%u", &major, &minor);
+
+   support_unpack_row_length = true;
+   swizzle         = false;
+   internal_format = GL_RGBA;
+   tex_type        = GL_BGRA;
+   tex_format      = GL_UNSIGNED_INT_8_8_8_8_REV;
+   pbo_supported   = major > 2 || (major == 2 && minor >= 1) ||
+      query_extension("GL_ARB_pixel_buffer_object");
+   fences_supported = pbo_supported && (major > 3 || (major == 3 && minor >= 2) ||
+         (query_extension("GL_ARB_sync") && query_extension("GL_ARB_map_buffer_range")));
+#ifdef GL_VERSION_4_2
+   storage_supported = (major > 4 || (major == 4 && minor >= 2) ||
+         query_extension("GL_ARB_texture_storage")) && SYM(glTexStorage2D);
+#else
+   storage_supported = false;
+#endif
+#endif
+}
+
+void camera_context_reset(void)
+{
+   // The last frame is still around, put it in the new texture.
+   consumer_dirty = slots[consumer_slot].data != NULL;
+   tex        = 0;
+   tex_chroma = 0;
+   memset(ring, 0, sizeof(ring));
+   ring_next = 0;
+   query_support();
+}
+
+void camera_context_destroy(void)
+{
+   if (tex)
+      SYM(glDeleteTextures)(1, &tex);
+   if (tex_chroma)
+      SYM(glDeleteTextures)(1, &tex_chroma);
+   tex        = 0;
+   tex_chroma = 0;
+
+   for (unsigned i = 0; i < CAMERA_PBO_COUNT; i++)
+   {
+#ifndef GLES
+      if (ring[i].fence)
+         SYM(glDeleteSync)(ring[i].fence);
+#endif
+      if (ring[i].buffer)
+         SYM(glDeleteBuffers)(1, &ring[i].buffer);
+   }
+   memset(ring, 0, sizeof(ring));
+   ring_next = 0;
+}
+
+static GLuint create_texture(unsigned width, unsigned height,
+      GLenum storage, GLenum internal, GLenum type, GLenum format)
+{
+   GLuint texture;
+   SYM(glGenTextures)(1, &texture);
+   SYM(glBindTexture)(GL_TEXTURE_2D, texture);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+#ifdef GL_VERSION_4_2
+   if (storage_supported)
+      SYM(glTexStorage2D)(GL_TEXTURE_2D, 1, storage, width, height);
+   else
+#endif
+      SYM(glTexImage2D)(GL_TEXTURE_2D, 0, internal, width, height, 0, type, format, NULL);
+
+   return texture;
+}
+
+// Immutable storage can't be resized, so a new mode gets new textures.
+static void create_textures(const struct camera_frame *frame)
+{
+   if (tex && (tex_width != frame->width || tex_height != frame->height ||
+            (tex_chroma != 0) != frame->yuv))
+   {
+      SYM(glDeleteTextures)(1, &tex);
+      if (tex_chroma)
+         SYM(glDeleteTextures)(1, &tex_chroma);
+      tex        = 0;
+      tex_chroma = 0;
+   }
+
+   if (tex)
+      return;
+
+   if (frame->yuv)
+   {
+      tex = create_texture(frame->width, frame->height,
+            GL_LUMINANCE8, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+      tex_chroma = create_texture((frame->width + 1) / 2, (frame->height + 1) / 2,
+            GL_LUMINANCE8_ALPHA8, GL_LUMINANCE_ALPHA, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE);
+   }
+   else
+      tex = create_texture(frame->width, frame->height,
+            GL_RGBA8, internal_format, tex_type, tex_format);
+
+   tex_width  = frame->width;
+   tex_height = frame->height;
+}
+
+// XRGB8888 to the same bytes in R, G, B, X order.
+static inline uint32_t swizzle_pixel(uint32_t p)
+{
+   return (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+static void swizzle_line(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   unsigned x = 0;
+#if defined(CAMERA_SSE2)
+   const __m128i mask_ag = _mm_set1_epi32(0xff00ff00);
+   const __m128i mask_b  = _mm_set1_epi32(0xff);
+   for (; x + 4 <= width; x += 4)
+   {
+      __m128i p = _mm_loadu_si128((const __m128i*)(src + x));
+      __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), mask_b);
+      __m128i b = _mm_slli_epi32(_mm_and_si128(p, mask_b), 16);
+      _mm_storeu_si128((__m128i*)(dst + x),
+            _mm_or_si128(_mm_and_si128(p, mask_ag), _mm_or_si128(r, b)));
+   }
+#elif defined(CAMERA_NEON)
+   for (; x + 16 <= width; x += 16)
+   {
+      uint8x16x4_t lanes = vld4q_u8((const uint8_t*)(src + x));
+      uint8x16_t tmp = lanes.val[0];
+      lanes.val[0] = lanes.val[2];
+      lanes.val[2] = tmp;
+      vst4q_u8((uint8_t*)(dst + x), lanes);
+   }
+#endif
+   for (; x < width; x++)
+      dst[x] = swizzle_pixel(src[x]);
+}
+
+struct convert_job
+{
+   uint8_t *dst;
+   const uint8_t *src;
+   unsigned width;
+   unsigned height;
+   size_t pitch;
+   unsigned bands;
+   unsigned next_band; // Guarded by convert_lock.
+};
+
+// Packs rows of width pixels tightly into dst, swizzling on the way if
+// the texture can't take BGRA.
+static void convert_rows(const struct convert_job *job, unsigned first_row, unsigned rows)
+{
+   const size_t line_bytes = (size_t)job->width * 4;
+   const uint8_t *src = job->src + first_row * job->pitch;
+   uint8_t *dst = job->dst + first_row * line_bytes;
+
+   if (swizzle)
+   {
+      for (unsigned h = 0; h < rows; h++, src += job->pitch, dst += line_bytes)
+         swizzle_line((uint32_t*)dst, (const uint32_t*)src, job->width);
+   }
+   else if (job->pitch == line_bytes)
+      memcpy(dst, src, line_bytes * rows);
+   else
+   {
+      for (unsigned h = 0; h < rows; h++, src += job->pitch, dst += line_bytes)
+         memcpy(dst, src, line_bytes);
+   }
+}
+
+static void convert_work(struct convert_job *job)
+{
+   for (;;)
+   {
+      slock_lock(convert_lock);
+      unsigned band = job->next_band++;
+      slock_unlock(convert_lock);
+      if (band >= job->bands)
+         break;
+
+      unsigned first = (uint64_t)job->height * band / job->bands;
+      unsigned last  = (uint64_t)job->height * (band + 1) / job->bands;
+      convert_rows(job, first, last - first);
+   }
+}
+
+static void convert_worker(void *userdata)
+{
+   (void)userdata;
+   slock_lock(convert_lock);
+   unsigned seen = convert_start_generation;
+   for (;;)
+   {
+      while (!convert_quit && convert_generation == seen)
+         scond_wait(convert_wake, convert_lock);
+      if (convert_quit)
+         break;
+
+      seen = convert_generation;
+      struct convert_job *job = convert_current;
+      slock_unlock(convert_lock);
+
+      convert_work(job);
+
+      slock_lock(convert_lock);
+      if (--convert_busy == 0)
+         scond_signal(convert_done);
+   }
+   slock_unlock(convert_lock);
+}
+
+// One worker per CPU besides the calling thread. False if there are none.
+static bool convert_workers_start(unsigned cpus)
+{
+   if (convert_worker_count)
+      return true;
+
+   if (!convert_lock)
+      convert_lock = slock_new();
+   if (!convert_wake)
+      convert_wake = scond_new();
+   if (!convert_done)
+      convert_done = scond_new();
+   if (!convert_lock || !convert_wake || !convert_done)
+      return false;
+
+   convert_quit = false;
+   convert_start_generation = convert_generation;
+   for (unsigned i = 0; i + 1 < cpus && i < CONVERT_BANDS_MAX - 1; i++)
+   {
+      convert_workers[convert_worker_count] = sthread_create(convert_worker, NULL);
+      if (!convert_workers[convert_worker_count])
+         break;
+      convert_worker_count++;
+   }
+   return convert_worker_count != 0;
+}
+
+static void convert_workers_stop(void)
+{
+   if (convert_worker_count)
+   {
+      slock_lock(convert_lock);
+      convert_quit = true;
+      scond_broadcast(convert_wake);
+      slock_unlock(convert_lock);
+
+      for (unsigned i = 0; i < convert_worker_count; i++)
+         sthread_join(convert_workers[i]);
+      convert_worker_count = 0;
+   }
+
+   if (convert_lock)
+      slock_free(convert_lock);
+   if (convert_wake)
+      scond_free(convert_wake);
+   if (convert_done)
+      scond_free(convert_done);
+   convert_lock = NULL;
+   convert_wake = NULL;
+   convert_done = NULL;
+}
+
+// Converts a whole frame into dst in one pass, split across the workers if
+// it is big enough to be worth it.
+static void convert_frame(uint8_t *dst, const uint8_t *src, unsigned width, unsigned height, size_t pitch)
+{
+   struct convert_job job;
+
+   job.dst       = dst;
+   job.src       = src;
+   job.width     = width;
+   job.height    = height;
+   job.pitch     = pitch;
+   job.next_band = 0;
+
+   unsigned cpus = sthread_cpu_count();
+   job.bands = cpus;
+   if (job.bands > height / CONVERT_BAND_ROWS_MIN)
+      job.bands = height / CONVERT_BAND_ROWS_MIN;
+   if (job.bands > CONVERT_BANDS_MAX)
+      job.bands = CONVERT_BANDS_MAX;
+   if (cpus < 2 || (size_t)width * height * 4 < CONVERT_SPLIT_BYTES)
+      job.bands = 1;
+
+   if (job.bands <= 1 || !convert_workers_start(cpus))
+   {
+      convert_rows(&job, 0, height);
+      return;
+   }
+
+   slock_lock(convert_lock);
+   convert_current = &job;
+   convert_busy    = convert_worker_count;
+   convert_generation++;
+   scond_broadcast(convert_wake);
+   slock_unlock(convert_lock);
+
+   // The calling thread converts bands too.
+   convert_work(&job);
+
+   slock_lock(convert_lock);
+   while (convert_busy)
+      scond_wait(convert_done, convert_lock);
+   convert_current = NULL;
+   slock_unlock(convert_lock);
+}
+
+#ifndef GLES
+// Maps the oldest buffer of the ring for writing size bytes, waiting for the
+// GPU to finish the upload that last sourced from it. NULL on failure.
+static uint8_t *ring_map(struct camera_pbo *pbo, size_t size)
+{
+   if (!pbo->buffer)
+      SYM(glGenBuffers)(1, &pbo->buffer);
+   SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+
+   if (!fences_supported)
+   {
+      // Orphaning lets the driver hand out fresh memory while the old
+      // contents are still in use.
+      SYM(glBufferData)(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+      pbo->size = size;
+      return (uint8_t*)SYM(glMapBuffer)(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+   }
+
+   if (pbo->fence)
+   {
+      GLenum status = SYM(glClientWaitSync)(pbo->fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+      SYM(glDeleteSync)(pbo->fence);
+      pbo->fence = NULL;
+      if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+         return NULL;
+   }
+
+   if (pbo->size != size)
+   {
+      SYM(glBufferData)(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+      pbo->size = size;
+   }
+
+   // The fence says the GPU is done, so there is nothing to synchronize with.
+   return (uint8_t*)SYM(glMapBufferRange)(GL_PIXEL_UNPACK_BUFFER, 0, size,
+         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+// Maps the next buffer of the ring, left bound to GL_PIXEL_UNPACK_BUFFER.
+static uint8_t *ring_begin(size_t size)
+{
+   uint8_t *dst = ring_map(&ring[ring_next], size);
+   if (!dst)
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+   return dst;
+}
+
+// Unmaps the buffer from ring_begin(). If that worked, uploads sourcing from
+// it go between this and ring_end().
+static bool ring_unmap(void)
+{
+   if (SYM(glUnmapBuffer)(GL_PIXEL_UNPACK_BUFFER))
+      return true;
+
+   SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+   ring_next = (ring_next + 1) % CAMERA_PBO_COUNT;
+   return false;
+}
+
+// Fences the uploads from the buffer and moves on to the next one.
+static void ring_end(void)
+{
+   if (fences_supported)
+      ring[ring_next].fence = SYM(glFenceSync)(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+   ring_next = (ring_next + 1) % CAMERA_PBO_COUNT;
+}
+
+static bool upload_pbo(const uint8_t *src, unsigned width, unsigned height, size_t pitch)
+{
+   uint8_t *dst = ring_begin((size_t)width * height * 4);
+   if (!dst)
+      return false;
+
+   convert_frame(dst, src, width, height, pitch);
+   if (!ring_unmap())
+      return false;
+
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, 0, 0, width, height, tex_type, tex_format, NULL);
+   ring_end();
+   return true;
+}
+#endif
+
+static void upload_client(const uint32_t *buffer, unsigned width, unsigned height, size_t pitch)
+{
+   if (swizzle || (!support_unpack_row_length && width != pitch / 4))
+   {
+      size_t size = (size_t)width * height * 4;
+      if (convert_buffer_size < size)
+      {
+         free(convert_buffer);
+         convert_buffer      = (uint8_t*)malloc(size);
+         convert_buffer_size = convert_buffer ? size : 0;
+         if (!convert_buffer)
+            return;
+      }
+
+      convert_frame(convert_buffer, (const uint8_t*)buffer, width, height, pitch);
+      SYM(glTexSubImage2D)(GL_TEXTURE_2D,
+            0, 0, 0, width, height, tex_type,
+            tex_format, convert_buffer);
+   }
+   else if (width == pitch / 4) // No need for GL_UNPACK_ROW_LENGTH.
+   {
+      SYM(glTexSubImage2D)(GL_TEXTURE_2D,
+            0, 0, 0, width, height, tex_type,
+            tex_format, buffer);
+   }
+   else
+   {
+      SYM(glPixelStorei)(GL_UNPACK_ROW_LENGTH, pitch / 4);
+      SYM(glTexSubImage2D)(GL_TEXTURE_2D,
+            0, 0, 0, width, height, tex_type,
+            tex_format, buffer);
+
+      SYM(glPixelStorei)(GL_UNPACK_ROW_LENGTH, 0);
+   }
+}
+
+static inline size_t frame_size(const struct camera_frame *frame)
+{
+   if (!frame->yuv)
+      return frame->pitch * frame->height;
+   return (size_t)frame->width * frame->height +
+      (size_t)((frame->width + 1) / 2) * ((frame->height + 1) / 2) * 2;
+}
+
+static void upload_yuv(const struct camera_frame *frame)
+{
+   size_t luma_size = (size_t)frame->width * frame->height;
+   const uint8_t *luma   = frame->data;
+   const uint8_t *chroma = frame->data + luma_size;
+   bool pbo = false;
+
+#ifndef GLES
+   if (pbo_supported)
+   {
+      uint8_t *dst = ring_begin(frame_size(frame));
+      if (dst)
+      {
+         memcpy(dst, frame->data, frame_size(frame));
+         pbo = ring_unmap();
+      }
+   }
+#endif
+
+   // Offsets into the bound unpack buffer.
+   if (pbo)
+   {
+      luma   = NULL;
+      chroma = (const uint8_t*)(uintptr_t)luma_size;
+   }
+
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 1);
+   SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, 0, 0, frame->width, frame->height,
+         GL_LUMINANCE, GL_UNSIGNED_BYTE, luma);
+   SYM(glBindTexture)(GL_TEXTURE_2D, tex_chroma);
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, 0, 0, (frame->width + 1) / 2, (frame->height + 1) / 2,
+         GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, chroma);
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 4);
+
+#ifndef GLES
+   if (pbo)
+      ring_end();
+#endif
+}
+
+static void upload(const struct camera_frame *frame)
+{
+   create_textures(frame);
+
+   if (frame->yuv)
+      upload_yuv(frame);
+   else
+   {
+      SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+#ifndef GLES
+      if (!pbo_supported || !upload_pbo(frame->data, frame->width, frame->height, frame->pitch))
+#endif
+         upload_client((const uint32_t*)frame->data, frame->width, frame->height, frame->pitch);
+   }
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+}
+
+static inline unsigned mailbox_exchange(unsigned slot)
+{
+#ifdef _MSC_VER
+   return _InterlockedExchange((volatile long*)&mailbox, slot);
+#else
+   return __atomic_exchange_n(&mailbox, slot, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline unsigned mailbox_peek(void)
+{
+#ifdef _MSC_VER
+   return *(volatile unsigned*)&mailbox;
+#else
+   return __atomic_load_n(&mailbox, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline bool frame_matches(const struct camera_frame *frame,
+      unsigned width, unsigned height, size_t pitch, bool yuv)
+{
+   return frame->data && frame->width == width && frame->height == height &&
+      frame->pitch == pitch && frame->yuv == yuv;
+}
+
+// Puts a buffer the producer is done with into the pool, in an empty entry
+// if there is one, or else in place of the oldest.
+static void pool_put(const struct camera_frame *frame)
+{
+   struct camera_frame *entry = NULL;
+   for (unsigned i = 0; i < FRAME_POOL_SIZE && !entry; i++)
+      if (!pool[i].data)
+         entry = &pool[i];
+
+   if (!entry)
+   {
+      entry = &pool[pool_next];
+      pool_next = (pool_next + 1) % FRAME_POOL_SIZE;
+      free(entry->data);
+   }
+   *entry = *frame;
+}
+
+// Gives frame a buffer for the given mode, from the pool if one fits.
+// Its old buffer goes back to the pool.
+static bool frame_acquire(struct camera_frame *frame,
+      unsigned width, unsigned height, size_t pitch, bool yuv)
+{
+   if (frame_matches(frame, width, height, pitch, yuv))
+      return true;
+
+   struct camera_frame old = *frame;
+   memset(frame, 0, sizeof(*frame));
+
+   for (unsigned i = 0; i < FRAME_POOL_SIZE; i++)
+   {
+      if (frame_matches(&pool[i], width, height, pitch, yuv))
+      {
+         *frame = pool[i];
+         memset(&pool[i], 0, sizeof(pool[i]));
+         break;
+      }
+   }
+
+   if (old.data)
+      pool_put(&old);
+   if (frame->data)
+      return true;
+
+   frame->width  = width;
+   frame->height = height;
+   frame->pitch  = pitch;
+   frame->yuv    = yuv;
+   frame->data   = (uint8_t*)malloc(frame_size(frame));
+   return frame->data != NULL;
+}
+
+// Hands the producer's frame over. Whatever was in the mailbox becomes
+// the producer's to fill next time.
+static void mailbox_publish(void)
+{
+   producer_slot = mailbox_exchange(producer_slot | MAILBOX_NEW) & ~MAILBOX_NEW;
+}
+
+void camera_submit(const uint32_t *buffer, unsigned width, unsigned height, size_t pitch)
+{
+   retro_time_t arrived = get_time_usec();
+   struct camera_frame *frame = &slots[producer_slot];
+   if (!width || !height || !frame_acquire(frame, width, height, pitch, false))
+      return;
+
+   memcpy(frame->data, buffer, pitch * height);
+   frame->arrived  = arrived;
+   frame->sequence = ++producer_sequence;
+   mailbox_publish();
+}
+
+void camera_submit_yuv(enum camera_yuv_format format, const uint8_t *const *planes,
+      const size_t *pitches, unsigned width, unsigned height)
+{
+   retro_time_t arrived = get_time_usec();
+   struct camera_frame *frame = &slots[producer_slot];
+   if (!width || !height || !frame_acquire(frame, width, height, width, true))
+      return;
+
+   unsigned chroma_width  = (width + 1) / 2;
+   unsigned chroma_height = (height + 1) / 2;
+   uint8_t *dst = frame->data;
+
+   for (unsigned y = 0; y < height; y++, dst += width)
+      memcpy(dst, planes[0] + y * pitches[0], width);
+
+   for (unsigned y = 0; y < chroma_height; y++, dst += 2 * chroma_width)
+   {
+      if (format == CAMERA_YUV_NV12)
+         memcpy(dst, planes[1] + y * pitches[1], 2 * chroma_width);
+      else
+      {
+         const uint8_t *u = planes[1] + y * pitches[1];
+         const uint8_t *v = planes[2] + y * pitches[2];
+         for (unsigned x = 0; x < chroma_width; x++)
+         {
+            dst[2 * x + 0] = u[x];
+            dst[2 * x + 1] = v[x];
+         }
+      }
+   }
+
+   frame->arrived  = arrived;
+   frame->sequence = ++producer_sequence;
+   mailbox_publish();
+}
+
+// Only for frames that are new; a re-upload after a context reset was
+// already counted.
+static void latency_uploaded(const struct camera_frame *frame)
+{
+   if (last_sequence)
+      frames_dropped += frame->sequence - last_sequence - 1;
+   last_sequence = frame->sequence;
+
+   stats_add(&latency_upload, (get_time_usec() - frame->arrived) / 1000.0f);
+   present_pending = true;
+   pending_arrived = frame->arrived;
+}
+
+GLuint camera_update(void)
+{
+   bool fresh = false;
+   if (mailbox_peek() & MAILBOX_NEW)
+   {
+      consumer_slot  = mailbox_exchange(consumer_slot) & ~MAILBOX_NEW;
+      consumer_dirty = true;
+      fresh          = true;
+   }
+
+   if (consumer_dirty)
+   {
+      upload(&slots[consumer_slot]);
+      consumer_dirty = false;
+      if (fresh)
+         latency_uploaded(&slots[consumer_slot]);
+   }
+
+   return tex;
+}
+
+void camera_presented(void)
+{
+   if (!present_pending)
+      return;
+
+   stats_add(&latency_present, (get_time_usec() - pending_arrived) / 1000.0f);
+   frames_shown++;
+   present_pending = false;
+}
+
+bool camera_latency(struct camera_latency *latency)
+{
+   if (!stats_percentiles(&latency_upload,
+            &latency->upload[0], &latency->upload[1], &latency->upload[2]) ||
+         !stats_percentiles(&latency_present,
+            &latency->present[0], &latency->present[1], &latency->present[2]))
+      return false;
+
+   latency->shown   = frames_shown;
+   latency->dropped = frames_dropped;
+   frames_shown     = 0;
+   frames_dropped   = 0;
+   return true;
+}
+
+GLuint camera_chroma(void)
+{
+   return tex_chroma;
+}
+
+void camera_unload(void)
+{
+   convert_workers_stop();
+
+   for (unsigned i = 0; i < 3; i++)
+      free(slots[i].data);
+   for (unsigned i = 0; i < FRAME_POOL_SIZE; i++)
+      free(pool[i].data);
+   memset(slots, 0, sizeof(slots));
+   memset(pool, 0, sizeof(pool));
+   pool_next      = 0;
+   mailbox        = 0;
+   producer_slot  = 1;
+   consumer_slot  = 2;
+   consumer_dirty = false;
+
+   producer_sequence = 0;
+   last_sequence     = 0;
+   frames_shown      = 0;
+   frames_dropped    = 0;
+   present_pending   = false;
+   stats_clear(&latency_upload);
+   stats_clear(&latency_present);
+
+   free(convert_buffer);
+   convert_buffer      = NULL;
+   convert_buffer_size = 0;
+}
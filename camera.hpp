@@ -0,0 +1,109 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAMERA_HPP__
+#define CAMERA_HPP__
+
+#include "gl.hpp"
+
+// Texture upload of raw camera frames (XRGB8888, any pitch, or YUV 4:2:0).
+//
+// Frames may arrive on any thread at any rate. camera_submit() copies one
+// into a latest-frame mailbox and returns without waiting on anything;
+// retro_run() picks up the newest with camera_update() and uploads it
+// there, so at most one frame goes up per video frame and older ones are
+// dropped unseen. Frame memory is pooled by size and stride, and the
+// texture (immutable where glTexStorage2D is available) is only recreated
+// when the size changes, so a steady stream allocates nothing.
+//
+// YUV frames go up as NV12, a luma texture and a half resolution chroma one
+// (U in luminance, V in alpha), 1.5 bytes a pixel instead of 4. The shader
+// converts them; see camera_chroma().
+//
+// Where pixel buffer objects are available, frames are streamed through a
+// ring of CAMERA_PBO_COUNT unpack buffers: each one is copied into the next
+// buffer and glTexSubImage2D sources from there, so the copy never waits on
+// the driver. A fence after every upload keeps a buffer from being rewritten
+// while the GPU still reads it; with three buffers the oldest is two frames
+// old and long done. Otherwise frames go up from client memory.
+//
+// Every frame is timed from when it is submitted to its upload and to the
+// first video_cb() that shows it (what the frontend does after that is out
+// of sight), for percentiles over the last STATS_WINDOW frames.
+//
+// Rows are repacked to the texture width, and swizzled to RGBA where GLES
+// lacks BGRA textures, in one SIMD pass straight into the upload buffer;
+// large frames are split across worker threads that are started once and
+// woken for each frame.
+
+#define CAMERA_PBO_COUNT 3
+
+enum camera_yuv_format
+{
+   CAMERA_YUV_NV12 = 0, // Luma, then interleaved U and V.
+   CAMERA_YUV_I420      // Luma, U, V.
+};
+
+// Call from context_reset(). Every GL object from before is considered lost.
+void camera_context_reset(void);
+
+// Deletes every GL object made so far. Call with the context current, before
+// a camera_context_reset() that doesn't follow a real context loss.
+void camera_context_destroy(void);
+
+// The raw framebuffer callback. Makes no GL calls; safe from one thread
+// other than the one rendering.
+void camera_submit(const uint32_t *buffer, unsigned width, unsigned height, size_t pitch);
+
+// Same for a YUV 4:2:0 frame, for sources other than the libretro camera
+// interface, which only knows XRGB8888. planes and pitches have one entry
+// per plane of the format.
+void camera_submit_yuv(enum camera_yuv_format format, const uint8_t *const *planes,
+      const size_t *pitches, unsigned width, unsigned height);
+
+// Call from retro_run(). Uploads the newest frame if there is one since the
+// last call, creating the texture on the first. Returns the texture, 0
+// until a frame has arrived.
+GLuint camera_update(void);
+
+// Call right after the video_cb() of a frame drawn with the texture.
+void camera_presented(void);
+
+struct camera_latency
+{
+   // p50, p95 and p99 in milliseconds, from camera_submit() to the upload,
+   // and to the video_cb() that first showed the frame.
+   float upload[3];
+   float present[3];
+
+   // Frames shown, and frames replaced before they could be, since the
+   // last call.
+   unsigned shown;
+   unsigned dropped;
+};
+
+// False until a frame has been shown.
+bool camera_latency(struct camera_latency *latency);
+
+// The chroma texture while frames are YUV, with luma in the one
+// camera_update() returns. 0 for XRGB8888 frames.
+GLuint camera_chroma(void);
+
+// Frees everything, once the camera is stopped. Makes no GL calls.
+void camera_unload(void);
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "camsource.hpp"
+#include "camera.hpp"
+#include "rthreads.h"
+#include "shared.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Padded rows are rounded up to this and get as much again on top.
+#define PAD_ALIGN 64
+
+struct source_plane
+{
+   size_t offset;    // From the start of an image.
+   size_t pitch;
+   size_t row_bytes;
+   unsigned rows;    // Visible rows; a scrolling image has twice as many.
+};
+
+static struct camsource_config config;
+static std::string config_path;
+static retro_camera_frame_raw_framebuffer_t raw_cb;
+
+// Images to deliver, each laid out with the configured pitches. The test
+// pattern is a single image twice as tall as a frame that scrolls by.
+static uint8_t *images;
+static size_t image_size;
+static unsigned image_count;
+static bool scrolling;
+static struct source_plane planes[3];
+static unsigned plane_count;
+
+static sthread_t *thread;
+static slock_t *lock;
+static scond_t *cond;
+static bool running; // Guarded by lock.
+
+static void setup_planes(void)
+{
+   unsigned chroma_width  = (config.width + 1) / 2;
+   unsigned chroma_height = (config.height + 1) / 2;
+
+   switch (config.format)
+   {
+      case CAMSOURCE_XRGB8888:
+         plane_count = 1;
+         planes[0].row_bytes = (size_t)config.width * 4;
+         planes[0].rows      = config.height;
+         break;
+
+      case CAMSOURCE_NV12:
+         plane_count = 2;
+         planes[0].row_bytes = config.width;
+         planes[0].rows      = config.height;
+         planes[1].row_bytes = 2 * chroma_width;
+         planes[1].rows      = chroma_height;
+         break;
+
+      case CAMSOURCE_I420:
+         plane_count = 3;
+         planes[0].row_bytes = config.width;
+         planes[0].rows      = config.height;
+         planes[1].row_bytes = chroma_width;
+         planes[1].rows      = chroma_height;
+         planes[2].row_bytes = chroma_width;
+         planes[2].rows      = chroma_height;
+         break;
+   }
+
+   image_size = 0;
+   for (unsigned i = 0; i < plane_count; i++)
+   {
+      struct source_plane *plane = &planes[i];
+      plane->pitch = plane->row_bytes;
+      if (config.padded)
+         plane->pitch = (plane->row_bytes + 2 * PAD_ALIGN - 1) / PAD_ALIGN * PAD_ALIGN;
+
+      plane->offset = image_size;
+      image_size += plane->pitch * plane->rows * (scrolling ? 2 : 1);
+   }
+}
+
+// Gradients under a checkerboard, with a grid that shows the scrolling.
+static void pattern_rgb(unsigned x, unsigned y, unsigned *r, unsigned *g, unsigned *b)
+{
+   y %= config.height;
+   if (x % 64 == 0 || y % 64 == 0)
+   {
+      *r = *g = *b = 255;
+      return;
+   }
+
+   unsigned check = ((x / 32) ^ (y / 32)) & 1;
+   *r = x * 255 / config.width;
+   *g = y * 255 / config.height;
+   *b = check ? 192 : 64;
+}
+
+// BT.601 limited range, the inverse of what the shader does.
+static void rgb_to_yuv(unsigned r, unsigned g, unsigned b, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+   *y = (uint8_t)(16.5f + 0.257f * r + 0.504f * g + 0.098f * b);
+   *u = (uint8_t)(128.5f - 0.148f * r - 0.291f * g + 0.439f * b);
+   *v = (uint8_t)(128.5f + 0.439f * r - 0.368f * g - 0.071f * b);
+}
+
+static bool build_pattern(void)
+{
+   scrolling   = true;
+   image_count = 1;
+   setup_planes();
+
+   images = (uint8_t*)calloc(1, image_size);
+   if (!images)
+      return false;
+
+   unsigned r, g, b;
+   uint8_t y, u, v;
+
+   const struct source_plane *luma = &planes[0];
+   for (unsigned row = 0; row < 2 * luma->rows; row++)
+   {
+      uint8_t *dst = images + luma->offset + row * luma->pitch;
+      for (unsigned x = 0; x < config.width; x++)
+      {
+         pattern_rgb(x, row, &r, &g, &b);
+         if (config.format == CAMSOURCE_XRGB8888)
+            ((uint32_t*)dst)[x] = 0xff000000u | (r << 16) | (g << 8) | b;
+         else
+         {
+            rgb_to_yuv(r, g, b, &y, &u, &v);
+            dst[x] = y;
+         }
+      }
+   }
+
+   // Chroma of the top left pixel of each 2x2 block.
+   for (unsigned row = 0; plane_count > 1 && row < 2 * planes[1].rows; row++)
+   {
+      uint8_t *dst_u = images + planes[1].offset + row * planes[1].pitch;
+      uint8_t *dst_v = plane_count > 2 ? images + planes[2].offset + row * planes[2].pitch : NULL;
+      for (unsigned x = 0; x < (config.width + 1) / 2; x++)
+      {
+         pattern_rgb(2 * x, 2 * row, &r, &g, &b);
+         rgb_to_yuv(r, g, b, &y, &u, &v);
+         if (dst_v)
+         {
+            dst_u[x] = u;
+            dst_v[x] = v;
+         }
+         else
+         {
+            dst_u[2 * x + 0] = u;
+            dst_u[2 * x + 1] = v;
+         }
+      }
+   }
+
+   return true;
+}
+
+static bool load_file(const char *path)
+{
+   scrolling = false;
+   setup_planes();
+
+   size_t frame_bytes = 0;
+   for (unsigned i = 0; i < plane_count; i++)
+      frame_bytes += planes[i].row_bytes * planes[i].rows;
+
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+
+   fseek(file, 0, SEEK_END);
+   long size = ftell(file);
+   fseek(file, 0, SEEK_SET);
+
+   image_count = size > 0 ? (size_t)size / frame_bytes : 0;
+   images = image_count ? (uint8_t*)malloc(image_size * image_count) : NULL;
+
+   bool ret = images != NULL;
+   for (unsigned i = 0; ret && i < image_count; i++)
+   {
+      for (unsigned p = 0; ret && p < plane_count; p++)
+      {
+         uint8_t *dst = images + i * image_size + planes[p].offset;
+         for (unsigned row = 0; ret && row < planes[p].rows; row++, dst += planes[p].pitch)
+            ret = fread(dst, 1, planes[p].row_bytes, file) == planes[p].row_bytes;
+      }
+   }
+
+   fclose(file);
+   if (!ret)
+   {
+      free(images);
+      images = NULL;
+   }
+   return ret;
+}
+
+static void deliver(unsigned frame)
+{
+   const uint8_t *image = images;
+   unsigned scroll = 0;
+
+   if (scrolling)
+   {
+      // Even, so chroma rows move along with luma.
+      unsigned period = config.height / 2 ? config.height / 2 : 1;
+      scroll = 2 * (frame % period);
+   }
+   else
+      image += (size_t)(frame % image_count) * image_size;
+
+   const uint8_t *data[3];
+   size_t pitches[3];
+   for (unsigned i = 0; i < plane_count; i++)
+   {
+      unsigned rows = i ? scroll / 2 : scroll;
+      data[i]    = image + planes[i].offset + rows * planes[i].pitch;
+      pitches[i] = planes[i].pitch;
+   }
+
+   if (config.format == CAMSOURCE_XRGB8888)
+      raw_cb((const uint32_t*)data[0], config.width, config.height, pitches[0]);
+   else
+      camera_submit_yuv(config.format == CAMSOURCE_NV12 ? CAMERA_YUV_NV12 : CAMERA_YUV_I420,
+            data, pitches, config.width, config.height);
+}
+
+static void source_thread(void *data)
+{
+   (void)data;
+   retro_time_t period = config.rate ? 1000000 / config.rate : 0;
+   retro_time_t next = get_time_usec();
+
+   for (unsigned frame = 0;; frame++)
+   {
+      slock_lock(lock);
+      for (retro_time_t wait; running && (wait = next - get_time_usec()) > 0; )
+         scond_wait_timeout(cond, lock, wait);
+      bool run = running;
+      slock_unlock(lock);
+
+      if (!run)
+         break;
+
+      deliver(frame);
+
+      // A camera that falls behind drops frames rather than bursting.
+      next += period;
+      retro_time_t now = get_time_usec();
+      if (now - next > period)
+         next = now;
+   }
+}
+
+void camsource_configure(const struct camsource_config *new_config,
+      retro_camera_frame_raw_framebuffer_t raw)
+{
+   camsource_stop();
+
+   config      = *new_config;
+   config_path = config.path ? config.path : "";
+   config.path = config.path ? config_path.c_str() : NULL;
+   raw_cb      = raw;
+}
+
+bool camsource_start(void)
+{
+   if (thread)
+      return true;
+   if (!config.width || !config.height || (config.format == CAMSOURCE_XRGB8888 && !raw_cb))
+      return false;
+
+   if (config.path && !load_file(config.path))
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_WARN, "No %ux%u frames in %s, using a test pattern.\n",
+               config.width, config.height, config.path);
+   }
+   if (!images && !build_pattern())
+      return false;
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Synthetic camera: %ux%u, %u image(s), %u fps.\n",
+            config.width, config.height, image_count, config.rate);
+
+   if (!lock)
+      lock = slock_new();
+   if (!cond)
+      cond = scond_new();
+
+   running = true;
+   thread  = lock && cond ? sthread_create(source_thread, NULL) : NULL;
+   if (!thread)
+   {
+      free(images);
+      images = NULL;
+   }
+   return thread != NULL;
+}
+
+void camsource_stop(void)
+{
+   if (thread)
+   {
+      slock_lock(lock);
+      running = false;
+      scond_signal(cond);
+      slock_unlock(lock);
+
+      sthread_join(thread);
+      thread = NULL;
+   }
+
+   if (lock)
+      slock_free(lock);
+   if (cond)
+      scond_free(cond);
+   lock = NULL;
+   cond = NULL;
+
+   free(images);
+   images = NULL;
+}
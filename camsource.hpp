@@ -0,0 +1,64 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAMSOURCE_HPP__
+#define CAMSOURCE_HPP__
+
+#include "libretro.h"
+
+// A stand-in for the frontend's camera, for measuring the camera path
+// where there is no camera (or no frontend that offers one).
+//
+// A thread of its own delivers frames at a fixed rate, the way a camera
+// driver would: XRGB8888 frames through the same raw framebuffer callback
+// the frontend would call, YUV ones through camera_submit_yuv(). Frames
+// are a scrolling test pattern, or raw frames looped from a file. Either
+// way they are prepared up front, so the source itself costs next to
+// nothing per frame.
+
+enum camsource_format
+{
+   CAMSOURCE_XRGB8888 = 0,
+   CAMSOURCE_NV12,
+   CAMSOURCE_I420
+};
+
+struct camsource_config
+{
+   unsigned width;
+   unsigned height;
+   bool padded;   // Rows longer than the image, as many drivers hand out.
+   unsigned rate; // Frames per second, 0 for as fast as they are taken.
+   enum camsource_format format;
+
+   // Tightly packed frames of the format above, back to back, or NULL
+   // for the test pattern.
+   const char *path;
+};
+
+// Sets what camsource_start() delivers, stopping the source first.
+// XRGB8888 frames go to raw.
+void camsource_configure(const struct camsource_config *config,
+      retro_camera_frame_raw_framebuffer_t raw);
+
+// Same signatures as the frontend's camera start and stop, so they can
+// stand in for them in retro_camera_callback. Starting a running source
+// does nothing.
+bool camsource_start(void);
+void camsource_stop(void);
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.hpp"
+#include "rthreads.h"
+#include "rpng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+
+// Frames between glReadPixels() into the pack buffer and mapping it. The
+// frontend keeps at most a frame or two queued, so by then the copy is done.
+#define READBACK_DELAY 2
+
+enum capture_state
+{
+   CAPTURE_IDLE = 0,
+   CAPTURE_REQUESTED,
+   CAPTURE_READBACK,
+   CAPTURE_ENCODING
+};
+
+static enum capture_state state;
+static std::string capture_path;
+static int capture_level;
+static unsigned capture_width;
+static unsigned capture_height;
+static unsigned readback_frames;
+static bool pbo_supported;
+static GLuint pbo;
+static bool pbo_mapped;
+static uint8_t *client_pixels; // Without a pack buffer.
+
+// Encoder thread. encode_done is guarded by encode_lock while it runs.
+static sthread_t *encode_thread;
+static slock_t *encode_lock;
+static const uint8_t *encode_pixels;
+static bool encode_done;
+static bool encode_ok;
+
+static void make_dir(const std::string &dir)
+{
+   // Parents first; failures show up when the file is written.
+   for (size_t pos = dir.find_first_of("/\\", 1);; pos = dir.find_first_of("/\\", pos + 1))
+   {
+      std::string sub = dir.substr(0, pos);
+#ifdef _WIN32
+      _mkdir(sub.c_str());
+#else
+      mkdir(sub.c_str(), 0755);
+#endif
+      if (pos == std::string::npos)
+         break;
+   }
+}
+
+bool capture_request(const char *dir, const char *name, int level)
+{
+   if (state != CAPTURE_IDLE)
+      return false;
+
+   std::string base = dir && *dir ? std::string(dir) : std::string(".");
+   make_dir(base);
+
+   for (unsigned i = 1; i < 1000; i++)
+   {
+      char file[32];
+      snprintf(file, sizeof(file), "-%03u.png", i);
+      std::string path = base + "/" + name + file;
+
+      FILE *probe = fopen(path.c_str(), "rb");
+      if (probe)
+      {
+         fclose(probe);
+         continue;
+      }
+
+      capture_path  = path;
+      capture_level = level;
+      state         = CAPTURE_REQUESTED;
+      return true;
+   }
+
+   return false;
+}
+
+// The frame is rendered flipped (hw_render.bottom_left_origin is unset), so
+// the first row glReadPixels() returns is the top of the image.
+static void encode_thread_func(void *data)
+{
+   (void)data;
+   bool ok = rpng_save_image_rgba(capture_path.c_str(), encode_pixels,
+         capture_width, capture_height, capture_width * 4, false, false, capture_level);
+
+   slock_lock(encode_lock);
+   encode_ok   = ok;
+   encode_done = true;
+   slock_unlock(encode_lock);
+}
+
+static void encode_start(const uint8_t *pixels)
+{
+   if (!encode_lock)
+      encode_lock = slock_new();
+
+   encode_pixels = pixels;
+   encode_done   = false;
+   encode_ok     = false;
+   state         = CAPTURE_ENCODING;
+
+   encode_thread = encode_lock ? sthread_create(encode_thread_func, NULL) : NULL;
+
+   // No threads, encode inline.
+   if (!encode_thread)
+   {
+      encode_ok   = rpng_save_image_rgba(capture_path.c_str(), pixels,
+            capture_width, capture_height, capture_width * 4, false, false, capture_level);
+      encode_done = true;
+   }
+}
+
+// Returns true once the encoder is done. With gl == false a mapped pack
+// buffer is forgotten rather than unmapped.
+static bool encode_poll(bool wait, bool gl)
+{
+   if (encode_thread)
+   {
+      slock_lock(encode_lock);
+      bool done = encode_done;
+      slock_unlock(encode_lock);
+
+      if (!done && !wait)
+         return false;
+
+      sthread_join(encode_thread);
+      encode_thread = NULL;
+   }
+
+#ifndef GLES
+   if (pbo_mapped && gl)
+   {
+      SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, pbo);
+      SYM(glUnmapBuffer)(GL_PIXEL_PACK_BUFFER);
+      SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, 0);
+   }
+#endif
+   pbo_mapped    = false;
+   encode_pixels = NULL;
+   free(client_pixels);
+   client_pixels = NULL;
+   state = CAPTURE_IDLE;
+   return true;
+}
+
+static void readback_start(void)
+{
+   size_t size = (size_t)capture_width * capture_height * 4;
+
+#ifndef GLES
+   if (pbo_supported)
+   {
+      if (!pbo)
+         SYM(glGenBuffers)(1, &pbo);
+      SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, pbo);
+      SYM(glBufferData)(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+      SYM(glReadPixels)(0, 0, capture_width, capture_height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, 0);
+
+      readback_frames = 0;
+      state = CAPTURE_READBACK;
+      return;
+   }
+#endif
+
+   client_pixels = (uint8_t*)malloc(size);
+   if (!client_pixels)
+   {
+      state = CAPTURE_IDLE;
+      return;
+   }
+
+   SYM(glReadPixels)(0, 0, capture_width, capture_height, GL_RGBA, GL_UNSIGNED_BYTE, client_pixels);
+   encode_start(client_pixels);
+}
+
+static void readback_finish(void)
+{
+#ifndef GLES
+   SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, pbo);
+   const uint8_t *pixels = (const uint8_t*)SYM(glMapBuffer)(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+   SYM(glBindBuffer)(GL_PIXEL_PACK_BUFFER, 0);
+
+   if (pixels)
+   {
+      pbo_mapped = true;
+      encode_start(pixels);
+      return;
+   }
+#endif
+
+   encode_ok   = false;
+   encode_done = true;
+   state       = CAPTURE_ENCODING;
+}
+
+bool capture_update(unsigned width, unsigned height, bool *ok, std::string *path)
+{
+   bool finished = false;
+
+   if (state == CAPTURE_ENCODING && encode_poll(false, true))
+   {
+      finished = true;
+      *ok      = encode_ok;
+      *path    = capture_path;
+   }
+
+   if (state == CAPTURE_READBACK && ++readback_frames >= READBACK_DELAY)
+      readback_finish();
+
+   if (state == CAPTURE_REQUESTED)
+   {
+      capture_width  = width;
+      capture_height = height;
+      readback_start();
+   }
+
+   return finished;
+}
+
+static bool query_pbo_support(void)
+{
+#ifdef GLES
+   return false;
+#else
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   const char *ext     = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   unsigned major = 0, minor = 0;
+   if (version)
+      sscanf(version, "%u.%u", &major, &minor);
+   return major > 2 || (major == 2 && minor >= 1) ||
+      (ext && strstr(ext, "GL_ARB_pixel_buffer_object"));
+#endif
+}
+
+void capture_context_reset(void)
+{
+   // The encoder may be reading a buffer mapped in the old context.
+   if (state == CAPTURE_ENCODING)
+      encode_poll(true, false);
+   if (state == CAPTURE_READBACK)
+      state = CAPTURE_IDLE;
+
+   pbo           = 0;
+   pbo_mapped    = false;
+   pbo_supported = query_pbo_support();
+}
+
+void capture_context_destroy(void)
+{
+   // The encoder may be reading the mapped pack buffer.
+   if (state == CAPTURE_ENCODING)
+      encode_poll(true, true);
+
+#ifndef GLES
+   if (pbo)
+      SYM(glDeleteBuffers)(1, &pbo);
+#endif
+   pbo = 0;
+}
+
+void capture_unload(void)
+{
+   if (state == CAPTURE_ENCODING)
+      encode_poll(true, false);
+   state = CAPTURE_IDLE;
+
+   if (encode_lock)
+      slock_free(encode_lock);
+   encode_lock = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTURE_HPP__
+#define CAPTURE_HPP__
+
+#include "gl.hpp"
+#include <string>
+
+// Screenshots of the rendered frame, written as PNG on a worker thread.
+//
+// Where pixel buffer objects are available, the frame is read into a
+// GL_PIXEL_PACK_BUFFER and only mapped a couple of frames later, when the
+// GPU is long done with it, so the render thread never stalls on the
+// readback. The encoder reads straight from the mapped buffer (see
+// rpng_save_image_rgba()). GLES2 has no pack buffers and reads back
+// synchronously.
+
+// Saves the next frame as dir/name-NNN.png, with the first free NNN, at a
+// zlib level (1 is fastest). dir is created if needed. Returns false while
+// another capture is in flight.
+bool capture_request(const char *dir, const char *name, int level);
+
+// Call every frame after drawing, with the frame still bound to GL_FRAMEBUFFER.
+// Returns true once a capture has finished, with *ok telling whether it was
+// written and *path where to.
+bool capture_update(unsigned width, unsigned height, bool *ok, std::string *path);
+
+// Call from context_reset(). Every GL object from before is considered lost;
+// a capture still waiting for its readback is dropped.
+void capture_context_reset(void);
+
+// Deletes the pack buffer, once the encoder is done with it. Call with the
+// context current, before a capture_context_reset() that doesn't follow a
+// real context loss.
+void capture_context_destroy(void);
+
+// Waits for any pending encode and frees everything. Makes no GL calls.
+void capture_unload(void);
+
+#endif
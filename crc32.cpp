@@ -0,0 +1,182 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crc32.h"
+
+#include <string.h>
+
+#if defined(CRC32_NO_SIMD)
+#elif defined(__PCLMUL__) && defined(__SSE4_1__)
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_PCLMUL
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32_ARM
+#endif
+
+static struct crc32_tables
+{
+   // table[k][b] is the CRC of byte b followed by k zero bytes.
+   uint32_t table[8][256];
+
+   crc32_tables()
+   {
+      for (unsigned b = 0; b < 256; b++)
+      {
+         uint32_t c = b;
+         for (unsigned i = 0; i < 8; i++)
+            c = c & 1 ? (c >> 1) ^ 0xedb88320u : c >> 1;
+         table[0][b] = c;
+      }
+
+      for (unsigned b = 0; b < 256; b++)
+         for (unsigned k = 1; k < 8; k++)
+            table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+   }
+} tables;
+
+static inline uint32_t load_le32(const uint8_t *data)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   uint32_t v;
+   memcpy(&v, data, sizeof(v));
+   return v;
+#else
+   return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+#endif
+}
+
+// Operates on the inverted CRC, like all the paths below.
+static uint32_t crc32_slice8(uint32_t c, const uint8_t *data, size_t size)
+{
+   for (; size && ((uintptr_t)data & 7); size--)
+      c = (c >> 8) ^ tables.table[0][(c ^ *data++) & 0xff];
+
+   for (; size >= 8; size -= 8, data += 8)
+   {
+      uint32_t lo = load_le32(data) ^ c;
+      uint32_t hi = load_le32(data + 4);
+      c = tables.table[7][lo & 0xff] ^ tables.table[6][(lo >> 8) & 0xff] ^
+         tables.table[5][(lo >> 16) & 0xff] ^ tables.table[4][lo >> 24] ^
+         tables.table[3][hi & 0xff] ^ tables.table[2][(hi >> 8) & 0xff] ^
+         tables.table[1][(hi >> 16) & 0xff] ^ tables.table[0][hi >> 24];
+   }
+
+   while (size--)
+      c = (c >> 8) ^ tables.table[0][(c ^ *data++) & 0xff];
+   return c;
+}
+
+#if defined(CRC32_PCLMUL)
+// Folding with carry-less multiplies, after Gopal et al., "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+// Four 128-bit lanes are folded 64 bytes ahead, merged, then Barrett reduced.
+// size must be a multiple of 16, at least 64.
+static uint32_t crc32_pclmul(uint32_t c, const uint8_t *data, size_t size)
+{
+   // x^(4*128+64) and x^(4*128) mod P, bit reflected; then for 128 bits; then 64.
+   const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+   const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+   const __m128i k5   = _mm_set_epi64x(0, 0x0163cd6124ll);
+   // P and mu = x^64 / P for the Barrett reduction.
+   const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll);
+   const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+   __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 0x00)), _mm_cvtsi32_si128(c));
+   __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+   __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+   __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+   data += 64;
+   size -= 64;
+
+   for (; size >= 64; size -= 64, data += 64)
+   {
+      __m128i y1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+      __m128i y2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+      __m128i y3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+      __m128i y4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+      x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+      x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+      x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+      x2 = _mm_xor_si128(_mm_xor_si128(x2, y2), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+      x3 = _mm_xor_si128(_mm_xor_si128(x3, y3), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+      x4 = _mm_xor_si128(_mm_xor_si128(x4, y4), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+   }
+
+#define FOLD128(acc, next) do { \
+   __m128i lo_ = _mm_clmulepi64_si128(acc, k3k4, 0x00); \
+   acc = _mm_clmulepi64_si128(acc, k3k4, 0x11); \
+   acc = _mm_xor_si128(_mm_xor_si128(acc, lo_), next); \
+} while (0)
+
+   FOLD128(x1, x2);
+   FOLD128(x1, x3);
+   FOLD128(x1, x4);
+   for (; size >= 16; size -= 16, data += 16)
+      FOLD128(x1, _mm_loadu_si128((const __m128i*)data));
+#undef FOLD128
+
+   // 128 to 64 bits.
+   __m128i x = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+   x = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x, low32), k5, 0x00), _mm_srli_si128(x, 4));
+
+   // Barrett reduction to 32 bits.
+   __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x, low32), poly, 0x10);
+   t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+   return _mm_extract_epi32(_mm_xor_si128(x, t), 1);
+}
+#elif defined(CRC32_ARM)
+static uint32_t crc32_arm(uint32_t c, const uint8_t *data, size_t size)
+{
+   for (; size && ((uintptr_t)data & 7); size--)
+      c = __crc32b(c, *data++);
+   for (; size >= 8; size -= 8, data += 8)
+   {
+      uint64_t v;
+      memcpy(&v, data, sizeof(v));
+      c = __crc32d(c, v);
+   }
+   while (size--)
+      c = __crc32b(c, *data++);
+   return c;
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+   uint32_t c = ~crc;
+
+#if defined(CRC32_PCLMUL)
+   if (size >= 64)
+   {
+      size_t bulk = size & ~(size_t)15;
+      c = crc32_pclmul(c, data, bulk);
+      data += bulk;
+      size -= bulk;
+   }
+   c = crc32_slice8(c, data, size);
+#elif defined(CRC32_ARM)
+   c = crc32_arm(c, data, size);
+#else
+   c = crc32_slice8(c, data, size);
+#endif
+
+   return ~c;
+}
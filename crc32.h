@@ -0,0 +1,43 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRC32_H__
+#define CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 as used by PNG and zlib (reflected polynomial 0xedb88320).
+//
+// Uses carry-less multiply folding when the build targets PCLMUL and SSE4.1
+// (e.g. -mpclmul -msse4.1, or -march=native) and the CRC32 instructions on
+// ARMv8 with the crc extension, unless CRC32_NO_SIMD is defined. Otherwise
+// slice-by-8 tables, over 1 GB/s.
+// PNG checksums the compressed data, so even that is small next to inflate.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start with crc = 0; pass the result back in to continue over more data.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,6 +40,9 @@ namespace GL
          _D(glBlendFunc),
          _D(glClearColor),
          _D(glTexImage2D),
+         _D(glTexSubImage2D),
+         _D(glPixelStorei),
+         _D(glGetString),
          _D(glViewport),
          _D(glClear),
          _D(glTexParameteri),
@@ -52,10 +55,13 @@ namespace GL
 #if defined(__APPLE__) && !defined(IOS)
          _D(glActiveTexture),
 	 _D(glCreateProgram),
+	 _D(glDeleteProgram),
          _D(glCreateShader),
+	 _D(glDeleteShader),
 	 _D(glShaderSource),
 	 _D(glCompileShader),
 	 _D(glGetShaderiv),
+	 _D(glGetShaderInfoLog),
 	 _D(glAttachShader),
 	 _D(glLinkProgram),
 	 _D(glGetProgramiv),
@@ -64,7 +70,27 @@ namespace GL
 	 _D(glGenBuffers),
 	 _D(glBindBuffer),
 	 _D(glBufferData),
+	 _D(glDeleteBuffers),
+	 _D(glMapBuffer),
+	 _D(glUnmapBuffer),
+	 _D(glCompressedTexImage2D),
+	 _D(glTexImage3D),
+	 _D(glTexSubImage3D),
 	 _D(glBindFramebuffer),
+	 _D(glGenFramebuffers),
+	 _D(glDeleteFramebuffers),
+	 _D(glFramebufferTexture2D),
+	 _D(glCheckFramebufferStatus),
+	 _D(glGenRenderbuffers),
+	 _D(glBindRenderbuffer),
+	 _D(glRenderbufferStorage),
+	 _D(glDeleteRenderbuffers),
+	 _D(glFramebufferRenderbuffer),
+	 _D(glReadPixels),
+	 _D(glMapBufferRange),
+	 _D(glFenceSync),
+	 _D(glClientWaitSync),
+	 _D(glDeleteSync),
 	 _D(glUseProgram),
 	 _D(glUniform1i),
          _D(glGetUniformLocation),
@@ -77,6 +103,16 @@ namespace GL
 	 _D(glDisableVertexAttribArray),
 	 _D(glVertexAttribDivisorARB),
 	 _D(glUniform4fv),
+#ifdef GL_VERSION_4_2
+	 _D(glTexStorage2D),
+#endif
+#if defined(GL_ARB_timer_query) || defined(GL_VERSION_3_3)
+	 _D(glGenQueries),
+	 _D(glDeleteQueries),
+	 _D(glQueryCounter),
+	 _D(glGetQueryObjectiv),
+	 _D(glGetQueryObjectui64v),
+#endif
 #endif
       };
 #undef _D
@@ -0,0 +1,260 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gputime.hpp"
+#include "stats.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(GLES)
+#ifdef GL_EXT_disjoint_timer_query
+#define GPUTIME_QUERIES
+// Extension functions aren't exported by every GLES library.
+static PFNGLGENQUERIESEXTPROC gen_queries;
+static PFNGLDELETEQUERIESEXTPROC delete_queries_ext;
+static PFNGLQUERYCOUNTEREXTPROC query_counter;
+static PFNGLGETQUERYOBJECTIVEXTPROC get_query_objectiv;
+static PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_objectui64v;
+#endif
+#elif defined(GL_ARB_timer_query) || defined(GL_VERSION_3_3)
+#define GPUTIME_QUERIES
+#endif
+
+static const char *pass_names[GPU_PASS_COUNT] = {
+   "upload",
+   "feedback",
+   "clear",
+   "scene",
+};
+
+static bool supported;
+static bool enabled;
+static bool in_frame;
+
+#ifdef GPUTIME_QUERIES
+static GLuint queries[GPUTIME_FRAMES][GPU_PASS_COUNT][2];
+#endif
+static bool queries_created;
+static unsigned issued[GPUTIME_FRAMES]; // Mask of the passes timed.
+static unsigned last_pass[GPUTIME_FRAMES];
+static unsigned frame_index;
+
+static struct stats_window pass_times[GPU_PASS_COUNT];
+
+static bool query_extension(const char *ext)
+{
+   const char *str = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   return str && strstr(str, ext);
+}
+
+#ifdef GPUTIME_QUERIES
+static void timestamp(GLuint query)
+{
+#ifdef GLES
+   query_counter(query, GL_TIMESTAMP_EXT);
+#else
+   SYM(glQueryCounter)(query, GL_TIMESTAMP);
+#endif
+}
+
+static bool result_available(GLuint query)
+{
+   GLint available = 0;
+#ifdef GLES
+   get_query_objectiv(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+#else
+   SYM(glGetQueryObjectiv)(query, GL_QUERY_RESULT_AVAILABLE, &available);
+#endif
+   return available != 0;
+}
+
+static GLuint64 result(GLuint query)
+{
+   GLuint64 time = 0;
+#ifdef GLES
+   get_query_objectui64v(query, GL_QUERY_RESULT_EXT, &time);
+#else
+   SYM(glGetQueryObjectui64v)(query, GL_QUERY_RESULT, &time);
+#endif
+   return time;
+}
+
+static bool disjoint(void)
+{
+#ifdef GLES
+   // Reading it clears it.
+   GLint disjoint = 0;
+   SYM(glGetIntegerv)(GL_GPU_DISJOINT_EXT, &disjoint);
+   return disjoint != 0;
+#else
+   return false;
+#endif
+}
+
+// Names that are not queries (the context was lost) are silently ignored,
+// and nothing else in the core makes queries.
+static void delete_queries(void)
+{
+   if (queries_created && supported)
+   {
+#ifdef GLES
+      delete_queries_ext(sizeof(queries) / sizeof(GLuint), &queries[0][0][0]);
+#else
+      SYM(glDeleteQueries)(sizeof(queries) / sizeof(GLuint), &queries[0][0][0]);
+#endif
+   }
+   queries_created = false;
+}
+
+// Reads back what the frame in slot index timed, if it is there by now.
+static void collect(unsigned index)
+{
+   if (!result_available(queries[index][last_pass[index]][1]) || disjoint())
+      return;
+
+   for (unsigned pass = 0; pass < GPU_PASS_COUNT; pass++)
+   {
+      if (!(issued[index] & (1u << pass)))
+         continue;
+
+      GLuint64 begin = result(queries[index][pass][0]);
+      GLuint64 end   = result(queries[index][pass][1]);
+      stats_add(&pass_times[pass], end > begin ? (end - begin) / 1000000.0f : 0.0f);
+   }
+}
+#endif
+
+void gputime_context_reset(void)
+{
+   memset(issued, 0, sizeof(issued));
+   frame_index = 0;
+   in_frame    = false;
+
+#if defined(GPUTIME_QUERIES) && defined(GLES)
+   gen_queries = (PFNGLGENQUERIESEXTPROC)GL::get_symbol("glGenQueriesEXT");
+   delete_queries_ext = (PFNGLDELETEQUERIESEXTPROC)GL::get_symbol("glDeleteQueriesEXT");
+   query_counter = (PFNGLQUERYCOUNTEREXTPROC)GL::get_symbol("glQueryCounterEXT");
+   get_query_objectiv = (PFNGLGETQUERYOBJECTIVEXTPROC)GL::get_symbol("glGetQueryObjectivEXT");
+   get_query_objectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)GL::get_symbol("glGetQueryObjectui64vEXT");
+   supported = query_extension("GL_EXT_disjoint_timer_query") &&
+      gen_queries && delete_queries_ext && query_counter && get_query_objectiv &&
+      get_query_objectui64v;
+
+   // The core also resets on option changes, when the context is still there.
+   delete_queries();
+   if (supported)
+      gen_queries(sizeof(queries) / sizeof(GLuint), &queries[0][0][0]);
+   queries_created = supported;
+#elif defined(GPUTIME_QUERIES)
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   unsigned major = 0, minor = 0;
+   if (version)
+      sscanf(version, "%u.%u", &major, &minor);
+
+   supported = (major > 3 || (major == 3 && minor >= 3) ||
+         query_extension("GL_ARB_timer_query")) &&
+      SYM(glGenQueries) && SYM(glDeleteQueries) && SYM(glQueryCounter) &&
+      SYM(glGetQueryObjectiv) && SYM(glGetQueryObjectui64v);
+
+   // The core also resets on option changes, when the context is still there.
+   delete_queries();
+   if (supported)
+      SYM(glGenQueries)(sizeof(queries) / sizeof(GLuint), &queries[0][0][0]);
+   queries_created = supported;
+#else
+   supported = false;
+   (void)query_extension;
+#endif
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "GPU timer queries: %s.\n", supported ? "yes" : "no");
+}
+
+void gputime_enable(bool enable)
+{
+   enabled = enable;
+   if (!enabled)
+      memset(issued, 0, sizeof(issued));
+}
+
+void gputime_frame_begin(void)
+{
+   if (!supported || !enabled)
+      return;
+
+#ifdef GPUTIME_QUERIES
+   if (issued[frame_index])
+      collect(frame_index);
+#endif
+   issued[frame_index] = 0;
+   in_frame = true;
+}
+
+void gputime_frame_end(void)
+{
+   if (!in_frame)
+      return;
+
+   frame_index = (frame_index + 1) % GPUTIME_FRAMES;
+   in_frame = false;
+}
+
+void gputime_begin(enum gpu_pass pass)
+{
+#ifdef GPUTIME_QUERIES
+   if (in_frame && !(issued[frame_index] & (1u << pass)))
+      timestamp(queries[frame_index][pass][0]);
+#else
+   (void)pass;
+#endif
+}
+
+void gputime_end(enum gpu_pass pass)
+{
+#ifdef GPUTIME_QUERIES
+   if (!in_frame || (issued[frame_index] & (1u << pass)))
+      return;
+
+   timestamp(queries[frame_index][pass][1]);
+   issued[frame_index]   |= 1u << pass;
+   last_pass[frame_index] = pass;
+#else
+   (void)pass;
+#endif
+}
+
+bool gputime_average(enum gpu_pass pass, float *ms)
+{
+   return stats_mean(&pass_times[pass], ms);
+}
+
+const char *gputime_pass_name(enum gpu_pass pass)
+{
+   return pass_names[pass];
+}
+
+void gputime_unload(void)
+{
+#ifdef GPUTIME_QUERIES
+   delete_queries();
+#endif
+   for (unsigned i = 0; i < GPU_PASS_COUNT; i++)
+      stats_clear(&pass_times[i]);
+   memset(issued, 0, sizeof(issued));
+   in_frame = false;
+}
@@ -0,0 +1,68 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GPUTIME_HPP__
+#define GPUTIME_HPP__
+
+#include "gl.hpp"
+
+// GPU time of each render pass, from timestamp queries written before and
+// after it (GL_ARB_timer_query, or GL_EXT_disjoint_timer_query on GLES).
+//
+// Queries go into a ring of GPUTIME_FRAMES frames and are only read back
+// when their slot comes round again, by which time the GPU is long done
+// with them, so reading never stalls. A frame whose results still aren't
+// there is dropped instead, as is one the GPU reports as disjoint (its
+// clock was reset, e.g. by a power state change). Results feed averages
+// over the last STATS_WINDOW frames that ran each pass.
+
+#define GPUTIME_FRAMES 4
+
+enum gpu_pass
+{
+   GPU_PASS_UPLOAD = 0, // Camera frames and content textures.
+   GPU_PASS_FEEDBACK,   // Virtual texture page feedback.
+   GPU_PASS_CLEAR,
+   GPU_PASS_SCENE,
+
+   GPU_PASS_COUNT
+};
+
+// Call from context_reset(). Queries from before are deleted, which does
+// nothing if the context was lost, and made again.
+void gputime_context_reset(void);
+
+// Timing is off until enabled; it is a no-op where queries are missing.
+void gputime_enable(bool enable);
+
+// Call around the GL work of retro_run(). Each pass is timed at most once
+// a frame.
+void gputime_frame_begin(void);
+void gputime_frame_end(void);
+
+void gputime_begin(enum gpu_pass pass);
+void gputime_end(enum gpu_pass pass);
+
+// Average milliseconds of a pass. False if it hasn't been measured.
+bool gputime_average(enum gpu_pass pass, float *ms);
+
+const char *gputime_pass_name(enum gpu_pass pass);
+
+// Deletes the queries and forgets all results. Call with the context current.
+void gputime_unload(void);
+
+#endif
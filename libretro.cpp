@@ -26,7 +26,22 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
 #include "rpng.h"
+#include "texloader.hpp"
+#include "texarray.hpp"
+#include "vtex.hpp"
+#include "capture.hpp"
+#include "camera.hpp"
+#include "camsource.hpp"
+#include "perf.hpp"
+#include "gputime.hpp"
 
 #include "gl.hpp"
 #include "glm/glm.hpp"
@@ -55,24 +70,6 @@ using namespace glm;
 #define MAX_HEIGHT 1600
 #endif
 
-#ifndef GL_BGRA_EXT
-#define GL_BGRA_EXT 0x80E1
-#endif
-
-#ifndef GL_UNPACK_ROW_LENGTH
-#define GL_UNPACK_ROW_LENGTH  0x0CF2
-#endif
-
-#ifdef GLES
-#define INTERNAL_FORMAT GL_BGRA_EXT
-#define TEX_TYPE        GL_BGRA_EXT
-#define TEX_FORMAT      GL_UNSIGNED_BYTE
-#else
-#define INTERNAL_FORMAT GL_RGBA
-#define TEX_TYPE        GL_BGRA
-#define TEX_FORMAT      GL_UNSIGNED_INT_8_8_8_8_REV
-#endif
-
 #if 0
 enum {
    LAUNCH_CATEGORY_GAME = 0,
@@ -88,14 +85,55 @@ static float cube_stride = 4.0f;
 static unsigned width = BASE_WIDTH;
 static unsigned height = BASE_HEIGHT;
 static bool camera_use = false;
-static bool support_unpack_row_length;
-static uint8_t *convert_buffer;
+static bool camera_synthetic;
 
 static std::string texpath;
+static bool wall_directory;
+static unsigned wall_layers;
+static unsigned image_width;
+static unsigned image_height;
+static std::string texture_cache_dir;
+static bool texture_cache_enable = true;
+static retro_time_t load_start_time;
+static bool first_frame_logged;
+static int screenshot_level = 1;
+static bool screenshot_held;
+
+enum stats_report_mode
+{
+   STATS_REPORT_DISABLED = 0,
+   STATS_REPORT_LOG,
+   STATS_REPORT_SCREEN
+};
+
+// Microseconds between reports.
+#define STATS_REPORT_INTERVAL 5000000
+
+static enum stats_report_mode stats_report;
+static retro_time_t stats_report_time;
+
+enum virtual_texture_mode
+{
+   VIRTUAL_TEXTURE_AUTO = 0,
+   VIRTUAL_TEXTURE_ALWAYS,
+   VIRTUAL_TEXTURE_DISABLED
+};
+
+// Auto only pages images bigger than GL_MAX_TEXTURE_SIZE.
+static enum virtual_texture_mode virtual_texture_mode;
+static bool virtual_texture;
+static bool virtual_texture_started;
+
+// prog samples palette indices (see texloader_palette()).
+static bool texture_indexed;
+// prog converts YUV camera frames (see camera_chroma()).
+static bool camera_yuv;
 
 static GLuint prog;
+static GLuint feedback_prog;
 static GLuint vbo;
 static GLuint tex;
+static bool tex_owned; // From texloader, which leaves deleting it to us.
 static GLuint g_texture_target = GL_TEXTURE_2D;
 static bool update;
 
@@ -109,6 +147,7 @@ struct Vertex
    GLfloat vert[4];
    GLfloat normal[4];
    GLfloat tex[2];
+   GLfloat layer;
 };
 
 struct Cube
@@ -209,41 +248,156 @@ static const char *vertex_shader[] = {
    "attribute vec4 aVertex;",
    "attribute vec4 aNormal;",
    "attribute vec2 aTexCoord;",
+   "attribute float aLayer;",
    "varying vec3 normal;",
    "varying vec4 model_pos;",
    "varying vec2 tex_coord;",
+   "varying float layer;",
    "void main() {",
    "  model_pos = uM * aVertex;",
    "  gl_Position = uVP * model_pos;",
    "  vec4 trans_normal = uM * aNormal;",
    "  normal = trans_normal.xyz;",
    "  tex_coord = vec2(1.0 - aTexCoord.x, aTexCoord.y);",
+   "  layer = aLayer;",
    "}",
 };
 
-static const char *fragment_shader[] = {
+static const char *fragment_shader_head[] = {
 #ifdef ANDROID
    "#extension GL_OES_EGL_image_external : require\n"
 #endif
 #ifdef GLES
+   // Only used by the virtual texture variant, harmless otherwise.
+   "#extension GL_OES_standard_derivatives : enable\n",
    "precision mediump float; \n",
+#else
+   // Only used by the texture array variant, harmless otherwise.
+   "#extension GL_EXT_texture_array : enable\n",
 #endif
-   "varying vec3 normal;",
-   "varying vec4 model_pos;",
-   "varying vec2 tex_coord;",
-   "uniform vec3 light_pos;",
-   "uniform vec4 ambient_light;",
+};
+
+// One of these defines sample_texture() for the body below.
+static const char *fragment_sample_2d[] = {
 #ifdef ANDROID
    // TODO - some kind of switching mechanism so we can switch between samplerExternalOES and sampler2D
    "uniform samplerExternalOES uTexture;",
 #else
    "uniform sampler2D uTexture;",
+#endif
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  return texture2D(uTexture, uv);",
+   "}",
+};
+
+// Indices are sampled with GL_NEAREST, so they never blend; the palette is 256x1.
+static const char *fragment_sample_indexed[] = {
+   "uniform sampler2D uTexture;",
+   "uniform sampler2D uPalette;",
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  float index = texture2D(uTexture, uv).r;",
+   "  return texture2D(uPalette, vec2(index * (255.0 / 256.0) + 0.5 / 256.0, 0.5));",
+   "}",
+};
+
+// Luma in uTexture, chroma in uChroma (U in luminance, V in alpha) at half
+// resolution. BT.601 limited range, as cameras deliver it.
+static const char *fragment_sample_nv12[] = {
+   "uniform sampler2D uTexture;",
+   "uniform sampler2D uChroma;",
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  float y = 1.164 * (texture2D(uTexture, uv).r - 16.0 / 255.0);",
+   "  vec2 c = texture2D(uChroma, uv).ra - 0.5;",
+   "  return vec4(y + 1.596 * c.y, y - 0.392 * c.x - 0.813 * c.y, y + 2.017 * c.x, 1.0);",
+   "}",
+};
+
+#ifndef GLES
+static const char *fragment_sample_array[] = {
+   "uniform sampler2DArray uTexture;",
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  return texture2DArray(uTexture, vec3(uv, layer));",
+   "}",
+};
 #endif
 
+// uAtlas is columns, rows and the half-texel inset of a tile.
+static const char *fragment_sample_atlas[] = {
+   "uniform sampler2D uTexture;",
+   "uniform vec4 uAtlas;",
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  float index = floor(layer + 0.5);",
+   "  vec2 tile = vec2(mod(index, uAtlas.x), floor(index / uAtlas.x));",
+   "  return texture2D(uTexture, (tile + clamp(uv, uAtlas.zw, 1.0 - uAtlas.zw)) / uAtlas.xy);",
+   "}",
+};
+
+// Pages are PYRAMID_TILE_CONTENT texels of one pyramid level. The page table
+// holds level 0 on the left and the rest stacked on the right; each entry is
+// the cache slot and level of the finest resident page covering it.
+// uVT0 is image width, height, last level and page table height,
+// uVT1 is tile content, border, tile size and cache size.
+static const char *fragment_sample_virtual[] = {
+   "#ifdef GL_ES\n",
+   "#ifdef GL_FRAGMENT_PRECISION_HIGH\n",
+   "precision highp float;\n",
+   "#endif\n",
+   "#endif\n",
+   "uniform sampler2D uTexture;",
+   "uniform sampler2D uPageTable;",
+   "uniform vec4 uVT0;",
+   "uniform vec4 uVT1;",
+   "uniform float uVTBias;",
+   "vec2 vt_texel(vec2 uv) {",
+   "  return clamp(vec2(uv.x, 1.0 - uv.y), 0.0, 0.99999) * uVT0.xy;",
+   "}",
+   "float vt_level(vec2 texel) {",
+   "  vec2 dx = dFdx(texel);",
+   "  vec2 dy = dFdy(texel);",
+   "  float d = max(max(dot(dx, dx), dot(dy, dy)), 1e-8);",
+   "  return clamp(floor(0.5 * log2(d) + uVTBias + 0.5), 0.0, uVT0.z);",
+   "}",
+   "vec2 vt_page(vec2 texel, float level) {",
+   "  return floor(texel * exp2(-level) / uVT1.x);",
+   "}",
+   "vec4 sample_texture(vec2 uv, float layer) {",
+   "  vec2 texel = vt_texel(uv);",
+   "  float level = vt_level(texel);",
+   "  vec2 origin = level < 0.5 ? vec2(0.0) : vec2(uVT0.w, uVT0.w - uVT0.w * exp2(1.0 - level));",
+   "  vec2 entry_uv = (origin + vt_page(texel, level) + 0.5) / vec2(2.0 * uVT0.w, uVT0.w);",
+   "  vec4 entry = floor(texture2D(uPageTable, entry_uv) * 255.0 + 0.5);",
+   "  vec2 offset = mod(texel * exp2(-entry.z), uVT1.x);",
+   "  return texture2D(uTexture, (entry.xy * uVT1.z + uVT1.y + offset) / uVT1.w);",
+   "}",
+   // Page and level + 1, unpacked by vtex_feedback_end().
+   "vec4 vt_feedback(vec2 uv) {",
+   "  vec2 texel = vt_texel(uv);",
+   "  float level = vt_level(texel);",
+   "  vec2 page = vt_page(texel, level);",
+   "  vec2 high = floor(page / 256.0);",
+   "  return vec4(page - high * 256.0, high.x + high.y * 16.0, level + 1.0) / 255.0;",
+   "}",
+};
+
+static const char *fragment_shader[] = {
+   "varying vec3 normal;",
+   "varying vec4 model_pos;",
+   "varying vec2 tex_coord;",
+   "varying float layer;",
+   "uniform vec3 light_pos;",
+   "uniform vec4 ambient_light;",
+
    "void main() {",
    "  vec3 diff = light_pos - model_pos.xyz;",
    "  float dist_mod = 100.0 * inversesqrt(dot(diff, diff));",
-   "  gl_FragColor = texture2D(uTexture, tex_coord) * (ambient_light + dist_mod * smoothstep(0.0, 1.0, dot(normalize(diff), normal)));",
+   "  gl_FragColor = sample_texture(tex_coord, layer) * (ambient_light + dist_mod * smoothstep(0.0, 1.0, dot(normalize(diff), normal)));",
+   "}",
+};
+
+static const char *fragment_feedback[] = {
+   "varying vec2 tex_coord;",
+   "void main() {",
+   "  gl_FragColor = vt_feedback(tex_coord);",
    "}",
 };
 
@@ -261,14 +415,19 @@ static void print_shader_log(GLuint shader)
    delete[] buffer;
 }
 
-static void compile_program(void)
+static GLuint compile_program(const char **sample, size_t sample_lines,
+      const char **body, size_t body_lines)
 {
-   prog = SYM(glCreateProgram)();
+   GLuint program = SYM(glCreateProgram)();
    GLuint vert = SYM(glCreateShader)(GL_VERTEX_SHADER);
    GLuint frag = SYM(glCreateShader)(GL_FRAGMENT_SHADER);
 
+   std::vector<const char*> frag_source(fragment_shader_head, fragment_shader_head + ARRAY_SIZE(fragment_shader_head));
+   frag_source.insert(frag_source.end(), sample, sample + sample_lines);
+   frag_source.insert(frag_source.end(), body, body + body_lines);
+
    SYM(glShaderSource)(vert, ARRAY_SIZE(vertex_shader), vertex_shader, 0);
-   SYM(glShaderSource)(frag, ARRAY_SIZE(fragment_shader), fragment_shader, 0);
+   SYM(glShaderSource)(frag, frag_source.size(), &frag_source[0], 0);
    SYM(glCompileShader)(vert);
    SYM(glCompileShader)(frag);
 
@@ -287,13 +446,19 @@ static void compile_program(void)
       print_shader_log(frag);
    }
 
-   SYM(glAttachShader)(prog, vert);
-   SYM(glAttachShader)(prog, frag);
-   SYM(glLinkProgram)(prog);
+   SYM(glAttachShader)(program, vert);
+   SYM(glAttachShader)(program, frag);
+   SYM(glLinkProgram)(program);
+
+   // Freed along with the program.
+   SYM(glDeleteShader)(vert);
+   SYM(glDeleteShader)(frag);
 
-   SYM(glGetProgramiv)(prog, GL_LINK_STATUS, &status);
+   SYM(glGetProgramiv)(program, GL_LINK_STATUS, &status);
    if (!status && log_cb)
       log_cb(RETRO_LOG_ERROR, "Program failed to link!\n");
+
+   return program;
 }
 
 static void setup_vao(void)
@@ -303,27 +468,62 @@ static void setup_vao(void)
    update = true;
 }
 
-static GLuint load_texture(const char *path)
+retro_time_t get_time_usec(void)
 {
-   uint8_t *data;
-   unsigned width, height;
-   if (!rpng_load_image_rgba(path, &data, &width, &height))
-   {
-      log_cb(RETRO_LOG_ERROR, "Couldn't load texture: %s\n", path);
-      return 0;
-   }
+#if defined(_WIN32)
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return count.QuadPart * 1000000 / freq.QuadPart;
+#elif defined(__APPLE__)
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (retro_time_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (retro_time_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+#endif
+}
+
+static const char *texture_cache_path(void)
+{
+   return texture_cache_enable ? texture_cache_dir.c_str() : NULL;
+}
 
-   GLuint tex;
-   SYM(glGenTextures)(1, &tex);
-   SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+static void update_texture(void)
+{
+   perf_begin(PERF_TEXTURE_LOAD);
 
-   SYM(glTexImage2D)(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-         0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-   free(data);
+   bool done;
+   if (wall_layers)
+      done = texarray_update(&tex);
+   else if (virtual_texture)
+      done = vtex_update(&tex);
+   else
+   {
+      done = texloader_update(&tex);
 
-   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-   return tex;
+      // Whether the image is a palette one is only known once it is decoded.
+      if (done && (texloader_palette() != 0) != texture_indexed)
+      {
+         texture_indexed = !texture_indexed;
+         SYM(glDeleteProgram)(prog);
+         if (texture_indexed)
+            prog = compile_program(fragment_sample_indexed, ARRAY_SIZE(fragment_sample_indexed),
+                  fragment_shader, ARRAY_SIZE(fragment_shader));
+         else
+            prog = compile_program(fragment_sample_2d, ARRAY_SIZE(fragment_sample_2d),
+                  fragment_shader, ARRAY_SIZE(fragment_shader));
+      }
+   }
+   perf_end(PERF_TEXTURE_LOAD);
+
+   if (done && log_cb)
+      log_cb(RETRO_LOG_INFO, "Time to full-quality texture: %.1f ms.\n",
+            (get_time_usec() - load_start_time) / 1000.0);
 }
 
 void retro_init(void)
@@ -334,10 +534,14 @@ void retro_init(void)
       log_cb = log.log;
    else
       log_cb = NULL;
+
+   perf_init(environ_cb);
 }
 
 void retro_deinit(void)
 {
+   if (stats_report != STATS_REPORT_DISABLED)
+      perf_report();
 }
 
 unsigned retro_api_version(void)
@@ -357,7 +561,7 @@ void retro_get_system_info(struct retro_system_info *info)
    info->library_name     = "InstancingViewer GL";
    info->library_version  = "v3";
    info->need_fullpath    = false;
-   info->valid_extensions = "png";
+   info->valid_extensions = "png|m3u";
 }
 
 void retro_get_system_av_info(struct retro_system_av_info *info)
@@ -393,12 +597,59 @@ void retro_set_environment(retro_environment_t cb)
          "launch_category",
          "Launch category; games|scene1|scene2|model1|model2" },
 #endif
+      {
+         "texture_cache",
+         "Texture cache; enabled|disabled" },
+      {
+         "texture_mipmaps",
+         "Texture mipmaps; cpu|gpu|disabled" },
+      {
+         "png_crc_check",
+         "PNG CRC check; enabled|disabled" },
+      {
+         "texture_compression",
+         "Texture compression; disabled|enabled" },
+      {
+         "texture_max_size",
+         "Texture size limit; auto|512|1024|2048|4096|8192" },
+      {
+         "texture_wall",
+         "Image wall (on next load); disabled|directory" },
+      {
+         "virtual_texture",
+         "Virtual texturing; auto|always|disabled" },
+#ifndef GLES
+      {
+         "texture_pbo",
+         "Texture upload via PBO; enabled|disabled" },
+#endif
+      {
+         "screenshot_compression",
+         "Screenshot compression (X button); fast|default|best" },
+      {
+         "stats_report",
+         "Performance stats; disabled|log|screen" },
       {
          "camera-use",
          "Camera Enable; false|true" },
       {
          "camera-type",
-         "Camera FB Type; texture|raw framebuffer" },
+         "Camera FB Type; texture|raw framebuffer|synthetic" },
+      {
+         "camera_synthetic_source",
+         "Synthetic camera frames; pattern|file" },
+      {
+         "camera_synthetic_size",
+         "Synthetic camera size; 640x480|320x240|1280x720|1920x1080|3840x2160" },
+      {
+         "camera_synthetic_rate",
+         "Synthetic camera rate; 30|15|60|120|unlimited" },
+      {
+         "camera_synthetic_stride",
+         "Synthetic camera rows; packed|padded" },
+      {
+         "camera_synthetic_format",
+         "Synthetic camera format; xrgb8888|nv12|i420" },
       { NULL, NULL },
    };
 
@@ -497,14 +748,101 @@ static void context_reset(void)
 
    GL::set_function_cb(hw_render.get_proc_address);
    GL::init_symbol_map();
-   compile_program();
-   setup_vao();
+
+   capture_context_reset();
+   gputime_context_reset();
+
+   const char **sample = fragment_sample_2d;
+   size_t sample_lines = ARRAY_SIZE(fragment_sample_2d);
+   virtual_texture = false;
+   texture_indexed = false;
+   camera_yuv = false;
+   tex_owned = false;
+
    if (camera_use)
    {
       tex = 0;
+      camera_context_reset();
+   }
+   else if (wall_layers)
+   {
+      float grid[4];
+      tex = texarray_context_reset(&g_texture_target);
+      if (texarray_atlas(grid))
+      {
+         sample = fragment_sample_atlas;
+         sample_lines = ARRAY_SIZE(fragment_sample_atlas);
+      }
+#ifndef GLES
+      else
+      {
+         sample = fragment_sample_array;
+         sample_lines = ARRAY_SIZE(fragment_sample_array);
+      }
+#endif
    }
    else
-      tex = load_texture(texpath.c_str());
+   {
+      GLint max_size = 0;
+      SYM(glGetIntegerv)(GL_MAX_TEXTURE_SIZE, &max_size);
+      virtual_texture = virtual_texture_mode == VIRTUAL_TEXTURE_ALWAYS ||
+         (virtual_texture_mode == VIRTUAL_TEXTURE_AUTO &&
+          std::max(image_width, image_height) > (unsigned)max_size);
+
+      g_texture_target = GL_TEXTURE_2D;
+      if (virtual_texture)
+      {
+         if (!virtual_texture_started)
+         {
+            vtex_start(texpath.c_str(), texture_cache_dir.c_str());
+            virtual_texture_started = true;
+         }
+         tex = vtex_context_reset();
+         sample = fragment_sample_virtual;
+         sample_lines = ARRAY_SIZE(fragment_sample_virtual);
+      }
+      else
+      {
+         texloader_start(texpath.c_str(), texture_cache_path());
+         tex = texloader_context_reset();
+         tex_owned = true;
+         if (texloader_palette())
+         {
+            texture_indexed = true;
+            sample = fragment_sample_indexed;
+            sample_lines = ARRAY_SIZE(fragment_sample_indexed);
+         }
+      }
+   }
+
+   prog = compile_program(sample, sample_lines, fragment_shader, ARRAY_SIZE(fragment_shader));
+   feedback_prog = 0;
+   if (virtual_texture)
+      feedback_prog = compile_program(sample, sample_lines, fragment_feedback, ARRAY_SIZE(fragment_feedback));
+   setup_vao();
+}
+
+// Option changes reinitialize on the context that is still current, which,
+// unlike a real context reset, still holds everything made on it.
+static void context_destroy(void)
+{
+   capture_context_destroy();
+   camera_context_destroy();
+   texloader_context_destroy();
+   vtex_context_destroy();
+   texarray_context_destroy();
+
+   if (tex_owned)
+      SYM(glDeleteTextures)(1, &tex);
+   tex = 0;
+   tex_owned = false;
+
+   SYM(glDeleteProgram)(prog);
+   SYM(glDeleteProgram)(feedback_prog);
+   SYM(glDeleteBuffers)(1, &vbo);
+   prog          = 0;
+   feedback_prog = 0;
+   vbo           = 0;
 }
 
 static void camera_initialized(void)
@@ -526,64 +864,64 @@ static void camera_gl_callback(unsigned texture_id, unsigned texture_target, con
 
 static void camera_raw_fb_callback(const uint32_t *buffer, unsigned width, unsigned height, size_t pitch)
 {
-   unsigned base_size = 4;
-   unsigned h;
+   camera_submit(buffer, width, height, pitch);
+}
 
-   if (!tex)
-   {
-      SYM(glGenTextures)(1, &tex);
-      SYM(glBindTexture)(GL_TEXTURE_2D, tex);
-      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      SYM(glTexImage2D)(GL_TEXTURE_2D, 0, INTERNAL_FORMAT, width, height, 0, TEX_TYPE, TEX_FORMAT, NULL);
-      if (!support_unpack_row_length)
-         convert_buffer = new uint8_t[width * height * 4];
-   }
-   else
-      SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+// The synthetic camera replays camera.raw from the system directory, in
+// the format and size set, or shows a test pattern.
+static void camera_synthetic_configure(void)
+{
+   struct camsource_config config;
+   memset(&config, 0, sizeof(config));
+   config.width  = 640;
+   config.height = 480;
+   config.rate   = 30;
 
-   if (support_unpack_row_length)
-   {
-      SYM(glPixelStorei)(GL_UNPACK_ROW_LENGTH, pitch / base_size);
-      SYM(glTexSubImage2D)(GL_TEXTURE_2D,
-            0, 0, 0, width, height, TEX_TYPE,
-            TEX_FORMAT, buffer);
+   struct retro_variable var;
+   var.key = "camera_synthetic_size";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      sscanf(var.value, "%ux%u", &config.width, &config.height);
 
-      SYM(glPixelStorei)(GL_UNPACK_ROW_LENGTH, 0);
-   }
-   else
-   {
-      // No GL_UNPACK_ROW_LENGTH ;(
-      unsigned pitch_width = pitch / base_size;
-      if (width == pitch_width) // Happy path :D
-      {
-         SYM(glTexSubImage2D)(GL_TEXTURE_2D,
-               0, 0, 0, width, height, TEX_TYPE,
-               TEX_FORMAT, buffer);
-      }
-      else // Slower path.
-      {
-         const unsigned line_bytes = width * base_size;
+   var.key = "camera_synthetic_rate";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      config.rate = strcmp(var.value, "unlimited") ? strtoul(var.value, NULL, 0) : 0;
 
-         uint8_t *dst = (uint8_t*)convert_buffer; // This buffer is preallocated for this purpose.
-         const uint8_t *src = (const uint8_t*)buffer;
+   var.key = "camera_synthetic_stride";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      config.padded = !strcmp(var.value, "padded");
 
-         for (h = 0; h < height; h++, src += pitch, dst += line_bytes)
-            memcpy(dst, src, line_bytes);
+   var.key = "camera_synthetic_format";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "nv12"))
+         config.format = CAMSOURCE_NV12;
+      else if (!strcmp(var.value, "i420"))
+         config.format = CAMSOURCE_I420;
+   }
 
-         SYM(glTexSubImage2D)(GL_TEXTURE_2D,
-               0, 0, 0, width, height, TEX_TYPE,
-               TEX_FORMAT, convert_buffer);         
-      }
+   std::string path;
+   var.key = "camera_synthetic_source";
+   var.value = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value &&
+         !strcmp(var.value, "file"))
+   {
+      path = texture_cache_dir.empty() ? std::string("camera.raw") : texture_cache_dir + "/camera.raw";
+      config.path = path.c_str();
    }
 
-   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+   camsource_configure(&config, camera_raw_fb_callback);
+   camera_cb.start = camsource_start;
+   camera_cb.stop  = camsource_stop;
 }
 
 static bool camera_prepare(void)
 {
+   camera_synthetic = false;
+
    struct retro_variable camvar = { "camera-type" };
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &camvar) && camvar.value)
    {
@@ -596,8 +934,11 @@ static bool camera_prepare(void)
       {
          camera_cb.caps = (1 << RETRO_CAMERA_BUFFER_RAW_FRAMEBUFFER);
          camera_cb.frame_raw_framebuffer = camera_raw_fb_callback;
+         camera_synthetic = !strcmp(camvar.value, "synthetic");
       }
    }
+   if (!camera_synthetic)
+      camsource_stop();
 
    struct retro_variable camuse = { "camera-use" };
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &camuse) && camuse.value)
@@ -606,7 +947,9 @@ static bool camera_prepare(void)
       {
          camera_cb.initialized = camera_initialized;
 
-         if (!environ_cb(RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE, &camera_cb))
+         if (camera_synthetic)
+            camera_synthetic_configure();
+         else if (!environ_cb(RETRO_ENVIRONMENT_GET_CAMERA_INTERFACE, &camera_cb))
          {
             if (log_cb)
                log_cb(RETRO_LOG_ERROR, "camera is not supported.\n");
@@ -659,6 +1002,17 @@ static vec3 check_input()
    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT))
       player_pos += s * look_dir_side;
 
+   bool screenshot = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_X);
+   if (screenshot && !screenshot_held)
+   {
+      size_t slash = texpath.find_last_of("/\\");
+      std::string name = slash == std::string::npos ? texpath : texpath.substr(slash + 1);
+      name = name.substr(0, name.find_last_of('.'));
+      std::string dir = texture_cache_dir.empty() ? std::string() : texture_cache_dir + "/screenshots";
+      capture_request(dir.c_str(), name.c_str(), screenshot_level);
+   }
+   screenshot_held = screenshot;
+
 #if 0
    static unsigned select_timeout = 0;
 
@@ -746,6 +1100,96 @@ static void update_variables(void)
       reinit = true;
    }
 
+   var.key = "texture_cache";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      texture_cache_enable = strcmp(var.value, "disabled") != 0;
+
+   var.key = "texture_mipmaps";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "gpu") == 0)
+         texloader_set_mipmaps(TEXLOADER_MIPMAPS_GPU);
+      else if (strcmp(var.value, "disabled") == 0)
+         texloader_set_mipmaps(TEXLOADER_MIPMAPS_DISABLED);
+      else
+         texloader_set_mipmaps(TEXLOADER_MIPMAPS_CPU);
+   }
+
+   var.key = "png_crc_check";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      rpng_set_crc_check(strcmp(var.value, "disabled") != 0);
+
+   var.key = "texture_wall";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      wall_directory = strcmp(var.value, "directory") == 0;
+
+   var.key = "virtual_texture";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "always") == 0)
+         virtual_texture_mode = VIRTUAL_TEXTURE_ALWAYS;
+      else if (strcmp(var.value, "disabled") == 0)
+         virtual_texture_mode = VIRTUAL_TEXTURE_DISABLED;
+      else
+         virtual_texture_mode = VIRTUAL_TEXTURE_AUTO;
+   }
+
+   var.key = "texture_compression";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      texloader_set_compression(strcmp(var.value, "enabled") == 0);
+
+   var.key = "texture_max_size";
+   var.value = NULL;
+
+   // Auto is whatever GL_MAX_TEXTURE_SIZE allows.
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      texloader_set_max_size(strtoul(var.value, NULL, 0));
+
+   var.key = "screenshot_compression";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "best") == 0)
+         screenshot_level = 9;
+      else if (strcmp(var.value, "default") == 0)
+         screenshot_level = 6;
+      else
+         screenshot_level = 1;
+   }
+
+   var.key = "stats_report";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (strcmp(var.value, "screen") == 0)
+         stats_report = STATS_REPORT_SCREEN;
+      else if (strcmp(var.value, "log") == 0)
+         stats_report = STATS_REPORT_LOG;
+      else
+         stats_report = STATS_REPORT_DISABLED;
+      gputime_enable(stats_report != STATS_REPORT_DISABLED);
+   }
+
+   var.key = "texture_pbo";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      texloader_set_pbo(strcmp(var.value, "disabled") != 0);
+
    /*
    var.key = "launch_category";
    var.value = NULL;
@@ -770,124 +1214,302 @@ static void update_variables(void)
    }
 
    if (!first_init && reinit)
+   {
+      context_destroy();
       context_reset();
+   }
 }
 
-void retro_run(void)
+static void update_cubes(void)
 {
-   bool updated = false;
-   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
-      update_variables();
+   update = false;
+   SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
 
-   vec3 look_dir = check_input();
+   std::vector<Cube> cubes;
+   cubes.resize(cube_size * cube_size * cube_size);
 
-   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, hw_render.get_current_framebuffer());
-   SYM(glClearColor)(0.1, 0.1, 0.1, 1.0);
-   SYM(glViewport)(0, 0, width, height);
-   SYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   for (unsigned x = 0; x < cube_size; x++)
+   {
+      for (unsigned y = 0; y < cube_size; y++)
+      {
+         for (unsigned z = 0; z < cube_size; z++)
+         {
+            unsigned index = (cube_size * cube_size * z) + (cube_size * y) + x;
+            Cube &cube = cubes[index];
+
+            float off_x = cube_stride * ((float)x - cube_size / 2);
+            float off_y = cube_stride * ((float)y - cube_size / 2);
+            float off_z = -100.0f + cube_stride * ((float)z - cube_size / 2);
+
+            for (unsigned v = 0; v < 36; v++)
+            {
+               cube.vertices[v] = vertex_data_ptr[indices[v]];
+               cube.vertices[v].vert[0] += off_x;
+               cube.vertices[v].vert[1] += off_y;
+               cube.vertices[v].vert[2] += off_z;
+               cube.vertices[v].layer = wall_layers ? index % wall_layers : 0;
+            }
+         }
+      }
+   }
+   SYM(glBufferData)(GL_ARRAY_BUFFER, cube_size * cube_size * cube_size * sizeof(Cube), &cubes[0], GL_STATIC_DRAW);
+   SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+}
+
+// Attributes a program doesn't use (the feedback program has no lighting) are skipped.
+static int enable_attrib(GLuint program, const char *name, GLint components, size_t offset)
+{
+   int loc = SYM(glGetAttribLocation)(program, name);
+   if (loc >= 0)
+   {
+      SYM(glVertexAttribPointer)(loc, components, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offset);
+      SYM(glEnableVertexAttribArray)(loc);
+   }
+   return loc;
+}
 
-   SYM(glUseProgram)(prog);
+static void disable_attrib(int loc)
+{
+   if (loc >= 0)
+      SYM(glDisableVertexAttribArray)(loc);
+}
+
+// Draws every cube with program into the bound framebuffer.
+static void draw_scene(GLuint program, const mat4 &vp, bool feedback)
+{
+   perf_begin(PERF_UNIFORMS);
+   SYM(glUseProgram)(program);
 
    SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
-   int vloc = SYM(glGetAttribLocation)(prog, "aVertex");
-   SYM(glVertexAttribPointer)(vloc, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, vert)));
-   SYM(glEnableVertexAttribArray)(vloc);
-   int nloc = SYM(glGetAttribLocation)(prog, "aNormal");
-   SYM(glVertexAttribPointer)(nloc, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, normal)));
-   SYM(glEnableVertexAttribArray)(nloc);
-   int tcloc = SYM(glGetAttribLocation)(prog, "aTexCoord");
-   SYM(glVertexAttribPointer)(tcloc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, tex)));
-   SYM(glEnableVertexAttribArray)(tcloc);
+   int vloc = enable_attrib(program, "aVertex", 4, offsetof(Vertex, vert));
+   int nloc = enable_attrib(program, "aNormal", 4, offsetof(Vertex, normal));
+   int tcloc = enable_attrib(program, "aTexCoord", 2, offsetof(Vertex, tex));
+   int lyloc = enable_attrib(program, "aLayer", 1, offsetof(Vertex, layer));
 
    SYM(glEnable)(GL_DEPTH_TEST);
    SYM(glEnable)(GL_CULL_FACE);
 
-   int tloc = SYM(glGetUniformLocation)(prog, "uTexture");
+   int tloc = SYM(glGetUniformLocation)(program, "uTexture");
    SYM(glUniform1i)(tloc, 0);
    SYM(glActiveTexture)(GL_TEXTURE0);
 
    SYM(glBindTexture)(g_texture_target, tex);
 
-   int lloc = SYM(glGetUniformLocation)(prog, "light_pos");
+   if (virtual_texture)
+      vtex_bind(program, feedback, width);
+
+   if (texture_indexed)
+   {
+      SYM(glUniform1i)(SYM(glGetUniformLocation)(program, "uPalette"), 1);
+      SYM(glActiveTexture)(GL_TEXTURE1);
+      SYM(glBindTexture)(GL_TEXTURE_2D, texloader_palette());
+      SYM(glActiveTexture)(GL_TEXTURE0);
+   }
+   else if (camera_yuv)
+   {
+      SYM(glUniform1i)(SYM(glGetUniformLocation)(program, "uChroma"), 1);
+      SYM(glActiveTexture)(GL_TEXTURE1);
+      SYM(glBindTexture)(GL_TEXTURE_2D, camera_chroma());
+      SYM(glActiveTexture)(GL_TEXTURE0);
+   }
+
+   int lloc = SYM(glGetUniformLocation)(program, "light_pos");
    vec3 light_pos(0, 150, 15);
    SYM(glUniform3fv)(lloc, 1, &light_pos[0]);
 
    vec4 ambient_light(0.2, 0.2, 0.2, 1.0);
-   lloc = SYM(glGetUniformLocation)(prog, "ambient_light");
+   lloc = SYM(glGetUniformLocation)(program, "ambient_light");
    SYM(glUniform4fv)(lloc, 1, &ambient_light[0]);
 
-   int vploc = SYM(glGetUniformLocation)(prog, "uVP");
-   mat4 view = lookAt(player_pos, player_pos + look_dir, vec3(0, 1, 0));
-   mat4 proj = scale(mat4(1.0), vec3(1, -1, 1)) * perspective(45.0f, 640.0f / 480.0f, 5.0f, 500.0f);
-   mat4 vp = proj * view;
+   float grid[4];
+   if (wall_layers && texarray_atlas(grid))
+      SYM(glUniform4fv)(SYM(glGetUniformLocation)(program, "uAtlas"), 1, grid);
+
+   int vploc = SYM(glGetUniformLocation)(program, "uVP");
    SYM(glUniformMatrix4fv)(vploc, 1, GL_FALSE, &vp[0][0]);
 
-   int modelloc = SYM(glGetUniformLocation)(prog, "uM");
+   int modelloc = SYM(glGetUniformLocation)(program, "uM");
    mat4 model = mat4(1.0);
    SYM(glUniformMatrix4fv)(modelloc, 1, GL_FALSE, &model[0][0]);
+   perf_end(PERF_UNIFORMS);
 
-   if (update)
+   perf_begin(PERF_DRAW);
+   SYM(glDrawArrays)(GL_TRIANGLES, 0, 36 * cube_size * cube_size * cube_size);
+   perf_end(PERF_DRAW);
+
+   SYM(glUseProgram)(0);
+   SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
+   disable_attrib(vloc);
+   disable_attrib(nloc);
+   disable_attrib(tcloc);
+   disable_attrib(lyloc);
+   SYM(glBindTexture)(g_texture_target, 0);
+
+   if (texture_indexed || camera_yuv)
+   {
+      SYM(glActiveTexture)(GL_TEXTURE1);
+      SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+      SYM(glActiveTexture)(GL_TEXTURE0);
+   }
+}
+
+// Logs what was measured since the last report, and shows it too if asked.
+static void report_stats(void)
+{
+   retro_time_t now = get_time_usec();
+   if (now - stats_report_time < STATS_REPORT_INTERVAL)
+      return;
+   stats_report_time = now;
+
+   perf_report();
+
+   std::string screen;
+   char text[256];
+   int len = snprintf(text, sizeof(text), "GPU ms:");
+   for (unsigned i = 0; i < GPU_PASS_COUNT; i++)
+   {
+      float ms;
+      if (gputime_average((enum gpu_pass)i, &ms) && len < (int)sizeof(text))
+         len += snprintf(text + len, sizeof(text) - len, " %s %.2f",
+               gputime_pass_name((enum gpu_pass)i), ms);
+   }
+   if (strcmp(text, "GPU ms:") != 0)
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "%s.\n", text);
+      screen = text;
+   }
+
+   struct camera_latency latency;
+   if (camera_use && camera_latency(&latency))
    {
-      update = false;
-      SYM(glBindBuffer)(GL_ARRAY_BUFFER, vbo);
+      snprintf(text, sizeof(text),
+            "Camera latency p50/p95/p99: upload %.1f/%.1f/%.1f ms, "
+            "present %.1f/%.1f/%.1f ms (%u shown, %u dropped)",
+            latency.upload[0], latency.upload[1], latency.upload[2],
+            latency.present[0], latency.present[1], latency.present[2],
+            latency.shown, latency.dropped);
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "%s.\n", text);
+      screen += screen.empty() ? text : std::string("; ") + text;
+   }
+
+   if (stats_report == STATS_REPORT_SCREEN && !screen.empty())
+   {
+      struct retro_message msg = { screen.c_str(), 300 };
+      environ_cb(RETRO_ENVIRONMENT_SET_MESSAGE, (void*)&msg);
+   }
+}
+
+void retro_run(void)
+{
+   bool updated = false;
+   perf_begin(PERF_VARIABLES);
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
+      update_variables();
+   perf_end(PERF_VARIABLES);
+
+   perf_begin(PERF_INPUT);
+   vec3 look_dir = check_input();
+   perf_end(PERF_INPUT);
 
-      std::vector<Cube> cubes;
-      cubes.resize(cube_size * cube_size * cube_size);
+   bool camera_raw = camera_use && (camera_cb.caps & (1 << RETRO_CAMERA_BUFFER_RAW_FRAMEBUFFER));
 
-      for (unsigned x = 0; x < cube_size; x++)
+   gputime_frame_begin();
+   gputime_begin(GPU_PASS_UPLOAD);
+
+   if (!camera_use)
+      update_texture();
+   else if (camera_raw)
+   {
+      perf_begin(PERF_CAMERA_UPLOAD);
+      tex = camera_update();
+      perf_end(PERF_CAMERA_UPLOAD);
+
+      // Frames may switch between XRGB and YUV as they come.
+      if ((camera_chroma() != 0) != camera_yuv)
       {
-         for (unsigned y = 0; y < cube_size; y++)
-         {
-            for (unsigned z = 0; z < cube_size; z++)
-            {
-               Cube &cube = cubes[((cube_size * cube_size * z) + (cube_size * y) + x)];
-
-               float off_x = cube_stride * ((float)x - cube_size / 2);
-               float off_y = cube_stride * ((float)y - cube_size / 2);
-               float off_z = -100.0f + cube_stride * ((float)z - cube_size / 2);
-
-               for (unsigned v = 0; v < 36; v++)
-               {
-                  cube.vertices[v] = vertex_data_ptr[indices[v]];
-                  cube.vertices[v].vert[0] += off_x;
-                  cube.vertices[v].vert[1] += off_y;
-                  cube.vertices[v].vert[2] += off_z;
-               }
-            }
-         }
+         camera_yuv = !camera_yuv;
+         SYM(glDeleteProgram)(prog);
+         if (camera_yuv)
+            prog = compile_program(fragment_sample_nv12, ARRAY_SIZE(fragment_sample_nv12),
+                  fragment_shader, ARRAY_SIZE(fragment_shader));
+         else
+            prog = compile_program(fragment_sample_2d, ARRAY_SIZE(fragment_sample_2d),
+                  fragment_shader, ARRAY_SIZE(fragment_shader));
       }
-      SYM(glBufferData)(GL_ARRAY_BUFFER, cube_size * cube_size * cube_size * sizeof(Cube), &cubes[0], GL_STATIC_DRAW);
-      SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
    }
 
-   SYM(glDrawArrays)(GL_TRIANGLES, 0, 36 * cube_size * cube_size * cube_size);
+   gputime_end(GPU_PASS_UPLOAD);
 
-   SYM(glUseProgram)(0);
-   SYM(glBindBuffer)(GL_ARRAY_BUFFER, 0);
-   SYM(glDisableVertexAttribArray)(vloc);
-   SYM(glDisableVertexAttribArray)(nloc);
-   SYM(glDisableVertexAttribArray)(tcloc);
-   SYM(glBindTexture)(g_texture_target, 0);
+   mat4 view = lookAt(player_pos, player_pos + look_dir, vec3(0, 1, 0));
+   mat4 proj = scale(mat4(1.0), vec3(1, -1, 1)) * perspective(45.0f, 640.0f / 480.0f, 5.0f, 500.0f);
+   mat4 vp = proj * view;
 
-   video_cb(RETRO_HW_FRAME_BUFFER_VALID, width, height, 0);
-}
+   if (update)
+   {
+      perf_begin(PERF_GEOMETRY);
+      update_cubes();
+      perf_end(PERF_GEOMETRY);
+   }
 
+   // The virtual texture learns which pages are visible from a smaller pre-pass.
+   if (virtual_texture && vtex_feedback_begin())
+   {
+      gputime_begin(GPU_PASS_FEEDBACK);
+      draw_scene(feedback_prog, vp, true);
+      vtex_feedback_end();
+      gputime_end(GPU_PASS_FEEDBACK);
+   }
 
-static inline bool gl_query_extension(const char *ext)
-{
-#ifdef ANDROID
-   /* FIXME - glGetString at this point fails on Android 4.4 (but not 4.0 to 4.3) - so return false for now */
-   return false;
-#else
-   const char *str = (const char*)SYM(glGetString)(GL_EXTENSIONS);
-   bool ret = str && strstr(str, ext);
+   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, hw_render.get_current_framebuffer());
+   SYM(glClearColor)(0.1, 0.1, 0.1, 1.0);
+   SYM(glViewport)(0, 0, width, height);
+   gputime_begin(GPU_PASS_CLEAR);
+   SYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   gputime_end(GPU_PASS_CLEAR);
 
-   return ret;
-#endif
+   gputime_begin(GPU_PASS_SCENE);
+   draw_scene(prog, vp, false);
+   gputime_end(GPU_PASS_SCENE);
+   gputime_frame_end();
+
+   bool saved;
+   std::string screenshot;
+   if (capture_update(width, height, &saved, &screenshot))
+   {
+      std::string text = saved ? "Saved " + screenshot : "Couldn't save " + screenshot;
+      struct retro_message msg = { text.c_str(), 180 };
+      environ_cb(RETRO_ENVIRONMENT_SET_MESSAGE, (void*)&msg);
+      if (log_cb)
+         log_cb(saved ? RETRO_LOG_INFO : RETRO_LOG_ERROR, "%s\n", text.c_str());
+   }
+
+   perf_begin(PERF_VIDEO);
+   video_cb(RETRO_HW_FRAME_BUFFER_VALID, width, height, 0);
+   perf_end(PERF_VIDEO);
+
+   if (camera_raw)
+      camera_presented();
+   if (stats_report != STATS_REPORT_DISABLED)
+      report_stats();
+
+   if (!first_frame_logged)
+   {
+      first_frame_logged = true;
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Time to first frame: %.1f ms.\n",
+               (get_time_usec() - load_start_time) / 1000.0);
+   }
 }
 
 bool retro_load_game(const struct retro_game_info *info)
 {
+   load_start_time = get_time_usec();
+   first_frame_logged = false;
+   stats_report_time = load_start_time;
+
    update_variables();
    memset(&camera_cb, 0, sizeof(camera_cb));
 
@@ -899,6 +1521,12 @@ bool retro_load_game(const struct retro_game_info *info)
       return false;
    }
 
+   const char *system_dir = NULL;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &system_dir) && system_dir)
+      texture_cache_dir = std::string(system_dir) + "/instancingviewer";
+   else
+      texture_cache_dir.clear();
+
    if (!camera_prepare())
       return false;
 
@@ -912,23 +1540,43 @@ bool retro_load_game(const struct retro_game_info *info)
    if (!environ_cb(RETRO_ENVIRONMENT_SET_HW_RENDER, &hw_render))
       return false;
 
-#ifdef GLES
-   if (camera_cb.caps & (1 << RETRO_CAMERA_BUFFER_RAW_FRAMEBUFFER) && !gl_query_extension("BGRA8888"))
-   {
-      if (log_cb)
-         log_cb(RETRO_LOG_ERROR, "no BGRA8888 support for raw framebuffer, exiting...\n");
-      return false;
-   }
-   support_unpack_row_length = gl_query_extension("GL_EXT_unpack_subimage");
-#else
-   support_unpack_row_length = true;
-#endif
-
    if (log_cb)
       log_cb(RETRO_LOG_INFO, "Loaded game!\n");
    player_pos = vec3(0, 0, 0);
    texpath = info->path;
 
+   // A playlist, or the image's directory with the wall enabled,
+   // puts a different image on each cube.
+   std::vector<std::string> wall_paths;
+   std::string ext = texpath.substr(std::min(texpath.size(), texpath.find_last_of('.')));
+   if (ext == ".m3u" && !texarray_read_playlist(texpath.c_str(), &wall_paths) && log_cb)
+      log_cb(RETRO_LOG_ERROR, "No images in playlist: %s\n", texpath.c_str());
+   else if (ext != ".m3u" && wall_directory)
+   {
+      size_t slash = texpath.find_last_of("/\\");
+      std::string dir = slash == std::string::npos ? "." : texpath.substr(0, slash);
+      texarray_list_directory(dir.c_str(), &wall_paths);
+   }
+
+   // Only the header is read here. Whether the image gets paged depends on
+   // GL_MAX_TEXTURE_SIZE, so the decode of anything that might be isn't started early.
+   image_width = image_height = 0;
+   rpng_stream_t *probe = ext != ".m3u" ? rpng_stream_open(texpath.c_str(), &image_width, &image_height) : NULL;
+   if (probe)
+      rpng_stream_close(probe);
+   bool maybe_virtual = virtual_texture_mode == VIRTUAL_TEXTURE_ALWAYS ||
+      (virtual_texture_mode == VIRTUAL_TEXTURE_AUTO && std::max(image_width, image_height) > 2048);
+
+   wall_layers = 0;
+   virtual_texture_started = false;
+   if (!camera_use && !wall_paths.empty())
+   {
+      wall_layers = texarray_start(wall_paths);
+      update = true;
+   }
+   else if (!camera_use && !maybe_virtual)
+      texloader_start(texpath.c_str(), texture_cache_path());
+
    first_init = false;
 
    return true;
@@ -936,9 +1584,22 @@ bool retro_load_game(const struct retro_game_info *info)
 
 void retro_unload_game(void)
 {
-   if (convert_buffer)
-      delete[] convert_buffer;
-   convert_buffer = NULL;
+   // Frames may be on their way into the mailbox, from a frontend camera
+   // thread as well. Nothing may submit once the slots are freed.
+   if (camera_use)
+      camera_cb.stop();
+   camera_use = false;
+   camsource_stop();
+   camera_unload();
+
+   texloader_unload();
+   texarray_unload();
+   vtex_unload();
+   capture_unload();
+   gputime_unload();
+   wall_layers = 0;
+   virtual_texture = false;
+   virtual_texture_started = false;
 }
 
 unsigned retro_get_region(void)
@@ -0,0 +1,375 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mipmap.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIPMAP_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIPMAP_NEON
+#endif
+
+// Four 14-bit texels still sum without overflowing a 16-bit lane.
+#define LINEAR_BITS 14
+#define LINEAR_MAX ((1 << LINEAR_BITS) - 1)
+
+static struct srgb_tables
+{
+   uint16_t to_linear[256];
+   uint8_t from_linear[LINEAR_MAX + 1];
+
+   srgb_tables()
+   {
+      for (unsigned i = 0; i < 256; i++)
+      {
+         double c = i / 255.0;
+         double l = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+         to_linear[i] = (uint16_t)(l * LINEAR_MAX + 0.5);
+      }
+
+      for (unsigned i = 0; i <= LINEAR_MAX; i++)
+      {
+         double l = i / (double)LINEAR_MAX;
+         double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+         from_linear[i] = (uint8_t)(c * 255.0 + 0.5);
+      }
+   }
+} tables;
+
+// 8-bit to 14-bit by bit replication, so 0xff maps to LINEAR_MAX exactly.
+static inline uint16_t expand_unorm(uint8_t v)
+{
+   return (v << 6) | (v >> 2);
+}
+
+static inline uint8_t compress_unorm(unsigned v)
+{
+   v = (v + 32) >> 6;
+   return v > 0xff ? 0xff : v;
+}
+
+static void expand_row(const uint8_t *src, uint16_t *dst, unsigned width, bool srgb)
+{
+   unsigned i = 0;
+   unsigned count = width * 4;
+
+   if (srgb)
+   {
+      for (; i < count; i += 4)
+      {
+         dst[i + 0] = tables.to_linear[src[i + 0]];
+         dst[i + 1] = tables.to_linear[src[i + 1]];
+         dst[i + 2] = tables.to_linear[src[i + 2]];
+         dst[i + 3] = expand_unorm(src[i + 3]);
+      }
+      return;
+   }
+
+#if defined(MIPMAP_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   for (; i + 16 <= count; i += 16)
+   {
+      __m128i v  = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+      lo = _mm_or_si128(_mm_slli_epi16(lo, 6), _mm_srli_epi16(lo, 2));
+      hi = _mm_or_si128(_mm_slli_epi16(hi, 6), _mm_srli_epi16(hi, 2));
+      _mm_storeu_si128((__m128i*)(dst + i), lo);
+      _mm_storeu_si128((__m128i*)(dst + i + 8), hi);
+   }
+#elif defined(MIPMAP_NEON)
+   for (; i + 16 <= count; i += 16)
+   {
+      uint8x16_t v  = vld1q_u8(src + i);
+      uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+      uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+      vst1q_u16(dst + i,     vorrq_u16(vshlq_n_u16(lo, 6), vshrq_n_u16(lo, 2)));
+      vst1q_u16(dst + i + 8, vorrq_u16(vshlq_n_u16(hi, 6), vshrq_n_u16(hi, 2)));
+   }
+#endif
+
+   for (; i < count; i++)
+      dst[i] = expand_unorm(src[i]);
+}
+
+static void compress_row(const uint16_t *src, uint8_t *dst, unsigned width, bool srgb)
+{
+   unsigned i = 0;
+   unsigned count = width * 4;
+
+   if (srgb)
+   {
+      for (; i < count; i += 4)
+      {
+         dst[i + 0] = tables.from_linear[src[i + 0]];
+         dst[i + 1] = tables.from_linear[src[i + 1]];
+         dst[i + 2] = tables.from_linear[src[i + 2]];
+         dst[i + 3] = compress_unorm(src[i + 3]);
+      }
+      return;
+   }
+
+#if defined(MIPMAP_SSE2)
+   const __m128i round = _mm_set1_epi16(32);
+   for (; i + 16 <= count; i += 16)
+   {
+      __m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 8));
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 6);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 6);
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+   }
+#elif defined(MIPMAP_NEON)
+   for (; i + 16 <= count; i += 16)
+   {
+      uint16x8_t lo = vld1q_u16(src + i);
+      uint16x8_t hi = vld1q_u16(src + i + 8);
+      vst1q_u8(dst + i, vcombine_u8(vqrshrn_n_u16(lo, 6), vqrshrn_n_u16(hi, 6)));
+   }
+#endif
+
+   for (; i < count; i++)
+      dst[i] = compress_unorm(src[i]);
+}
+
+// Averages 2x2 blocks of two expanded source rows into one expanded destination row.
+static void box_rows(const uint16_t *r0, const uint16_t *r1, uint16_t *dst,
+      unsigned src_width, unsigned dst_width)
+{
+   unsigned x = 0;
+
+#if defined(MIPMAP_SSE2)
+   const __m128i two = _mm_set1_epi16(2);
+   for (; 2 * x + 4 <= src_width && x + 2 <= dst_width; x += 2)
+   {
+      // Two source texels per register, four per row.
+      __m128i s0 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0 + 8 * x)),
+            _mm_loadu_si128((const __m128i*)(r1 + 8 * x)));
+      __m128i s1 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0 + 8 * x + 8)),
+            _mm_loadu_si128((const __m128i*)(r1 + 8 * x + 8)));
+      __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+      _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_srli_epi16(_mm_add_epi16(sum, two), 2));
+   }
+#elif defined(MIPMAP_NEON)
+   for (; 2 * x + 4 <= src_width && x + 2 <= dst_width; x += 2)
+   {
+      uint16x8_t s0 = vaddq_u16(vld1q_u16(r0 + 8 * x), vld1q_u16(r1 + 8 * x));
+      uint16x8_t s1 = vaddq_u16(vld1q_u16(r0 + 8 * x + 8), vld1q_u16(r1 + 8 * x + 8));
+      uint16x8_t sum = vaddq_u16(vcombine_u16(vget_low_u16(s0), vget_low_u16(s1)),
+            vcombine_u16(vget_high_u16(s0), vget_high_u16(s1)));
+      vst1q_u16(dst + 4 * x, vrshrq_n_u16(sum, 2));
+   }
+#endif
+
+   for (; x < dst_width; x++)
+   {
+      unsigned x0 = 4 * std::min(2 * x, src_width - 1);
+      unsigned x1 = 4 * std::min(2 * x + 1, src_width - 1);
+      for (unsigned c = 0; c < 4; c++)
+         dst[4 * x + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2;
+   }
+}
+
+void mipmap_downsample_rows_rgba8(const uint8_t *row0, const uint8_t *row1, unsigned width,
+      uint8_t *dst, unsigned dst_width, bool srgb, uint16_t *scratch)
+{
+   uint16_t *exp0 = scratch;
+   uint16_t *exp1 = scratch + width * 4;
+   uint16_t *out  = scratch + width * 8;
+
+   expand_row(row0, exp0, width, srgb);
+   if (row1 != row0)
+      expand_row(row1, exp1, width, srgb);
+
+   box_rows(exp0, row1 != row0 ? exp1 : exp0, out, width, dst_width);
+   compress_row(out, dst, dst_width, srgb);
+}
+
+void mipmap_downsample_rgba8(const uint8_t *src, unsigned width, unsigned height,
+      uint8_t *dst, bool srgb)
+{
+   unsigned dst_width  = std::max(width >> 1, 1u);
+   unsigned dst_height = std::max(height >> 1, 1u);
+   size_t src_pitch = width * 4;
+
+   std::vector<uint16_t> scratch((2 * width + dst_width) * 4);
+
+   for (unsigned y = 0; y < dst_height; y++)
+   {
+      unsigned y0 = std::min(2 * y, height - 1);
+      unsigned y1 = std::min(2 * y + 1, height - 1);
+      mipmap_downsample_rows_rgba8(src + y0 * src_pitch, src + y1 * src_pitch, width,
+            dst + y * dst_width * 4, dst_width, srgb, &scratch[0]);
+   }
+}
+
+// Scalar path for L8 and LA8, which are small enough not to bother with SIMD.
+// The first channel is colour, the second (if any) alpha.
+static void downsample_gray(const uint8_t *src, unsigned width, unsigned height,
+      uint8_t *dst, unsigned channels, bool srgb)
+{
+   unsigned dst_width  = std::max(width >> 1, 1u);
+   unsigned dst_height = std::max(height >> 1, 1u);
+
+   for (unsigned y = 0; y < dst_height; y++)
+   {
+      const uint8_t *r0 = src + std::min(2 * y, height - 1) * width * channels;
+      const uint8_t *r1 = src + std::min(2 * y + 1, height - 1) * width * channels;
+
+      for (unsigned x = 0; x < dst_width; x++, dst += channels)
+      {
+         unsigned x0 = std::min(2 * x, width - 1) * channels;
+         unsigned x1 = std::min(2 * x + 1, width - 1) * channels;
+
+         for (unsigned c = 0; c < channels; c++)
+         {
+            if (c == 0 && srgb)
+            {
+               unsigned sum = tables.to_linear[r0[x0]] + tables.to_linear[r0[x1]] +
+                  tables.to_linear[r1[x0]] + tables.to_linear[r1[x1]];
+               dst[c] = tables.from_linear[(sum + 2) >> 2];
+            }
+            else
+            {
+               unsigned sum = expand_unorm(r0[x0 + c]) + expand_unorm(r0[x1 + c]) +
+                  expand_unorm(r1[x0 + c]) + expand_unorm(r1[x1 + c]);
+               dst[c] = compress_unorm((sum + 2) >> 2);
+            }
+         }
+      }
+   }
+}
+
+// Maps filtered RGBA8 texels back to the closest palette entry.
+// Filtered images repeat a lot of colours, so recent answers are kept in a small hash.
+#define QUANTIZE_CACHE_SIZE 4096
+
+struct quantizer
+{
+   const uint8_t *palette;
+   uint32_t key[QUANTIZE_CACHE_SIZE];
+   int16_t index[QUANTIZE_CACHE_SIZE];
+};
+
+static uint8_t quantize(struct quantizer *q, const uint8_t *texel)
+{
+   uint32_t key;
+   memcpy(&key, texel, sizeof(key));
+   unsigned slot = (key * 2654435761u) >> 20;
+   if (q->index[slot] >= 0 && q->key[slot] == key)
+      return q->index[slot];
+
+   unsigned best = 0;
+   unsigned best_dist = ~0u;
+   for (unsigned i = 0; i < 256 && best_dist; i++)
+   {
+      const uint8_t *entry = q->palette + 4 * i;
+      unsigned dist = 0;
+      for (unsigned c = 0; c < 4; c++)
+      {
+         int d = entry[c] - texel[c];
+         dist += d * d;
+      }
+
+      if (dist < best_dist)
+      {
+         best      = i;
+         best_dist = dist;
+      }
+   }
+
+   q->key[slot]   = key;
+   q->index[slot] = best;
+   return best;
+}
+
+static void expand_indices(const uint8_t *src, const uint8_t *palette, uint8_t *dst, unsigned width)
+{
+   for (unsigned x = 0; x < width; x++)
+      memcpy(dst + 4 * x, palette + 4 * src[x], 4);
+}
+
+static void downsample_indexed(const uint8_t *src, unsigned width, unsigned height,
+      uint8_t *dst, const uint8_t *palette, bool srgb, struct quantizer *q)
+{
+   unsigned dst_width  = std::max(width >> 1, 1u);
+   unsigned dst_height = std::max(height >> 1, 1u);
+
+   std::vector<uint8_t> rows((2 * width + dst_width) * 4);
+   std::vector<uint16_t> scratch((2 * width + dst_width) * 4);
+   uint8_t *row0 = &rows[0];
+   uint8_t *row1 = row0 + width * 4;
+   uint8_t *out  = row1 + width * 4;
+
+   for (unsigned y = 0; y < dst_height; y++)
+   {
+      unsigned y0 = std::min(2 * y, height - 1);
+      unsigned y1 = std::min(2 * y + 1, height - 1);
+      expand_indices(src + y0 * width, palette, row0, width);
+      expand_indices(src + y1 * width, palette, row1, width);
+      mipmap_downsample_rows_rgba8(row0, row1, width, out, dst_width, srgb, &scratch[0]);
+
+      for (unsigned x = 0; x < dst_width; x++)
+         dst[y * dst_width + x] = quantize(q, out + 4 * x);
+   }
+}
+
+void mipmap_generate(struct texture_image *img, bool srgb)
+{
+   struct quantizer *q = NULL;
+   if (img->format == TEXTURE_FORMAT_INDEX8)
+   {
+      q = (struct quantizer*)malloc(sizeof(*q));
+      if (!q)
+         return;
+      q->palette = img->palette;
+      memset(q->index, 0xff, sizeof(q->index));
+   }
+
+   for (unsigned i = 1; i < img->levels; i++)
+   {
+      const struct texture_level *src = &img->level[i - 1];
+      const uint8_t *src_data = img->owned + src->offset;
+      uint8_t *dst_data = img->owned + img->level[i].offset;
+
+      switch (img->format)
+      {
+         case TEXTURE_FORMAT_L8:
+            downsample_gray(src_data, src->width, src->height, dst_data, 1, srgb);
+            break;
+         case TEXTURE_FORMAT_LA8:
+            downsample_gray(src_data, src->width, src->height, dst_data, 2, srgb);
+            break;
+         case TEXTURE_FORMAT_INDEX8:
+            downsample_indexed(src_data, src->width, src->height, dst_data, img->palette, srgb, q);
+            break;
+         default:
+            mipmap_downsample_rgba8(src_data, src->width, src->height, dst_data, srgb);
+            break;
+      }
+   }
+
+   free(q);
+}
@@ -0,0 +1,48 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIPMAP_HPP__
+#define MIPMAP_HPP__
+
+#include <stdint.h>
+#include "texture.hpp"
+
+// 2x2 box downsampler for RGBA8 images.
+//
+// Texels are expanded to 14-bit linear light (through the sRGB curve for RGB
+// when srgb is set, alpha is always linear), filtered with SSE2/NEON on 16-bit
+// lanes, then converted back. Odd dimensions clamp at the edge.
+
+// dst must hold max(width / 2, 1) * max(height / 2, 1) texels.
+void mipmap_downsample_rgba8(const uint8_t *src, unsigned width, unsigned height,
+      uint8_t *dst, bool srgb);
+
+// One destination row from a pair of source rows, for callers that stream.
+// dst_width may also be (width + 1) / 2, the last texel then repeats the edge.
+// scratch holds (2 * width + dst_width) * 4 values.
+void mipmap_downsample_rows_rgba8(const uint8_t *row0, const uint8_t *row1, unsigned width,
+      uint8_t *dst, unsigned dst_width, bool srgb, uint16_t *scratch);
+
+// Fills levels 1..levels-1 of an uncompressed image from level 0.
+// img->owned must be writable storage laid out by texture_image_layout().
+// L8 and LA8 are filtered the same way as RGBA8 (without SIMD). INDEX8 levels
+// are filtered as RGBA8 through the palette, then every texel is mapped back
+// to the nearest palette entry, so they can still be sampled with GL_NEAREST.
+void mipmap_generate(struct texture_image *img, bool srgb);
+
+#endif
+
@@ -0,0 +1,148 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perf.hpp"
+#include "shared.hpp"
+
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/time.h>
+#endif
+
+static struct retro_perf_callback perf_cb;
+static bool frontend_perf;
+
+static struct retro_perf_counter counters[PERF_STAGE_COUNT] = {
+   { "input" },
+   { "variables" },
+   { "geometry" },
+   { "uniforms" },
+   { "draw" },
+   { "video_cb" },
+   { "camera_upload" },
+   { "texture_load" },
+};
+
+// Totals at the last perf_report(), for the fallback.
+static retro_perf_tick_t reported_total[PERF_STAGE_COUNT];
+static retro_perf_tick_t reported_calls[PERF_STAGE_COUNT];
+
+static retro_perf_tick_t fallback_get_counter(void)
+{
+#if defined(_WIN32)
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return (retro_perf_tick_t)(count.QuadPart * 1000000000.0 / freq.QuadPart);
+#elif defined(__APPLE__)
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (retro_perf_tick_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#else
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (retro_perf_tick_t)tv.tv_sec * 1000000000 + tv.tv_nsec;
+#endif
+}
+
+static uint64_t fallback_get_cpu_features(void)
+{
+   return 0;
+}
+
+static void fallback_register(struct retro_perf_counter *counter)
+{
+   counter->registered = true;
+}
+
+static void fallback_start(struct retro_perf_counter *counter)
+{
+   counter->start = fallback_get_counter();
+}
+
+static void fallback_stop(struct retro_perf_counter *counter)
+{
+   counter->total += fallback_get_counter() - counter->start;
+   counter->call_cnt++;
+}
+
+static void fallback_log(void)
+{
+   if (!log_cb)
+      return;
+
+   for (unsigned i = 0; i < PERF_STAGE_COUNT; i++)
+   {
+      retro_perf_tick_t calls = counters[i].call_cnt - reported_calls[i];
+      retro_perf_tick_t total = counters[i].total - reported_total[i];
+      reported_calls[i] = counters[i].call_cnt;
+      reported_total[i] = counters[i].total;
+
+      if (calls)
+         log_cb(RETRO_LOG_INFO, "Perf: %-14s %9.1f us x %llu.\n", counters[i].ident,
+               total / 1000.0 / calls, (unsigned long long)calls);
+   }
+}
+
+void perf_init(retro_environment_t environ_cb)
+{
+   memset(&perf_cb, 0, sizeof(perf_cb));
+   frontend_perf = environ_cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb) &&
+      perf_cb.perf_register && perf_cb.perf_start && perf_cb.perf_stop;
+
+   if (!frontend_perf)
+   {
+      perf_cb.get_time_usec    = get_time_usec;
+      perf_cb.get_cpu_features = fallback_get_cpu_features;
+      perf_cb.get_perf_counter = fallback_get_counter;
+      perf_cb.perf_register    = fallback_register;
+      perf_cb.perf_start       = fallback_start;
+      perf_cb.perf_stop        = fallback_stop;
+      perf_cb.perf_log         = fallback_log;
+   }
+
+   // The frontend keeps counters it knows of, so only register them once.
+   for (unsigned i = 0; i < PERF_STAGE_COUNT; i++)
+   {
+      if (!counters[i].registered)
+         perf_cb.perf_register(&counters[i]);
+   }
+}
+
+void perf_begin(enum perf_stage stage)
+{
+   if (counters[stage].registered)
+      perf_cb.perf_start(&counters[stage]);
+}
+
+void perf_end(enum perf_stage stage)
+{
+   if (counters[stage].registered)
+      perf_cb.perf_stop(&counters[stage]);
+}
+
+void perf_report(void)
+{
+   if (perf_cb.perf_log)
+      perf_cb.perf_log();
+}
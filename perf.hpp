@@ -0,0 +1,54 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PERF_HPP__
+#define PERF_HPP__
+
+#include "libretro.h"
+
+// CPU time of each stage of a frame, in named libretro perf counters.
+//
+// Counters are registered with the frontend's perf interface, so they show
+// up wherever it reports its own. A frontend without one gets counters
+// kept here instead, ticking in nanoseconds, and perf_report() writes them
+// to the log. Only call from the thread running retro_run().
+
+enum perf_stage
+{
+   PERF_INPUT = 0,
+   PERF_VARIABLES,     // Option updates.
+   PERF_GEOMETRY,      // Rebuilding the cube vertex buffer.
+   PERF_UNIFORMS,      // Program, attribute, texture and uniform setup.
+   PERF_DRAW,          // Draw call submission.
+   PERF_VIDEO,         // video_cb().
+   PERF_CAMERA_UPLOAD,
+   PERF_TEXTURE_LOAD,  // Streaming in the content textures.
+
+   PERF_STAGE_COUNT
+};
+
+// Call from retro_init().
+void perf_init(retro_environment_t environ_cb);
+
+void perf_begin(enum perf_stage stage);
+void perf_end(enum perf_stage stage);
+
+// Logs the counters: the frontend's way if it has a perf interface, else
+// as average microseconds per call since the last report.
+void perf_report(void);
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pyramid.hpp"
+#include "texcache.hpp"
+#include "mipmap.hpp"
+#include "rpng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static const char pyramid_magic[8] = { 'I', 'V', 'P', 'Y', 'R', 'A', 0x0d, 0x0a };
+#define PYRAMID_VERSION 1
+
+struct pyramid_header
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t data_offset;
+
+   uint64_t hash;
+   uint64_t source_size;
+   int64_t source_mtime;
+
+   uint32_t tile_size;
+   uint32_t border;
+   uint32_t width;
+   uint32_t height;
+   uint32_t levels;
+   uint32_t tile_count;
+};
+
+void pyramid_layout(struct pyramid *pyr, unsigned width, unsigned height)
+{
+   pyr->width  = width;
+   pyr->height = height;
+   pyr->levels = 0;
+
+   unsigned tiles = 0;
+   for (unsigned i = 0; i < TEXTURE_MAX_LEVELS; i++)
+   {
+      struct pyramid_level *level = &pyr->level[i];
+      level->width      = width;
+      level->height     = height;
+      level->pages_x    = (width + PYRAMID_TILE_CONTENT - 1) / PYRAMID_TILE_CONTENT;
+      level->pages_y    = (height + PYRAMID_TILE_CONTENT - 1) / PYRAMID_TILE_CONTENT;
+      level->first_tile = tiles;
+      tiles += level->pages_x * level->pages_y;
+      pyr->levels++;
+
+      if (level->pages_x == 1 && level->pages_y == 1)
+         break;
+
+      width  = (width + 1) / 2;
+      height = (height + 1) / 2;
+   }
+}
+
+static unsigned tile_count(const struct pyramid *pyr)
+{
+   const struct pyramid_level *last = &pyr->level[pyr->levels - 1];
+   return last->first_tile + last->pages_x * last->pages_y;
+}
+
+static inline uint64_t align_up(uint64_t v)
+{
+   return (v + TEXCACHE_ALIGN - 1) & ~(uint64_t)(TEXCACHE_ALIGN - 1);
+}
+
+static std::string pyramid_path(const char *dir, const struct texcache_key *key)
+{
+   char name[32];
+   snprintf(name, sizeof(name), "/%016llx.ivp", (unsigned long long)key->hash);
+   return std::string(dir) + name;
+}
+
+static inline int clamp_int(int v, int lo, int hi)
+{
+   return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Build state of one level. The ring holds the last PYRAMID_TILE_SIZE rows,
+// which is exactly the span of one row of tiles including both borders.
+struct build_level
+{
+   unsigned width;
+   unsigned height;
+   unsigned rows;      // Rows received so far.
+   unsigned next_row;  // Next row of tiles to emit.
+   std::vector<uint8_t> ring;
+};
+
+struct builder
+{
+   struct pyramid *pyr;
+   FILE *file;
+   std::vector<build_level> levels;
+   std::vector<uint32_t> table;
+   std::vector<uint8_t> tile;
+   std::vector<uint16_t> scratch;
+   uint32_t written;
+};
+
+static bool emit_tile_row(struct builder *b, unsigned index, unsigned ty)
+{
+   struct build_level *level = &b->levels[index];
+   const struct pyramid_level *info = &b->pyr->level[index];
+   int last_x = level->width - 1;
+   int last_y = level->height - 1;
+
+   for (unsigned tx = 0; tx < info->pages_x; tx++)
+   {
+      int x0 = (int)(tx * PYRAMID_TILE_CONTENT) - PYRAMID_TILE_BORDER;
+      int y0 = (int)(ty * PYRAMID_TILE_CONTENT) - PYRAMID_TILE_BORDER;
+
+      for (int y = 0; y < PYRAMID_TILE_SIZE; y++)
+      {
+         unsigned src_y = clamp_int(y0 + y, 0, last_y) % PYRAMID_TILE_SIZE;
+         const uint32_t *src = (const uint32_t*)&level->ring[src_y * level->width * 4];
+         uint32_t *dst = (uint32_t*)&b->tile[y * PYRAMID_TILE_SIZE * 4];
+
+         if (x0 >= 0 && x0 + PYRAMID_TILE_SIZE <= (int)level->width)
+            memcpy(dst, src + x0, PYRAMID_TILE_SIZE * 4);
+         else
+         {
+            for (int x = 0; x < PYRAMID_TILE_SIZE; x++)
+               dst[x] = src[clamp_int(x0 + x, 0, last_x)];
+         }
+      }
+
+      if (fwrite(&b->tile[0], 1, PYRAMID_TILE_BYTES, b->file) != PYRAMID_TILE_BYTES)
+         return false;
+      b->table[info->first_tile + ty * info->pages_x + tx] = b->written++;
+   }
+
+   return true;
+}
+
+static bool add_row(struct builder *b, unsigned index, const uint8_t *row)
+{
+   struct build_level *level = &b->levels[index];
+   unsigned y = level->rows++;
+   uint8_t *slot = &level->ring[(y % PYRAMID_TILE_SIZE) * level->width * 4];
+   if (slot != row)
+      memcpy(slot, row, level->width * 4);
+
+   // A row of tiles is complete once its bottom border row (or the last row) is in.
+   const struct pyramid_level *info = &b->pyr->level[index];
+   while (level->next_row < info->pages_y)
+   {
+      unsigned needed = (level->next_row + 1) * PYRAMID_TILE_CONTENT + PYRAMID_TILE_BORDER - 1;
+      if (needed > level->height - 1)
+         needed = level->height - 1;
+      if (y < needed)
+         break;
+      if (!emit_tile_row(b, index, level->next_row++))
+         return false;
+   }
+
+   // Every pair of rows (or a lone last row) makes one row of the next level.
+   if (index + 1 < b->levels.size() && ((y & 1) || y == level->height - 1))
+   {
+      const uint8_t *row0 = &level->ring[((y & ~1u) % PYRAMID_TILE_SIZE) * level->width * 4];
+      struct build_level *next = &b->levels[index + 1];
+      uint8_t *next_slot = &next->ring[(next->rows % PYRAMID_TILE_SIZE) * next->width * 4];
+      mipmap_downsample_rows_rgba8(row0, slot, level->width, next_slot, next->width,
+            true, &b->scratch[0]);
+      if (!add_row(b, index + 1, next_slot))
+         return false;
+   }
+
+   return true;
+}
+
+static bool pyramid_build(const char *source, const std::string &path,
+      const struct texcache_key *key, struct pyramid *pyr)
+{
+   unsigned width, height;
+   rpng_stream_t *stream = rpng_stream_open(source, &width, &height);
+   if (!stream)
+      return false;
+
+   pyramid_layout(pyr, width, height);
+
+   struct builder b;
+   b.pyr     = pyr;
+   b.written = 0;
+   b.levels.resize(pyr->levels);
+   for (unsigned i = 0; i < pyr->levels; i++)
+   {
+      b.levels[i].width    = pyr->level[i].width;
+      b.levels[i].height   = pyr->level[i].height;
+      b.levels[i].rows     = 0;
+      b.levels[i].next_row = 0;
+      b.levels[i].ring.resize((size_t)PYRAMID_TILE_SIZE * pyr->level[i].width * 4);
+   }
+   b.table.resize(tile_count(pyr));
+   b.tile.resize(PYRAMID_TILE_BYTES);
+   b.scratch.resize(((size_t)2 * width + (width + 1) / 2) * 4);
+
+   struct pyramid_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, pyramid_magic, sizeof(pyramid_magic));
+   header.version      = PYRAMID_VERSION;
+   header.data_offset  = align_up(sizeof(header) + b.table.size() * sizeof(uint32_t));
+   header.hash         = key->hash;
+   header.source_size  = key->source_size;
+   header.source_mtime = key->source_mtime;
+   header.tile_size    = PYRAMID_TILE_SIZE;
+   header.border       = PYRAMID_TILE_BORDER;
+   header.width        = width;
+   header.height       = height;
+   header.levels       = pyr->levels;
+   header.tile_count   = b.table.size();
+
+   std::string tmp_path = path + ".tmp";
+   b.file = fopen(tmp_path.c_str(), "wb");
+   if (!b.file)
+   {
+      rpng_stream_close(stream);
+      return false;
+   }
+
+   bool ret = fseek(b.file, header.data_offset, SEEK_SET) == 0;
+
+   // Level 0 rows go straight into the ring.
+   for (unsigned y = 0; ret && y < height; y++)
+   {
+      uint8_t *slot = &b.levels[0].ring[(y % PYRAMID_TILE_SIZE) * width * 4];
+      ret = rpng_stream_read_row(stream, slot) && add_row(&b, 0, slot);
+   }
+   rpng_stream_close(stream);
+
+   ret = ret && b.written == b.table.size() &&
+      fseek(b.file, 0, SEEK_SET) == 0 &&
+      fwrite(&header, 1, sizeof(header), b.file) == sizeof(header) &&
+      fwrite(&b.table[0], sizeof(uint32_t), b.table.size(), b.file) == b.table.size();
+
+   if (fclose(b.file) != 0)
+      ret = false;
+
+   if (ret)
+   {
+#ifdef _WIN32
+      remove(path.c_str());
+#endif
+      ret = rename(tmp_path.c_str(), path.c_str()) == 0;
+   }
+
+   if (!ret)
+      remove(tmp_path.c_str());
+   return ret;
+}
+
+static bool pyramid_map(const std::string &path, const struct texcache_key *key, struct pyramid *pyr)
+{
+   FILE *file = fopen(path.c_str(), "rb");
+   if (!file)
+      return false;
+
+   struct pyramid_header header;
+   fseek(file, 0, SEEK_END);
+   long file_size = ftell(file);
+   rewind(file);
+
+   bool valid = file_size >= 0 && fread(&header, 1, sizeof(header), file) == sizeof(header) &&
+      memcmp(header.magic, pyramid_magic, sizeof(pyramid_magic)) == 0 &&
+      header.version == PYRAMID_VERSION &&
+      header.hash == key->hash && header.source_size == key->source_size &&
+      header.source_mtime == key->source_mtime &&
+      header.tile_size == PYRAMID_TILE_SIZE && header.border == PYRAMID_TILE_BORDER &&
+      header.width && header.height;
+
+   if (valid)
+   {
+      pyramid_layout(pyr, header.width, header.height);
+      valid = pyr->levels == header.levels && tile_count(pyr) == header.tile_count &&
+         header.data_offset == align_up(sizeof(header) + header.tile_count * sizeof(uint32_t)) &&
+         header.data_offset + (uint64_t)header.tile_count * PYRAMID_TILE_BYTES <= (uint64_t)file_size;
+   }
+
+   if (!valid)
+   {
+      fclose(file);
+      return false;
+   }
+
+#ifdef _WIN32
+   pyr->owned = (uint8_t*)malloc(file_size);
+   if (!pyr->owned || fseek(file, 0, SEEK_SET) < 0 ||
+         fread(pyr->owned, 1, file_size, file) != (size_t)file_size)
+   {
+      fclose(file);
+      pyramid_close(pyr);
+      return false;
+   }
+   const uint8_t *base = pyr->owned;
+#else
+   void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+   if (map == MAP_FAILED)
+   {
+      fclose(file);
+      return false;
+   }
+   pyr->map      = map;
+   pyr->map_size = file_size;
+   const uint8_t *base = (const uint8_t*)map;
+#endif
+   fclose(file);
+
+   pyr->tile_table = (const uint32_t*)(base + sizeof(header));
+   pyr->data       = base + header.data_offset;
+
+   for (unsigned i = 0; i < header.tile_count; i++)
+   {
+      if (pyr->tile_table[i] >= header.tile_count)
+      {
+         pyramid_close(pyr);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+bool pyramid_open(const char *path, const char *dir, struct pyramid *pyr)
+{
+   memset(pyr, 0, sizeof(*pyr));
+
+   struct texcache_key key;
+   if (!texcache_make_key(path, PYRAMID_VERSION, &key))
+      return false;
+
+   std::string file_path = pyramid_path(dir, &key);
+   if (pyramid_map(file_path, &key, pyr))
+      return true;
+
+#ifdef _WIN32
+   _mkdir(dir);
+#else
+   mkdir(dir, 0755);
+#endif
+
+   memset(pyr, 0, sizeof(*pyr));
+   if (!pyramid_build(path, file_path, &key, pyr))
+      return false;
+
+   memset(pyr, 0, sizeof(*pyr));
+   return pyramid_map(file_path, &key, pyr);
+}
+
+const uint8_t *pyramid_tile(const struct pyramid *pyr, unsigned level, unsigned x, unsigned y)
+{
+   const struct pyramid_level *info = &pyr->level[level];
+   uint32_t slot = pyr->tile_table[info->first_tile + y * info->pages_x + x];
+   return pyr->data + (size_t)slot * PYRAMID_TILE_BYTES;
+}
+
+void pyramid_close(struct pyramid *pyr)
+{
+#ifndef _WIN32
+   if (pyr->map)
+      munmap(pyr->map, pyr->map_size);
+#endif
+   free(pyr->owned);
+   memset(pyr, 0, sizeof(*pyr));
+}
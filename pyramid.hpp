@@ -0,0 +1,77 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PYRAMID_HPP__
+#define PYRAMID_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "texture.hpp"
+
+// On-disk tile pyramid for virtual texturing.
+//
+// Level 0 is the source image; every further level halves it, rounding up,
+// until one tile covers it. Each level is cut into PYRAMID_TILE_SIZE squared
+// RGBA8 tiles holding PYRAMID_TILE_CONTENT texels of image plus a
+// PYRAMID_TILE_BORDER texel border copied from the neighbours (or repeated
+// at the image edge), so tiles can be filtered bilinearly in isolation.
+// Unlike the rest of the textures, rows are stored top row first.
+//
+// The pyramid is built from a streaming PNG decode, so memory use depends on
+// the width of the image only. The file is memory mapped when opened.
+
+#define PYRAMID_TILE_SIZE 128
+#define PYRAMID_TILE_BORDER 1
+#define PYRAMID_TILE_CONTENT (PYRAMID_TILE_SIZE - 2 * PYRAMID_TILE_BORDER)
+#define PYRAMID_TILE_BYTES (PYRAMID_TILE_SIZE * PYRAMID_TILE_SIZE * 4)
+
+struct pyramid_level
+{
+   unsigned width;
+   unsigned height;
+   unsigned pages_x;
+   unsigned pages_y;
+   unsigned first_tile; // Index of tile (0, 0) in the tile table.
+};
+
+struct pyramid
+{
+   unsigned width;
+   unsigned height;
+   unsigned levels;
+   struct pyramid_level level[TEXTURE_MAX_LEVELS];
+
+   const uint32_t *tile_table; // Tile index to slot in the data area.
+   const uint8_t *data;
+
+   void *map;
+   size_t map_size;
+   uint8_t *owned;
+};
+
+// Fills in the level layout for an image size.
+void pyramid_layout(struct pyramid *pyr, unsigned width, unsigned height);
+
+// Builds the pyramid for path unless an up-to-date one exists in dir, then opens it.
+bool pyramid_open(const char *path, const char *dir, struct pyramid *pyr);
+
+const uint8_t *pyramid_tile(const struct pyramid *pyr, unsigned level, unsigned x, unsigned y);
+
+void pyramid_close(struct pyramid *pyr);
+
+#endif
+
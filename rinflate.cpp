@@ -0,0 +1,649 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rinflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef INFLATE_BUILTIN
+
+#include <zlib.h>
+
+// One stream with the zlib wrapper, one raw; inflateInit() allocates, so both
+// are set up once and reset for every use.
+struct rinflate
+{
+   z_stream zlib;
+   z_stream raw;
+   bool zlib_init;
+   bool raw_init;
+};
+
+rinflate_t *rinflate_new(void)
+{
+   return (rinflate_t*)calloc(1, sizeof(rinflate_t));
+}
+
+void rinflate_free(rinflate_t *inflater)
+{
+   if (!inflater)
+      return;
+
+   if (inflater->zlib_init)
+      inflateEnd(&inflater->zlib);
+   if (inflater->raw_init)
+      inflateEnd(&inflater->raw);
+   free(inflater);
+}
+
+static bool stream_begin(z_stream *stream, bool *init, int window_bits)
+{
+#ifndef INFLATE_MINIZ
+   if (*init)
+      return inflateReset(stream) == Z_OK;
+#else
+   // The miniz in include/miniz has no inflateReset().
+   if (*init)
+      inflateEnd(stream);
+   *init = false;
+#endif
+
+   memset(stream, 0, sizeof(*stream));
+   *init = inflateInit2(stream, window_bits) == Z_OK;
+   return *init;
+}
+
+bool rinflate_buffer(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written)
+{
+   z_stream *stream = &inflater->zlib;
+   *written = 0;
+   if (!stream_begin(stream, &inflater->zlib_init, MAX_WBITS))
+      return false;
+
+   stream->next_in   = (uint8_t*)src;
+   stream->avail_in  = src_size;
+   stream->next_out  = dst;
+   stream->avail_out = dst_size;
+
+   bool ret = inflate(stream, Z_FINISH) == Z_STREAM_END;
+   *written = stream->total_out;
+   return ret;
+}
+
+bool rinflate_blocks(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written)
+{
+   z_stream *stream = &inflater->raw;
+   *written = 0;
+   if (!stream_begin(stream, &inflater->raw_init, -MAX_WBITS))
+      return false;
+
+   stream->next_in   = (uint8_t*)src;
+   stream->avail_in  = src_size;
+   stream->next_out  = dst;
+   stream->avail_out = dst_size;
+
+   // There is no end of stream to stop at, so keep going until the input
+   // runs out. Z_OK means progress was made.
+   int zret;
+   do
+   {
+      zret = inflate(stream, Z_SYNC_FLUSH);
+   } while (zret == Z_OK && stream->avail_in);
+
+   *written = stream->total_out;
+   return (zret == Z_OK || zret == Z_STREAM_END || zret == Z_BUF_ERROR) && !stream->avail_in;
+}
+
+const char *rinflate_backend(void)
+{
+#ifdef INFLATE_MINIZ
+   return "miniz";
+#else
+   return "zlib";
+#endif
+}
+
+#else
+
+// Table entries. The low nibble is the number of bits the code takes, the
+// next one the number of extra bits that follow it, then flags, and the top
+// 16 bits the literal, length or distance base. Codes longer than the table's
+// root bits go through a subtable entry, which consumes the root bits and
+// holds the subtable's offset and size (in bits) instead.
+#define ENTRY_LITERAL  0x100
+#define ENTRY_EOB      0x200
+#define ENTRY_SUBTABLE 0x400
+#define ENTRY_INVALID  0x800
+
+#define LITLEN_BITS 10
+#define DIST_BITS 8
+#define CODELEN_BITS 7
+#define MAX_CODE_BITS 15
+
+// Worst case: a subtable of 2^(15 - root) entries for every long code.
+#define LITLEN_TABLE_SIZE ((1 << LITLEN_BITS) + 288 * (1 << (MAX_CODE_BITS - LITLEN_BITS)))
+#define DIST_TABLE_SIZE ((1 << DIST_BITS) + 32 * (1 << (MAX_CODE_BITS - DIST_BITS)))
+
+// A match is at most 258 bytes and copies may run over by 7.
+#define FAST_OUT_MARGIN (258 + 8)
+
+struct inflate_tables
+{
+   uint32_t litlen[LITLEN_TABLE_SIZE];
+   uint32_t dist[DIST_TABLE_SIZE];
+   uint32_t codelen[1 << CODELEN_BITS];
+};
+
+struct rinflate
+{
+   struct inflate_tables tables;
+};
+
+static const uint16_t length_base[29] = {
+   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+
+static const uint8_t length_extra[29] = {
+   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+static const uint16_t dist_base[30] = {
+   1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+
+static const uint8_t dist_extra[30] = {
+   0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+   7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static const uint8_t codelen_order[19] = {
+   16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static inline uint32_t litlen_entry(unsigned sym)
+{
+   if (sym < 256)
+      return ENTRY_LITERAL | (sym << 16);
+   if (sym == 256)
+      return ENTRY_EOB;
+   if (sym < 286)
+      return (length_base[sym - 257] << 16) | (length_extra[sym - 257] << 4);
+   return ENTRY_INVALID;
+}
+
+static inline uint32_t dist_entry(unsigned sym)
+{
+   if (sym < 30)
+      return (dist_base[sym] << 16) | (dist_extra[sym] << 4);
+   return ENTRY_INVALID;
+}
+
+static inline uint32_t codelen_entry(unsigned sym)
+{
+   return sym << 16;
+}
+
+static inline unsigned reverse_bits(unsigned code, unsigned len)
+{
+   unsigned rev = 0;
+   for (unsigned i = 0; i < len; i++, code >>= 1)
+      rev = (rev << 1) | (code & 1);
+   return rev;
+}
+
+// Builds the decode table for a canonical Huffman code. Over-subscribed
+// codes fail; incomplete ones are allowed, the missing codes decode as invalid.
+static bool build_table(uint32_t *table, unsigned root,
+      const uint8_t *lens, unsigned count, uint32_t (*entry)(unsigned))
+{
+   unsigned bl_count[MAX_CODE_BITS + 1] = {0};
+   for (unsigned i = 0; i < count; i++)
+      bl_count[lens[i]]++;
+   bl_count[0] = 0;
+
+   int left = 1;
+   unsigned next_code[MAX_CODE_BITS + 1] = {0};
+   for (unsigned len = 1, code = 0; len <= MAX_CODE_BITS; len++)
+   {
+      left = (left << 1) - bl_count[len];
+      if (left < 0)
+         return false;
+      code = (code + bl_count[len - 1]) << 1;
+      next_code[len] = code;
+   }
+
+   unsigned root_size = 1u << root;
+   for (unsigned i = 0; i < root_size; i++)
+      table[i] = ENTRY_INVALID;
+
+   // Codes longer than root share a subtable per root-bit prefix, sized for
+   // the longest of them.
+   uint8_t sub_bits[1 << LITLEN_BITS] = {0};
+   unsigned code[MAX_CODE_BITS + 1];
+   memcpy(code, next_code, sizeof(code));
+   for (unsigned sym = 0; sym < count; sym++)
+   {
+      unsigned len = lens[sym];
+      if (len <= root)
+      {
+         code[len]++;
+         continue;
+      }
+
+      unsigned prefix = reverse_bits(code[len]++, len) & (root_size - 1);
+      if (sub_bits[prefix] < len - root)
+         sub_bits[prefix] = len - root;
+   }
+
+   unsigned next = root_size;
+   for (unsigned prefix = 0; prefix < root_size; prefix++)
+   {
+      if (!sub_bits[prefix])
+         continue;
+
+      table[prefix] = (next << 16) | ENTRY_SUBTABLE | (sub_bits[prefix] << 4) | root;
+      unsigned size = 1u << sub_bits[prefix];
+      for (unsigned i = 0; i < size; i++)
+         table[next + i] = ENTRY_INVALID;
+      next += size;
+   }
+
+   memcpy(code, next_code, sizeof(code));
+   for (unsigned sym = 0; sym < count; sym++)
+   {
+      unsigned len = lens[sym];
+      if (!len)
+         continue;
+
+      unsigned rev = reverse_bits(code[len]++, len);
+      if (len <= root)
+      {
+         for (unsigned i = rev; i < root_size; i += 1u << len)
+            table[i] = entry(sym) | len;
+      }
+      else
+      {
+         uint32_t sub = table[rev & (root_size - 1)];
+         uint32_t *subtable = table + (sub >> 16);
+         unsigned size = 1u << ((sub >> 4) & 15);
+         for (unsigned i = rev >> root; i < size; i += 1u << (len - root))
+            subtable[i] = entry(sym) | (len - root);
+      }
+   }
+
+   return true;
+}
+
+struct bit_reader
+{
+   const uint8_t *in;
+   const uint8_t *end;
+   uint64_t buf;
+   unsigned count;
+   size_t overrun; // Zero bytes fed in past the end of the input.
+};
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+   uint64_t v;
+   memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   v = __builtin_bswap64(v);
+#endif
+   return v;
+}
+
+// Tops the bit buffer up to at least 56 bits. With eight bytes of input left
+// that's one unaligned load; bytes loaded but not counted are loaded again,
+// at the same position, by the next refill.
+static inline void refill(struct bit_reader *br)
+{
+   if (br->end - br->in >= 8)
+   {
+      br->buf |= load_le64(br->in) << br->count;
+      br->in += (63 - br->count) >> 3;
+      br->count |= 56;
+      return;
+   }
+
+   while (br->count <= 56)
+   {
+      if (br->in < br->end)
+         br->buf |= (uint64_t)*br->in++ << br->count;
+      else
+         br->overrun++;
+      br->count += 8;
+   }
+}
+
+static inline unsigned read_bits(struct bit_reader *br, unsigned bits)
+{
+   unsigned v = br->buf & ((1u << bits) - 1);
+   br->buf >>= bits;
+   br->count -= bits;
+   return v;
+}
+
+// True if decoding went past the end of the input.
+static inline bool truncated(const struct bit_reader *br)
+{
+   return br->overrun * 8 > br->count;
+}
+
+// Needs 15 bits in the buffer.
+static inline uint32_t decode(const uint32_t *table, unsigned root, struct bit_reader *br)
+{
+   uint32_t entry = table[br->buf & ((1u << root) - 1)];
+   if (entry & ENTRY_SUBTABLE)
+   {
+      br->buf >>= root;
+      br->count -= root;
+      entry = table[(entry >> 16) + (br->buf & ((1u << ((entry >> 4) & 15)) - 1))];
+   }
+
+   unsigned len = entry & 15;
+   br->buf >>= len;
+   br->count -= len;
+   return entry;
+}
+
+static bool read_dynamic_tables(struct bit_reader *br, struct inflate_tables *tables)
+{
+   refill(br);
+   unsigned hlit  = read_bits(br, 5) + 257;
+   unsigned hdist = read_bits(br, 5) + 1;
+   unsigned hclen = read_bits(br, 4) + 4;
+   if (hlit > 286 || hdist > 30)
+      return false;
+
+   uint8_t codelen_lens[19] = {0};
+   for (unsigned i = 0; i < hclen; i++)
+   {
+      refill(br);
+      codelen_lens[codelen_order[i]] = read_bits(br, 3);
+   }
+
+   if (!build_table(tables->codelen, CODELEN_BITS, codelen_lens, 19, codelen_entry))
+      return false;
+
+   // Literal/length and distance lengths form one sequence; repeats may
+   // cross from one into the other.
+   uint8_t lens[286 + 30];
+   unsigned total = hlit + hdist;
+   for (unsigned i = 0; i < total; )
+   {
+      refill(br);
+      uint32_t entry = decode(tables->codelen, CODELEN_BITS, br);
+      if (entry & ENTRY_INVALID)
+         return false;
+
+      unsigned sym = entry >> 16;
+      if (sym < 16)
+      {
+         lens[i++] = sym;
+         continue;
+      }
+
+      unsigned len = 0, repeat;
+      if (sym == 16)
+      {
+         if (!i)
+            return false;
+         len = lens[i - 1];
+         repeat = 3 + read_bits(br, 2);
+      }
+      else if (sym == 17)
+         repeat = 3 + read_bits(br, 3);
+      else
+         repeat = 11 + read_bits(br, 7);
+
+      if (repeat > total - i)
+         return false;
+      memset(lens + i, len, repeat);
+      i += repeat;
+   }
+
+   // A block without an end of block code can't terminate.
+   if (!lens[256])
+      return false;
+
+   return build_table(tables->litlen, LITLEN_BITS, lens, hlit, litlen_entry) &&
+      build_table(tables->dist, DIST_BITS, lens + hlit, hdist, dist_entry);
+}
+
+static void build_fixed_tables(struct inflate_tables *tables)
+{
+   uint8_t lens[288];
+   memset(lens, 8, 144);
+   memset(lens + 144, 9, 112);
+   memset(lens + 256, 7, 24);
+   memset(lens + 280, 8, 8);
+   build_table(tables->litlen, LITLEN_BITS, lens, 288, litlen_entry);
+
+   memset(lens, 5, 32);
+   build_table(tables->dist, DIST_BITS, lens, 32, dist_entry);
+}
+
+static bool inflate_stored(struct bit_reader *br,
+      uint8_t **out, uint8_t *out_end)
+{
+   // Back up to the byte boundary; whole bytes still in the buffer go back
+   // to the input.
+   read_bits(br, br->count & 7);
+   size_t buffered = br->count >> 3;
+   if (br->overrun > buffered)
+      return false;
+   br->in -= buffered - br->overrun;
+   br->buf = 0;
+   br->count = 0;
+   br->overrun = 0;
+
+   if (br->end - br->in < 4)
+      return false;
+
+   unsigned len  = br->in[0] | (br->in[1] << 8);
+   unsigned nlen = br->in[2] | (br->in[3] << 8);
+   br->in += 4;
+   if (len != (~nlen & 0xffff))
+      return false;
+   if ((size_t)(br->end - br->in) < len || (size_t)(out_end - *out) < len)
+      return false;
+
+   memcpy(*out, br->in, len);
+   *out += len;
+   br->in += len;
+   return true;
+}
+
+static bool inflate_huffman(struct bit_reader *reader, const struct inflate_tables *tables,
+      uint8_t *out_start, uint8_t **out_ptr, uint8_t *out_end)
+{
+   // Work on a local copy; output stores could alias the reader otherwise.
+   struct bit_reader local = *reader;
+   struct bit_reader *br = &local;
+   uint8_t *out = *out_ptr;
+   bool ret = false;
+
+   for (;;)
+   {
+      // After a refill there are 56 bits: enough for a length code, its
+      // extra bits, a distance code and its extra bits (15 + 5 + 15 + 13).
+      refill(br);
+
+      uint32_t entry = decode(tables->litlen, LITLEN_BITS, br);
+      if (entry & ENTRY_LITERAL)
+      {
+         if (out == out_end)
+            goto end;
+         *out++ = entry >> 16;
+         continue;
+      }
+
+      if (entry & (ENTRY_EOB | ENTRY_INVALID))
+      {
+         ret = !(entry & ENTRY_INVALID);
+         goto end;
+      }
+
+      unsigned length = (entry >> 16) + read_bits(br, (entry >> 4) & 15);
+
+      entry = decode(tables->dist, DIST_BITS, br);
+      if (entry & ENTRY_INVALID)
+         goto end;
+      size_t dist = (entry >> 16) + read_bits(br, (entry >> 4) & 15);
+
+      if (dist > (size_t)(out - out_start) || length > (size_t)(out_end - out))
+         goto end;
+
+      const uint8_t *src = out - dist;
+      if (out_end - out >= FAST_OUT_MARGIN && dist >= 8)
+      {
+         uint8_t *copy_end = out + length;
+         do
+         {
+            memcpy(out, src, 8);
+            out += 8;
+            src += 8;
+         } while (out < copy_end);
+         out = copy_end;
+      }
+      else if (dist == 1)
+      {
+         memset(out, *src, length);
+         out += length;
+      }
+      else
+      {
+         for (unsigned i = 0; i < length; i++)
+            *out++ = *src++;
+      }
+   }
+
+end:
+   *reader = local;
+   *out_ptr = out;
+   return ret;
+}
+
+// Real input bits not yet consumed.
+static inline size_t bits_left(const struct bit_reader *br)
+{
+   return (size_t)(br->end - br->in) * 8 + br->count - br->overrun * 8;
+}
+
+// Inflates deflate blocks up to the final one or, with until_end, up to the
+// end of the input if that comes first.
+static bool inflate_blocks(struct bit_reader *br, struct inflate_tables *tables,
+      uint8_t *dst, size_t dst_size, size_t *written, bool until_end)
+{
+   uint8_t *out = dst;
+   uint8_t *out_end = dst + dst_size;
+   bool fixed_built = false;
+   bool final = false;
+   bool ret = false;
+
+   while (!final && !(until_end && !bits_left(br)))
+   {
+      refill(br);
+      final = read_bits(br, 1);
+      unsigned type = read_bits(br, 2);
+
+      bool ok;
+      switch (type)
+      {
+         case 0:
+            ok = inflate_stored(br, &out, out_end);
+            break;
+
+         case 1:
+            if (!fixed_built)
+               build_fixed_tables(tables);
+            fixed_built = true;
+            ok = inflate_huffman(br, tables, dst, &out, out_end);
+            break;
+
+         case 2:
+            fixed_built = false;
+            ok = read_dynamic_tables(br, tables) &&
+               inflate_huffman(br, tables, dst, &out, out_end);
+            break;
+
+         default:
+            ok = false;
+            break;
+      }
+
+      if (!ok || truncated(br))
+         goto end;
+   }
+
+   ret = true;
+
+end:
+   *written = out - dst;
+   return ret;
+}
+
+rinflate_t *rinflate_new(void)
+{
+   return (rinflate_t*)malloc(sizeof(rinflate_t));
+}
+
+void rinflate_free(rinflate_t *inflater)
+{
+   free(inflater);
+}
+
+bool rinflate_buffer(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written)
+{
+   *written = 0;
+
+   // zlib header: deflate, window up to 32K, check bits, no preset dictionary.
+   if (src_size < 2)
+      return false;
+   unsigned cmf = src[0], flg = src[1];
+   if ((cmf & 15) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 || (flg & 0x20))
+      return false;
+
+   struct bit_reader br = {0};
+   br.in = src + 2;
+   br.end = src + src_size;
+   return inflate_blocks(&br, &inflater->tables, dst, dst_size, written, false);
+}
+
+bool rinflate_blocks(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written)
+{
+   struct bit_reader br = {0};
+   br.in = src;
+   br.end = src + src_size;
+   return inflate_blocks(&br, &inflater->tables, dst, dst_size, written, true);
+}
+
+const char *rinflate_backend(void)
+{
+   return "builtin";
+}
+
+#endif
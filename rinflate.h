@@ -0,0 +1,65 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINFLATE_H__
+#define RINFLATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "boolean.h"
+
+// Whole-buffer inflate for rpng, with the backend picked at build time
+// (INFLATE in the Makefile): system zlib, miniz through include/miniz/zlib.h,
+// or the built-in decoder.
+//
+// The built-in decoder only handles the case where all of the compressed and
+// decompressed data is in memory, which lets it skip zlib's resumable state
+// machine: a 64-bit bit buffer refilled eight bytes at a time, single-lookup
+// Huffman tables (with a second level for long codes) and match copies done
+// eight bytes at a time. The Adler-32 trailer isn't checked, PNG chunk CRCs
+// cover the same ground. Streaming decodes always go through the zlib API.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Inflate state, kept between calls so that a decoder working through many
+// images allocates it once. Use one per thread.
+typedef struct rinflate rinflate_t;
+
+rinflate_t *rinflate_new(void);
+void rinflate_free(rinflate_t *inflater);
+
+// Inflates the zlib stream in src into dst. Fails on corrupt or truncated
+// data, or if dst is too small. *written receives the decompressed size.
+bool rinflate_buffer(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written);
+
+// Inflates raw deflate data (no zlib header) that starts at a block boundary
+// with nothing to refer back to, and runs up to a block boundary or through
+// the final block. The data between two full flush points is such a range.
+bool rinflate_blocks(rinflate_t *inflater, const uint8_t *src, size_t src_size,
+      uint8_t *dst, size_t dst_size, size_t *written);
+
+// "zlib", "miniz" or "builtin".
+const char *rinflate_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
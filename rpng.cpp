@@ -14,6 +14,9 @@
  */
 
 #include "rpng.h"
+#include "crc32.h"
+#include "rinflate.h"
+#include "rthreads.h"
 
 #include <zlib.h>
 
@@ -21,10 +24,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+// RPNG_NO_SIMD forces the plain C paths, for comparing them in bench/.
+#if defined(RPNG_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RPNG_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RPNG_NEON
+#endif
+
 // Decodes a subset of PNG standard.
-// Does not handle much outside 24/32-bit RGB(A) images.
+// Every color type and bit depth is handled, 16-bit samples are cut to 8 bits.
 //
-// Missing: Adam7 interlace, 16 bpp, various color formats.
+// Missing: Adam7 interlace.
 
 #undef GOTO_END_ERROR
 #define GOTO_END_ERROR() do { \
@@ -33,15 +46,21 @@
    goto end; \
 } while(0)
 
+static bool verify_crc = true;
+
 static const uint8_t png_magic[8] = {
    0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a,
 };
 
+// Largest chunk rpng reads into memory: rfLP with 256 entries. Anything
+// longer of the others is malformed (PLTE tops out at 768 bytes).
+#define PNG_CHUNK_MAX 2048
+
 struct png_chunk
 {
    uint32_t size;
    char type[4];
-   uint8_t *data;
+   uint8_t data[PNG_CHUNK_MAX + 4]; // + CRC, filled in by png_read_chunk().
 };
 
 struct png_ihdr
@@ -60,8 +79,35 @@ enum png_chunk_type
    PNG_CHUNK_NOOP = 0,
    PNG_CHUNK_ERROR,
    PNG_CHUNK_IHDR,
+   PNG_CHUNK_PLTE,
+   PNG_CHUNK_TRNS,
    PNG_CHUNK_IDAT,
-   PNG_CHUNK_IEND
+   PNG_CHUNK_IEND,
+   PNG_CHUNK_RFLP
+};
+
+// PLTE and tRNS contents.
+struct png_colors
+{
+   uint8_t palette[256 * 4]; // RGBA, entries past palette_size stay zero.
+   unsigned palette_size;
+   bool has_key;             // Grayscale or RGB value that is transparent.
+   uint16_t key[3];
+};
+
+// Restart points from the private rfLP chunk. Encoders that want their
+// images decoded in parallel do a deflate full flush at some row boundaries
+// and list them here: the row, and the offset into the zlib stream (all IDAT
+// data) where deflate data for that row onwards starts, without references
+// to anything earlier. The chunk goes before IDAT and is unsafe to copy, any
+// change to the image data invalidates it.
+#define PNG_RESTART_MAX (PNG_CHUNK_MAX / 8)
+
+struct png_restarts
+{
+   unsigned count;
+   uint32_t row[PNG_RESTART_MAX];
+   uint32_t offset[PNG_RESTART_MAX];
 };
 
 static uint32_t dword_be(const uint8_t *buf)
@@ -89,14 +135,56 @@ struct
    enum png_chunk_type type;
 } static const chunk_map[] = {
    { "IHDR", PNG_CHUNK_IHDR },
+   { "PLTE", PNG_CHUNK_PLTE },
+   { "tRNS", PNG_CHUNK_TRNS },
    { "IDAT", PNG_CHUNK_IDAT },
    { "IEND", PNG_CHUNK_IEND },
+   { "rfLP", PNG_CHUNK_RFLP },
 };
 
-struct idat_buffer
+// Scratch memory that only ever grows, so it can be kept between images.
+struct png_buffer
 {
    uint8_t *data;
    size_t size;
+   size_t capacity;
+};
+
+static bool png_buffer_reserve(struct png_buffer *buf, size_t capacity)
+{
+   if (capacity <= buf->capacity)
+      return true;
+
+   if (capacity < buf->capacity * 2)
+      capacity = buf->capacity * 2;
+
+   uint8_t *data = (uint8_t*)realloc(buf->data, capacity);
+   if (!data)
+      return false;
+
+   buf->data     = data;
+   buf->capacity = capacity;
+   return true;
+}
+
+static void png_buffer_free(struct png_buffer *buf)
+{
+   free(buf->data);
+   memset(buf, 0, sizeof(*buf));
+}
+
+// Everything a whole-image decode allocates. rpng_load_image() uses a
+// temporary one.
+struct rpng_decoder
+{
+   struct png_buffer idat;      // All IDAT data.
+   struct png_buffer inflated;  // Filtered scanlines.
+   struct png_buffer scanlines; // Unfiltered ones, a couple per band.
+   struct png_buffer bands;
+   rinflate_t *inflater;
+   slock_t *band_lock;
+   scond_t *band_cond;
+   char io[BUFSIZ];             // stdio buffer.
 };
 
 static enum png_chunk_type png_chunk_type(const struct png_chunk *chunk)
@@ -110,30 +198,40 @@ static enum png_chunk_type png_chunk_type(const struct png_chunk *chunk)
    return PNG_CHUNK_NOOP;
 }
 
+void rpng_set_crc_check(bool enable)
+{
+   verify_crc = enable;
+}
+
+// CRC covers the chunk type and data. Chunks rpng skips over aren't checked.
+static uint32_t png_chunk_crc(const struct png_chunk *chunk, const uint8_t *data)
+{
+   return crc32_update(crc32_update(0, (const uint8_t*)chunk->type, 4), data, chunk->size);
+}
+
+static bool png_check_crc(const struct png_chunk *chunk, uint32_t crc, const uint8_t *stored)
+{
+   if (!verify_crc || crc == dword_be(stored))
+      return true;
+
+   fprintf(stderr, "[RPNG]: CRC mismatch in %.4s chunk.\n", chunk->type);
+   return false;
+}
+
 static bool png_read_chunk(FILE *file, struct png_chunk *chunk)
 {
-   free(chunk->data);
-   chunk->data = (uint8_t*)calloc(1, chunk->size + sizeof(uint32_t)); // CRC32
-   if (!chunk->data)
+   if (chunk->size > PNG_CHUNK_MAX)
       return false;
 
    if (fread(chunk->data, 1, chunk->size + sizeof(uint32_t), file) != (chunk->size + sizeof(uint32_t)))
-   {
-      free(chunk->data);
       return false;
-   }
 
-   // Ignore CRC.
+   if (verify_crc && !png_check_crc(chunk, png_chunk_crc(chunk, chunk->data), chunk->data + chunk->size))
+      return false;
 
    return true;
 }
 
-static void png_free_chunk(struct png_chunk *chunk)
-{
-   free(chunk->data);
-   chunk->data = NULL;
-}
-
 static bool png_parse_ihdr(FILE *file, struct png_chunk *chunk, struct png_ihdr *ihdr)
 {
    bool ret = true;
@@ -154,11 +252,29 @@ static bool png_parse_ihdr(FILE *file, struct png_chunk *chunk, struct png_ihdr
    if (ihdr->width == 0 || ihdr->height == 0)
       GOTO_END_ERROR();
 
-   if (ihdr->depth != 8) // Only 8bpc supported.
-      GOTO_END_ERROR();
+   switch (ihdr->color_type)
+   {
+      case 0: // Grayscale
+         if (ihdr->depth != 1 && ihdr->depth != 2 && ihdr->depth != 4 &&
+               ihdr->depth != 8 && ihdr->depth != 16)
+            GOTO_END_ERROR();
+         break;
 
-   if (ihdr->color_type != 2 && ihdr->color_type != 6) // Only RGB/RGBA supported.
-      GOTO_END_ERROR();
+      case 3: // Palette
+         if (ihdr->depth != 1 && ihdr->depth != 2 && ihdr->depth != 4 && ihdr->depth != 8)
+            GOTO_END_ERROR();
+         break;
+
+      case 2: // RGB
+      case 4: // Grayscale + alpha
+      case 6: // RGBA
+         if (ihdr->depth != 8 && ihdr->depth != 16)
+            GOTO_END_ERROR();
+         break;
+
+      default:
+         GOTO_END_ERROR();
+   }
 
    if (ihdr->compression != 0)
       GOTO_END_ERROR();
@@ -167,10 +283,192 @@ static bool png_parse_ihdr(FILE *file, struct png_chunk *chunk, struct png_ihdr
       GOTO_END_ERROR();
 
 end:
-   png_free_chunk(chunk);
    return ret;
 }
 
+static bool png_parse_plte(FILE *file, struct png_chunk *chunk, const struct png_ihdr *ihdr,
+      struct png_colors *colors)
+{
+   bool ret = true;
+   if (!png_read_chunk(file, chunk))
+      return false;
+
+   unsigned entries = chunk->size / 3;
+   if (chunk->size % 3 || entries == 0 || entries > 256)
+      GOTO_END_ERROR();
+
+   // Only palette images need it, for the others it's a mere suggestion.
+   if (ihdr->color_type == 3)
+   {
+      for (unsigned i = 0; i < entries; i++)
+      {
+         colors->palette[4 * i + 0] = chunk->data[3 * i + 0];
+         colors->palette[4 * i + 1] = chunk->data[3 * i + 1];
+         colors->palette[4 * i + 2] = chunk->data[3 * i + 2];
+         colors->palette[4 * i + 3] = 0xff;
+      }
+      colors->palette_size = entries;
+   }
+
+end:
+   return ret;
+}
+
+// Must come after PLTE for palette images.
+static bool png_parse_trns(FILE *file, struct png_chunk *chunk, const struct png_ihdr *ihdr,
+      struct png_colors *colors)
+{
+   bool ret = true;
+   if (!png_read_chunk(file, chunk))
+      return false;
+
+   switch (ihdr->color_type)
+   {
+      case 0:
+         if (chunk->size != 2)
+            GOTO_END_ERROR();
+         colors->key[0]  = (chunk->data[0] << 8) | chunk->data[1];
+         colors->has_key = true;
+         break;
+
+      case 2:
+         if (chunk->size != 6)
+            GOTO_END_ERROR();
+         for (unsigned i = 0; i < 3; i++)
+            colors->key[i] = (chunk->data[2 * i] << 8) | chunk->data[2 * i + 1];
+         colors->has_key = true;
+         break;
+
+      case 3:
+         if (chunk->size > colors->palette_size)
+            GOTO_END_ERROR();
+         for (unsigned i = 0; i < chunk->size; i++)
+            colors->palette[4 * i + 3] = chunk->data[i];
+         break;
+
+      default: // Has an alpha channel already.
+         break;
+   }
+
+end:
+   return ret;
+}
+
+// The index is only a hint; one that doesn't make sense is dropped and the
+// image decoded serially.
+static bool png_parse_rflp(FILE *file, struct png_chunk *chunk, const struct png_ihdr *ihdr,
+      struct png_restarts *restarts)
+{
+   restarts->count = 0;
+   if (chunk->size > PNG_CHUNK_MAX)
+      return fseek(file, chunk->size + sizeof(uint32_t), SEEK_CUR) == 0;
+
+   if (!png_read_chunk(file, chunk))
+      return false;
+
+   unsigned count = chunk->size / 8;
+   if (chunk->size % 8 == 0 && count <= PNG_RESTART_MAX)
+   {
+      uint32_t row = 0, offset = 2; // zlib header
+      unsigned i;
+      for (i = 0; i < count; i++)
+      {
+         restarts->row[i]    = dword_be(chunk->data + 8 * i);
+         restarts->offset[i] = dword_be(chunk->data + 8 * i + 4);
+         if (restarts->row[i] <= row || restarts->row[i] >= ihdr->height ||
+               restarts->offset[i] <= offset)
+            break;
+         row    = restarts->row[i];
+         offset = restarts->offset[i];
+      }
+
+      if (i == count)
+         restarts->count = count;
+   }
+
+   return true;
+}
+
+static unsigned png_channels(const struct png_ihdr *ihdr)
+{
+   switch (ihdr->color_type)
+   {
+      case 2:
+         return 3;
+      case 4:
+         return 2;
+      case 6:
+         return 4;
+      default:
+         return 1;
+   }
+}
+
+// Bytes per scanline, without the filter byte.
+static size_t png_pitch(const struct png_ihdr *ihdr)
+{
+   return ((size_t)ihdr->width * png_channels(ihdr) * ihdr->depth + 7) / 8;
+}
+
+// Distance to the corresponding byte of the previous pixel, as the filters see it.
+static unsigned png_filter_bpp(const struct png_ihdr *ihdr)
+{
+   unsigned bits = png_channels(ihdr) * ihdr->depth;
+   return bits < 8 ? 1 : bits / 8;
+}
+
+// Most compact rpng_format holding the image in 8 bits per channel.
+static enum rpng_format png_native_format(const struct png_ihdr *ihdr, const struct png_colors *colors)
+{
+   switch (ihdr->color_type)
+   {
+      case 0:
+         return colors->has_key ? RPNG_FORMAT_LA8 : RPNG_FORMAT_L8;
+      case 3:
+         return RPNG_FORMAT_INDEX8;
+      case 4:
+         return RPNG_FORMAT_LA8;
+      default:
+         return RPNG_FORMAT_RGBA8;
+   }
+}
+
+// Raw value of sample i, packed MSB first below 8 bits, big endian at 16.
+static inline unsigned png_sample(const uint8_t *line, unsigned i, unsigned depth)
+{
+   switch (depth)
+   {
+      case 1:
+         return (line[i >> 3] >> (7 - (i & 7))) & 1;
+      case 2:
+         return (line[i >> 2] >> (6 - 2 * (i & 3))) & 3;
+      case 4:
+         return (line[i >> 1] >> (4 - 4 * (i & 1))) & 15;
+      case 8:
+         return line[i];
+      default:
+         return (line[2 * i] << 8) | line[2 * i + 1];
+   }
+}
+
+// Raw sample value to 8 bits, replicating low depths so full scale stays 0xff.
+static inline uint8_t png_scale8(unsigned v, unsigned depth)
+{
+   switch (depth)
+   {
+      case 1:
+         return v * 0xff;
+      case 2:
+         return v * 0x55;
+      case 4:
+         return v * 0x11;
+      case 8:
+         return v;
+      default:
+         return v >> 8;
+   }
+}
+
 // Paeth prediction filter.
 static inline int paeth(int a, int b, int c)
 {
@@ -203,123 +501,488 @@ static inline void copy_line_rgba(uint8_t *data, const uint8_t *decoded, unsigne
    memcpy(data, decoded, width * sizeof(uint32_t));
 }
 
-static bool png_reverse_filter(uint8_t *data, const struct png_ihdr *ihdr,
-      const uint8_t *inflate_buf, size_t inflate_buf_size)
+// Converts an unfiltered scanline to format, which is either RGBA8
+// or what png_native_format() picked for the image.
+static void png_convert_line(uint8_t *data, const uint8_t *line, const struct png_ihdr *ihdr,
+      const struct png_colors *colors, enum rpng_format format)
 {
-   bool ret = true;
-   unsigned bpp = ihdr->color_type == 2 ? 3 : 4;
-   if (inflate_buf_size < (ihdr->width * bpp + 1) * ihdr->height)
-      return false;
-
-   unsigned pitch = ihdr->width * bpp;
-   uint8_t *prev_scanline    = (uint8_t*)calloc(1, pitch);
-   uint8_t *decoded_scanline = (uint8_t*)calloc(1, pitch);
-
-   if (!decoded_scanline || !decoded_scanline)
-      GOTO_END_ERROR();
-
-   // Top-left origin to bottom-left origin for OpenGL.
-   data += (ihdr->height - 1) * ihdr->width * sizeof(uint32_t);
+   unsigned width = ihdr->width;
+   unsigned depth = ihdr->depth;
 
-   for (unsigned h = 0; h < ihdr->height;
-         h++, inflate_buf += pitch, data -= ihdr->width * sizeof(uint32_t))
+   switch (format)
    {
-      unsigned filter = *inflate_buf++;
-      switch (filter)
-      {
-         case 0: // None
-            memcpy(decoded_scanline, inflate_buf, pitch);
-            break;
-
-         case 1: // Sub
-            for (unsigned i = 0; i < bpp; i++)
-               decoded_scanline[i] = inflate_buf[i];
-            for (unsigned i = bpp; i < pitch; i++)
-               decoded_scanline[i] = decoded_scanline[i - bpp] + inflate_buf[i];
-            break;
+      case RPNG_FORMAT_INDEX8:
+         if (depth == 8)
+            memcpy(data, line, width);
+         else
+            for (unsigned i = 0; i < width; i++)
+               data[i] = png_sample(line, i, depth);
+         return;
+
+      case RPNG_FORMAT_L8:
+         if (depth == 8)
+            memcpy(data, line, width);
+         else
+            for (unsigned i = 0; i < width; i++)
+               data[i] = png_scale8(png_sample(line, i, depth), depth);
+         return;
+
+      case RPNG_FORMAT_LA8:
+         if (ihdr->color_type == 4)
+         {
+            if (depth == 8)
+               memcpy(data, line, width * 2);
+            else
+               for (unsigned i = 0; i < width * 2; i++)
+                  data[i] = line[2 * i];
+         }
+         else
+         {
+            for (unsigned i = 0; i < width; i++)
+            {
+               unsigned v = png_sample(line, i, depth);
+               data[2 * i + 0] = png_scale8(v, depth);
+               data[2 * i + 1] = v == colors->key[0] ? 0 : 0xff;
+            }
+         }
+         return;
 
-         case 2: // Up
-            for (unsigned i = 0; i < pitch; i++)
-               decoded_scanline[i] = prev_scanline[i] + inflate_buf[i];
-            break;
+      default:
+         break;
+   }
 
-         case 3: // Average
-            for (unsigned i = 0; i < bpp; i++)
+   switch (ihdr->color_type)
+   {
+      case 0:
+      case 4:
+         for (unsigned i = 0; i < width; i++)
+         {
+            unsigned v;
+            uint8_t alpha = 0xff;
+            if (ihdr->color_type == 4)
             {
-               uint8_t avg = prev_scanline[i] >> 1;
-               decoded_scanline[i] = avg + inflate_buf[i];
+               v     = png_sample(line, 2 * i, depth);
+               alpha = png_scale8(png_sample(line, 2 * i + 1, depth), depth);
             }
-            for (unsigned i = bpp; i < pitch; i++)
+            else
             {
-               uint8_t avg = (decoded_scanline[i - bpp] + prev_scanline[i]) >> 1;
-               decoded_scanline[i] = avg + inflate_buf[i];
+               v = png_sample(line, i, depth);
+               if (colors->has_key && v == colors->key[0])
+                  alpha = 0;
             }
-            break;
 
-         case 4: // Paeth
-            for (unsigned i = 0; i < bpp; i++)
-               decoded_scanline[i] = paeth(0, prev_scanline[i], 0) + inflate_buf[i];
-            for (unsigned i = bpp; i < pitch; i++)
-               decoded_scanline[i] = paeth(decoded_scanline[i - bpp], prev_scanline[i], prev_scanline[i - bpp]) + inflate_buf[i];
+            uint8_t l = png_scale8(v, depth);
+            *data++ = l;
+            *data++ = l;
+            *data++ = l;
+            *data++ = alpha;
+         }
+         break;
+
+      case 3:
+         for (unsigned i = 0; i < width; i++, data += 4)
+            memcpy(data, colors->palette + 4 * png_sample(line, i, depth), 4);
+         break;
+
+      case 2:
+         if (depth == 8 && !colors->has_key)
+         {
+            copy_line_rgb(data, line, width);
             break;
+         }
+         for (unsigned i = 0; i < width; i++)
+         {
+            unsigned r = png_sample(line, 3 * i + 0, depth);
+            unsigned g = png_sample(line, 3 * i + 1, depth);
+            unsigned b = png_sample(line, 3 * i + 2, depth);
+            *data++ = png_scale8(r, depth);
+            *data++ = png_scale8(g, depth);
+            *data++ = png_scale8(b, depth);
+            *data++ = colors->has_key && r == colors->key[0] &&
+               g == colors->key[1] && b == colors->key[2] ? 0 : 0xff;
+         }
+         break;
+
+      case 6:
+         if (depth == 8)
+            copy_line_rgba(data, line, width);
+         else
+            for (unsigned i = 0; i < width * 4; i++)
+               data[i] = line[2 * i];
+         break;
+   }
+}
 
-         default:
-            GOTO_END_ERROR();
-      }
+static bool png_unfilter_line(unsigned filter, uint8_t *decoded_scanline, const uint8_t *prev_scanline,
+      const uint8_t *inflate_buf, unsigned pitch, unsigned bpp)
+{
+   switch (filter)
+   {
+      case 0: // None
+         memcpy(decoded_scanline, inflate_buf, pitch);
+         break;
+
+      case 1: // Sub
+         for (unsigned i = 0; i < bpp; i++)
+            decoded_scanline[i] = inflate_buf[i];
+         for (unsigned i = bpp; i < pitch; i++)
+            decoded_scanline[i] = decoded_scanline[i - bpp] + inflate_buf[i];
+         break;
+
+      case 2: // Up
+         for (unsigned i = 0; i < pitch; i++)
+            decoded_scanline[i] = prev_scanline[i] + inflate_buf[i];
+         break;
+
+      case 3: // Average
+         for (unsigned i = 0; i < bpp; i++)
+         {
+            uint8_t avg = prev_scanline[i] >> 1;
+            decoded_scanline[i] = avg + inflate_buf[i];
+         }
+         for (unsigned i = bpp; i < pitch; i++)
+         {
+            uint8_t avg = (decoded_scanline[i - bpp] + prev_scanline[i]) >> 1;
+            decoded_scanline[i] = avg + inflate_buf[i];
+         }
+         break;
+
+      case 4: // Paeth
+         for (unsigned i = 0; i < bpp; i++)
+            decoded_scanline[i] = paeth(0, prev_scanline[i], 0) + inflate_buf[i];
+         for (unsigned i = bpp; i < pitch; i++)
+            decoded_scanline[i] = paeth(decoded_scanline[i - bpp], prev_scanline[i], prev_scanline[i - bpp]) + inflate_buf[i];
+         break;
+
+      default:
+         return false;
+   }
+
+   return true;
+}
+
+// Unfilters and converts rows [first, first + rows). prev_scanline holds the
+// unfiltered row above the first one (zeros for the top row), and is left
+// holding the last one.
+static bool png_reverse_filter_rows(uint8_t *data, const struct png_ihdr *ihdr,
+      const struct png_colors *colors, enum rpng_format format, const uint8_t *inflate_buf,
+      unsigned first, unsigned rows, uint8_t *prev_scanline, uint8_t *decoded_scanline)
+{
+   unsigned bpp = png_filter_bpp(ihdr);
+   size_t pitch = png_pitch(ihdr);
+   size_t out_pitch = (size_t)ihdr->width * rpng_format_bpp(format);
+
+   inflate_buf += (pitch + 1) * first;
+
+   // Top-left origin to bottom-left origin for OpenGL.
+   data += (ihdr->height - 1 - first) * out_pitch;
 
-      if (bpp == 3)
-         copy_line_rgb(data, decoded_scanline, ihdr->width);
-      else
-         copy_line_rgba(data, decoded_scanline, ihdr->width);
+   for (unsigned h = 0; h < rows;
+         h++, inflate_buf += pitch, data -= out_pitch)
+   {
+      unsigned filter = *inflate_buf++;
+      if (!png_unfilter_line(filter, decoded_scanline, prev_scanline, inflate_buf, pitch, bpp))
+         return false;
+
+      png_convert_line(data, decoded_scanline, ihdr, colors, format);
 
       memcpy(prev_scanline, decoded_scanline, pitch);
    }
 
+   return true;
+}
+
+static bool png_reverse_filter(struct rpng_decoder *decoder, uint8_t *data,
+      const struct png_ihdr *ihdr, const struct png_colors *colors, enum rpng_format format,
+      const uint8_t *inflate_buf, size_t inflate_buf_size)
+{
+   size_t pitch = png_pitch(ihdr);
+   if (inflate_buf_size < (pitch + 1) * ihdr->height)
+      return false;
+
+   if (!png_buffer_reserve(&decoder->scanlines, 2 * pitch))
+      return false;
+
+   uint8_t *prev_scanline    = decoder->scanlines.data;
+   uint8_t *decoded_scanline = decoder->scanlines.data + pitch;
+   memset(prev_scanline, 0, pitch);
+
+   return png_reverse_filter_rows(data, ihdr, colors, format, inflate_buf,
+         0, ihdr->height, prev_scanline, decoded_scanline);
+}
+
+// Parallel decode of images with restart points. Each band of rows between
+// two of them is inflated and unfiltered by whichever thread picks it up.
+// Unfiltering a band whose first row uses Up, Average or Paeth has to wait
+// for the last row of the band above, so encoders should start bands with
+// None or Sub.
+struct png_band
+{
+   const uint8_t *src;
+   size_t src_size;
+   unsigned first_row;
+   unsigned rows;
+   uint8_t *last_scanline; // Unfiltered last row, for the band below.
+   uint8_t *decoded_scanline;
+   bool done;
+   bool ok;
+};
+
+struct png_band_job
+{
+   const struct png_ihdr *ihdr;
+   const struct png_colors *colors;
+   enum rpng_format format;
+   uint8_t *data;
+   uint8_t *inflate_buf;
+
+   struct png_band *bands;
+   unsigned count;
+   unsigned next;
+
+   slock_t *lock;
+   scond_t *cond;
+};
+
+static bool png_decode_band(struct png_band_job *job, unsigned index, rinflate_t *inflater)
+{
+   struct png_band *band = &job->bands[index];
+   size_t pitch = png_pitch(job->ihdr);
+   size_t size = (pitch + 1) * band->rows;
+   uint8_t *buf = job->inflate_buf + (pitch + 1) * band->first_row;
+
+   size_t written;
+   if (!rinflate_blocks(inflater, band->src, band->src_size, buf, size, &written) || written != size)
+      return false;
+
+   if (index && buf[0] >= 2)
+   {
+      struct png_band *prev = &job->bands[index - 1];
+      slock_lock(job->lock);
+      while (!prev->done)
+         scond_wait(job->cond, job->lock);
+      slock_unlock(job->lock);
+
+      if (!prev->ok)
+         return false;
+      memcpy(band->last_scanline, prev->last_scanline, pitch);
+   }
+
+   return png_reverse_filter_rows(job->data, job->ihdr, job->colors, job->format,
+         job->inflate_buf, band->first_row, band->rows, band->last_scanline, band->decoded_scanline);
+}
+
+static void png_band_work(struct png_band_job *job, rinflate_t *inflater)
+{
+   for (;;)
+   {
+      slock_lock(job->lock);
+      unsigned index = job->next;
+      if (index < job->count)
+         job->next++;
+      slock_unlock(job->lock);
+
+      if (index >= job->count)
+         break;
+
+      bool ok = png_decode_band(job, index, inflater);
+
+      slock_lock(job->lock);
+      job->bands[index].ok   = ok;
+      job->bands[index].done = true;
+      scond_broadcast(job->cond);
+      slock_unlock(job->lock);
+   }
+}
+
+// Extra threads bring their own inflate state. If that fails the others
+// pick up the slack.
+static void png_band_worker(void *userdata)
+{
+   rinflate_t *inflater = rinflate_new();
+   if (inflater)
+      png_band_work((struct png_band_job*)userdata, inflater);
+   rinflate_free(inflater);
+}
+
+static bool png_decode_bands(struct rpng_decoder *decoder, uint8_t *data,
+      const struct png_ihdr *ihdr, const struct png_colors *colors, enum rpng_format format,
+      const struct png_restarts *restarts)
+{
+   const struct png_buffer *idat = &decoder->idat;
+
+   // zlib header, and the Adler-32 trailer after the last band.
+   if (idat->size < 6 || (idat->data[0] & 15) != 8 || (idat->data[1] & 0x20) ||
+         restarts->offset[restarts->count - 1] >= idat->size - 4)
+      return false;
+
+   bool ret = true;
+   size_t pitch = png_pitch(ihdr);
+   unsigned count = restarts->count + 1;
+   sthread_t *threads[PNG_RESTART_MAX];
+   unsigned thread_count = 0;
+
+   struct png_band_job job = {0};
+   job.ihdr        = ihdr;
+   job.colors      = colors;
+   job.format      = format;
+   job.data        = data;
+   job.inflate_buf = decoder->inflated.data;
+   job.count       = count;
+
+   if (!decoder->band_lock)
+      decoder->band_lock = slock_new();
+   if (!decoder->band_cond)
+      decoder->band_cond = scond_new();
+   job.lock        = decoder->band_lock;
+   job.cond        = decoder->band_cond;
+
+   if (!job.lock || !job.cond ||
+         !png_buffer_reserve(&decoder->bands, count * sizeof(struct png_band)) ||
+         !png_buffer_reserve(&decoder->scanlines, 2 * pitch * count))
+      GOTO_END_ERROR();
+
+   job.bands = (struct png_band*)decoder->bands.data;
+   memset(job.bands, 0, count * sizeof(struct png_band));
+   memset(decoder->scanlines.data, 0, 2 * pitch * count);
+
+   for (unsigned i = 0; i < count; i++)
+   {
+      struct png_band *band = &job.bands[i];
+      size_t start = i ? restarts->offset[i - 1] : 2;
+      size_t end   = i < restarts->count ? restarts->offset[i] : idat->size - 4;
+      unsigned last_row = i < restarts->count ? restarts->row[i] : ihdr->height;
+
+      band->src              = idat->data + start;
+      band->src_size         = end - start;
+      band->first_row        = i ? restarts->row[i - 1] : 0;
+      band->rows             = last_row - band->first_row;
+      band->last_scanline    = decoder->scanlines.data + 2 * pitch * i;
+      band->decoded_scanline = band->last_scanline + pitch;
+   }
+
+   // The calling thread works on bands too.
+   for (unsigned cpus = sthread_cpu_count(); thread_count + 1 < cpus && thread_count + 1 < count; )
+   {
+      threads[thread_count] = sthread_create(png_band_worker, &job);
+      if (!threads[thread_count])
+         break;
+      thread_count++;
+   }
+
+   png_band_work(&job, decoder->inflater);
+   for (unsigned i = 0; i < thread_count; i++)
+      sthread_join(threads[i]);
+
+   for (unsigned i = 0; i < count; i++)
+      ret = ret && job.bands[i].ok;
+
 end:
-   free(decoded_scanline);
-   free(prev_scanline);
    return ret;
 }
 
-static bool png_append_idat(FILE *file, const struct png_chunk *chunk, struct idat_buffer *buf)
+static bool png_append_idat(FILE *file, const struct png_chunk *chunk, struct png_buffer *buf)
 {
-   uint8_t *new_buffer = (uint8_t*)realloc(buf->data, buf->size + chunk->size);
-   if (!new_buffer)
+   if (!png_buffer_reserve(buf, buf->size + chunk->size))
       return false;
 
-   buf->data  = new_buffer;
    if (fread(buf->data + buf->size, 1, chunk->size, file) != chunk->size)
       return false;
-   if (fseek(file, sizeof(uint32_t), SEEK_CUR) < 0)
+
+   uint8_t stored[4];
+   if (fread(stored, 1, sizeof(stored), file) != sizeof(stored))
+      return false;
+   if (verify_crc && !png_check_crc(chunk, png_chunk_crc(chunk, buf->data + buf->size), stored))
       return false;
    buf->size += chunk->size;
    return true;
 }
 
+unsigned rpng_format_bpp(enum rpng_format format)
+{
+   switch (format)
+   {
+      case RPNG_FORMAT_L8:
+      case RPNG_FORMAT_INDEX8:
+         return 1;
+      case RPNG_FORMAT_LA8:
+         return 2;
+      default:
+         return 4;
+   }
+}
+
+static uint8_t *rpng_malloc(unsigned width, unsigned height, void *userdata)
+{
+   (void)userdata;
+   return (uint8_t*)malloc(width * height * sizeof(uint32_t));
+}
+
 bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, unsigned *height)
 {
-   *data   = NULL;
-   *width  = 0;
-   *height = 0;
+   *data = NULL;
+   bool ret = rpng_load_image_rgba_into(path, rpng_malloc, NULL, data, width, height);
+   if (!ret)
+   {
+      free(*data);
+      *data = NULL;
+   }
+   return ret;
+}
 
-   bool ret = true;
-   FILE *file = fopen(path, "rb");
-   if (!file)
-      return false;
+// Adapts the RGBA-only allocator to rpng_load_image().
+struct rgba_alloc
+{
+   rpng_alloc_t alloc;
+   void *userdata;
+};
 
-   fseek(file, 0, SEEK_END);
-   long file_len = ftell(file);
-   rewind(file);
+static uint8_t *rgba_alloc_image(const struct rpng_image *image, void *userdata)
+{
+   struct rgba_alloc *rgba = (struct rgba_alloc*)userdata;
+   return rgba->alloc(image->width, image->height, rgba->userdata);
+}
+
+static bool rpng_load_rgba(const char *path, unsigned max_size, rpng_alloc_t alloc, void *userdata,
+      uint8_t **data, unsigned *width, unsigned *height)
+{
+   struct rgba_alloc rgba = { alloc, userdata };
+   struct rpng_image image;
+   bool ret = rpng_load_image(path, RPNG_FORMAT_BIT(RPNG_FORMAT_RGBA8), max_size,
+         rgba_alloc_image, &rgba, data, &image);
+   *width  = image.width;
+   *height = image.height;
+   return ret;
+}
+
+bool rpng_load_image_rgba_into(const char *path, rpng_alloc_t alloc, void *userdata,
+      uint8_t **data, unsigned *width, unsigned *height)
+{
+   return rpng_load_rgba(path, 0, alloc, userdata, data, width, height);
+}
 
+bool rpng_load_image_rgba_scaled(const char *path, unsigned max_size,
+      rpng_alloc_t alloc, void *userdata,
+      uint8_t **data, unsigned *width, unsigned *height)
+{
+   return rpng_load_rgba(path, max_size, alloc, userdata, data, width, height);
+}
+
+// Reads every chunk up to IEND, leaving the IDAT data in decoder->idat.
+// Sets *factor and fails without reading any further if the image has to be
+// shrunk to fit max_size.
+static bool png_read_chunks(struct rpng_decoder *decoder, FILE *file, unsigned max_size,
+      struct png_ihdr *ihdr, struct png_colors *colors, struct png_restarts *restarts,
+      unsigned *factor)
+{
+   bool ret = true;
    bool has_ihdr = false;
    bool has_idat = false;
    bool has_iend = false;
-   uint8_t *inflate_buf = NULL;
-   size_t inflate_buf_size = 0;
-   z_stream stream = {0};
 
-   struct idat_buffer idat_buf = {0};
-   struct png_ihdr ihdr = {0};
+   fseek(file, 0, SEEK_END);
+   long file_len = ftell(file);
+   rewind(file);
 
    char header[8];
    if (fread(header, 1, sizeof(header), file) != sizeof(header))
@@ -331,7 +994,7 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
    // feof() apparently isn't triggered after a seek (IEND).
    for (long pos = ftell(file); pos < file_len && pos >= 0; pos = ftell(file))
    {
-      struct png_chunk chunk = {0};
+      struct png_chunk chunk;
       if (!read_chunk_header(file, &chunk))
          GOTO_END_ERROR();
 
@@ -350,17 +1013,57 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
             if (has_ihdr || has_idat || has_iend)
                GOTO_END_ERROR();
 
-            if (!png_parse_ihdr(file, &chunk, &ihdr))
+            if (!png_parse_ihdr(file, &chunk, ihdr))
                GOTO_END_ERROR();
 
+            if (max_size)
+            {
+               unsigned fx = (ihdr->width + max_size - 1) / max_size;
+               unsigned fy = (ihdr->height + max_size - 1) / max_size;
+               *factor = fx > fy ? fx : fy;
+               if (*factor > 1)
+               {
+                  ret = false;
+                  goto end;
+               }
+            }
+
             has_ihdr = true;
             break;
 
+         case PNG_CHUNK_PLTE:
+            if (!has_ihdr || has_idat)
+               GOTO_END_ERROR();
+
+            if (!png_parse_plte(file, &chunk, ihdr, colors))
+               GOTO_END_ERROR();
+            break;
+
+         case PNG_CHUNK_TRNS:
+            if (!has_ihdr || has_idat)
+               GOTO_END_ERROR();
+
+            if (!png_parse_trns(file, &chunk, ihdr, colors))
+               GOTO_END_ERROR();
+            break;
+
+         case PNG_CHUNK_RFLP:
+            if (!has_ihdr || has_idat)
+            {
+               if (fseek(file, chunk.size + sizeof(uint32_t), SEEK_CUR) < 0)
+                  GOTO_END_ERROR();
+               break;
+            }
+
+            if (!png_parse_rflp(file, &chunk, ihdr, restarts))
+               GOTO_END_ERROR();
+            break;
+
          case PNG_CHUNK_IDAT:
             if (!has_ihdr || has_iend)
                GOTO_END_ERROR();
 
-            if (!png_append_idat(file, &chunk, &idat_buf))
+            if (!png_append_idat(file, &chunk, &decoder->idat))
                GOTO_END_ERROR();
 
             has_idat = true;
@@ -381,42 +1084,463 @@ bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, uns
    if (!has_ihdr || !has_idat || !has_iend)
       GOTO_END_ERROR();
 
-   if (inflateInit(&stream) != Z_OK)
+   if (ihdr->color_type == 3 && !colors->palette_size)
       GOTO_END_ERROR();
 
-   inflate_buf_size = (ihdr.width + 1) * ihdr.height * sizeof(uint32_t);
-   inflate_buf = (uint8_t*)malloc(inflate_buf_size);
-   if (!inflate_buf)
-      GOTO_END_ERROR();
+end:
+   return ret;
+}
+
+// Sets *factor and fails without decoding anything if the image has to be
+// shrunk to fit max_size.
+static bool png_load_whole(struct rpng_decoder *decoder, const char *path,
+      unsigned formats, unsigned max_size, rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image, unsigned *factor)
+{
+   bool ret = true;
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return false;
+
+   setvbuf(file, decoder->io, _IOFBF, sizeof(decoder->io));
+
+   size_t inflate_buf_size = 0;
+   size_t inflated = 0;
 
-   stream.next_in   = idat_buf.data;
-   stream.avail_in  = idat_buf.size;
-   stream.avail_out = inflate_buf_size;
-   stream.next_out  = inflate_buf;
+   struct png_ihdr ihdr = {0};
+   struct png_colors colors;
+   struct png_restarts restarts;
+   memset(&colors, 0, sizeof(colors));
+   restarts.count = 0;
 
-   if (inflate(&stream, Z_FINISH) != Z_STREAM_END)
+   // Reports its own errors, and a shrink isn't one.
+   if (!png_read_chunks(decoder, file, max_size, &ihdr, &colors, &restarts, factor))
    {
-      inflateEnd(&stream);
-      GOTO_END_ERROR();
+      ret = false;
+      goto end;
    }
-   inflateEnd(&stream);
 
-   *width  = ihdr.width;
-   *height = ihdr.height;
-   *data = (uint8_t*)malloc(ihdr.width * ihdr.height * sizeof(uint32_t));
+   image->width  = ihdr.width;
+   image->height = ihdr.height;
+   image->format = png_native_format(&ihdr, &colors);
+   if (!(formats & RPNG_FORMAT_BIT(image->format)))
+      image->format = RPNG_FORMAT_RGBA8;
+   if (image->format == RPNG_FORMAT_INDEX8)
+      memcpy(image->palette, colors.palette, sizeof(image->palette));
+
+   *data = alloc(image, userdata);
    if (!*data)
       GOTO_END_ERROR();
 
-   if (!png_reverse_filter(*data, &ihdr, inflate_buf, stream.total_out))
+   inflate_buf_size = (png_pitch(&ihdr) + 1) * ihdr.height;
+   if (!png_buffer_reserve(&decoder->inflated, inflate_buf_size))
+      GOTO_END_ERROR();
+
+   if (!decoder->inflater)
+      decoder->inflater = rinflate_new();
+   if (!decoder->inflater)
+      GOTO_END_ERROR();
+
+   if (restarts.count)
+   {
+      if (png_decode_bands(decoder, *data, &ihdr, &colors, image->format, &restarts))
+         goto end;
+      fprintf(stderr, "[RPNG]: Restart points don't match the image data, decoding serially.\n");
+   }
+
+   if (!rinflate_buffer(decoder->inflater, decoder->idat.data, decoder->idat.size,
+            decoder->inflated.data, inflate_buf_size, &inflated))
+      GOTO_END_ERROR();
+
+   if (!png_reverse_filter(decoder, *data, &ihdr, &colors, image->format,
+            decoder->inflated.data, inflated))
       GOTO_END_ERROR();
 
 end:
    if (file)
       fclose(file);
+   decoder->idat.size = 0;
+   return ret;
+}
+
+// Streaming decode. IDAT data is read in STREAM_CHUNK pieces and inflated
+// one scanline at a time, so memory use depends on the width only.
+
+#define STREAM_CHUNK (64 * 1024)
+
+struct rpng_stream
+{
+   FILE *file;
+   struct png_ihdr ihdr;
+   struct png_colors colors;
+   unsigned bpp;
+   size_t pitch;
+
+   z_stream zstream;
+   bool zstream_init;
+   uint8_t in[STREAM_CHUNK];
+   uint32_t idat_left; // Bytes left in the current IDAT chunk.
+   uint32_t idat_crc;  // Of what has been read of it so far.
+   bool idat_done;
+
+   uint8_t *scanline;      // Filter byte + pitch.
+   uint8_t *prev_scanline;
+   uint8_t *decoded_scanline;
+   unsigned row;
+};
+
+void rpng_stream_close(rpng_stream_t *stream)
+{
+   if (!stream)
+      return;
+
+   if (stream->zstream_init)
+      inflateEnd(&stream->zstream);
+   if (stream->file)
+      fclose(stream->file);
+   free(stream->scanline);
+   free(stream->prev_scanline);
+   free(stream->decoded_scanline);
+   free(stream);
+}
+
+// Positions the file at the data of the next IDAT chunk.
+// Picks up PLTE and tRNS on the way to the first one.
+static bool stream_next_idat(rpng_stream_t *stream)
+{
+   for (;;)
+   {
+      struct png_chunk chunk;
+      if (!read_chunk_header(stream->file, &chunk))
+         return false;
+
+      switch (png_chunk_type(&chunk))
+      {
+         case PNG_CHUNK_IDAT:
+            stream->idat_left = chunk.size;
+            stream->idat_crc  = crc32_update(0, (const uint8_t*)chunk.type, 4);
+            return true;
+
+         case PNG_CHUNK_PLTE:
+            if (!png_parse_plte(stream->file, &chunk, &stream->ihdr, &stream->colors))
+               return false;
+            break;
+
+         case PNG_CHUNK_TRNS:
+            if (!png_parse_trns(stream->file, &chunk, &stream->ihdr, &stream->colors))
+               return false;
+            break;
+
+         case PNG_CHUNK_IHDR:
+         case PNG_CHUNK_IEND:
+         case PNG_CHUNK_ERROR:
+            return false;
+
+         default:
+            if (fseek(stream->file, chunk.size + sizeof(uint32_t), SEEK_CUR) < 0)
+               return false;
+            break;
+      }
+   }
+}
+
+// Reads the CRC at the end of a fully read IDAT chunk.
+static bool stream_end_idat(rpng_stream_t *stream)
+{
+   uint8_t stored[4];
+   if (fread(stored, 1, sizeof(stored), stream->file) != sizeof(stored))
+      return false;
+
+   struct png_chunk chunk;
+   memcpy(chunk.type, "IDAT", 4);
+   return png_check_crc(&chunk, stream->idat_crc, stored);
+}
+
+rpng_stream_t *rpng_stream_open(const char *path, unsigned *width, unsigned *height)
+{
+   bool ret = true;
+   rpng_stream_t *stream = (rpng_stream_t*)calloc(1, sizeof(*stream));
+   if (!stream)
+      return NULL;
+
+   char header[8];
+   struct png_chunk chunk;
+
+   stream->file = fopen(path, "rb");
+   if (!stream->file)
+      GOTO_END_ERROR();
+
+   if (fread(header, 1, sizeof(header), stream->file) != sizeof(header))
+      GOTO_END_ERROR();
+   if (memcmp(header, png_magic, sizeof(png_magic)) != 0)
+      GOTO_END_ERROR();
+
+   if (!read_chunk_header(stream->file, &chunk) || png_chunk_type(&chunk) != PNG_CHUNK_IHDR)
+      GOTO_END_ERROR();
+   if (!png_parse_ihdr(stream->file, &chunk, &stream->ihdr))
+      GOTO_END_ERROR();
+   if (!stream_next_idat(stream))
+      GOTO_END_ERROR();
+   if (stream->ihdr.color_type == 3 && !stream->colors.palette_size)
+      GOTO_END_ERROR();
+
+   if (inflateInit(&stream->zstream) != Z_OK)
+      GOTO_END_ERROR();
+   stream->zstream_init = true;
+
+   stream->bpp   = png_filter_bpp(&stream->ihdr);
+   stream->pitch = png_pitch(&stream->ihdr);
+   stream->scanline         = (uint8_t*)malloc(stream->pitch + 1);
+   stream->prev_scanline    = (uint8_t*)calloc(1, stream->pitch);
+   stream->decoded_scanline = (uint8_t*)calloc(1, stream->pitch);
+   if (!stream->scanline || !stream->prev_scanline || !stream->decoded_scanline)
+      GOTO_END_ERROR();
+
+   *width  = stream->ihdr.width;
+   *height = stream->ihdr.height;
+
+end:
    if (!ret)
-      free(*data);
-   free(idat_buf.data);
-   free(inflate_buf);
+   {
+      rpng_stream_close(stream);
+      return NULL;
+   }
+   return stream;
+}
+
+bool rpng_stream_read_row(rpng_stream_t *stream, uint8_t *data)
+{
+   if (stream->row >= stream->ihdr.height)
+      return false;
+
+   z_stream *z = &stream->zstream;
+   z->next_out  = stream->scanline;
+   z->avail_out = stream->pitch + 1;
+
+   while (z->avail_out)
+   {
+      if (!z->avail_in)
+      {
+         // Refill from the current IDAT chunk, moving on to the next one when it runs out.
+         while (!stream->idat_left && !stream->idat_done)
+         {
+            if (!stream_end_idat(stream) || !stream_next_idat(stream))
+               stream->idat_done = true;
+         }
+         if (stream->idat_done)
+            return false;
+
+         size_t size = stream->idat_left < STREAM_CHUNK ? stream->idat_left : STREAM_CHUNK;
+         if (fread(stream->in, 1, size, stream->file) != size)
+            return false;
+         if (verify_crc)
+            stream->idat_crc = crc32_update(stream->idat_crc, stream->in, size);
+         stream->idat_left -= size;
+         z->next_in  = stream->in;
+         z->avail_in = size;
+      }
+
+      int zret = inflate(z, Z_NO_FLUSH);
+      if (zret == Z_STREAM_END && z->avail_out)
+         return false;
+      if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR)
+         return false;
+   }
+
+   if (!png_unfilter_line(stream->scanline[0], stream->decoded_scanline, stream->prev_scanline,
+            stream->scanline + 1, stream->pitch, stream->bpp))
+      return false;
+
+   png_convert_line(data, stream->decoded_scanline, &stream->ihdr, &stream->colors, RPNG_FORMAT_RGBA8);
+
+   uint8_t *tmp = stream->prev_scanline;
+   stream->prev_scanline    = stream->decoded_scanline;
+   stream->decoded_scanline = tmp;
+   stream->row++;
+   return true;
+}
+
+
+// Downscaling decode. Rows are summed per source column in 16 bits (up to
+// COLUMN_ROWS of them before 255 * rows could overflow), then folded
+// horizontally into 32-bit box sums.
+
+#define COLUMN_ROWS 257
+
+static void accumulate_row(uint16_t *column, const uint8_t *row, size_t size)
+{
+   size_t i = 0;
+#if defined(RPNG_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   for (; i + 16 <= size; i += 16)
+   {
+      __m128i v  = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i lo = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(column + i)), _mm_unpacklo_epi8(v, zero));
+      __m128i hi = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(column + i + 8)), _mm_unpackhi_epi8(v, zero));
+      _mm_storeu_si128((__m128i*)(column + i), lo);
+      _mm_storeu_si128((__m128i*)(column + i + 8), hi);
+   }
+#elif defined(RPNG_NEON)
+   for (; i + 16 <= size; i += 16)
+   {
+      uint8x16_t v = vld1q_u8(row + i);
+      vst1q_u16(column + i, vaddw_u8(vld1q_u16(column + i), vget_low_u8(v)));
+      vst1q_u16(column + i + 8, vaddw_u8(vld1q_u16(column + i + 8), vget_high_u8(v)));
+   }
+#endif
+   for (; i < size; i++)
+      column[i] += row[i];
+}
+
+static void fold_columns(uint32_t *box, uint16_t *column, unsigned width, unsigned factor)
+{
+   for (unsigned x = 0; x < width; x++)
+   {
+      uint32_t *dst = box + (x / factor) * 4;
+      dst[0] += column[x * 4 + 0];
+      dst[1] += column[x * 4 + 1];
+      dst[2] += column[x * 4 + 2];
+      dst[3] += column[x * 4 + 3];
+   }
+   memset(column, 0, width * 4 * sizeof(uint16_t));
+}
+
+static void emit_box_row(uint8_t *data, uint32_t *box, unsigned src_width,
+      unsigned dst_width, unsigned factor, unsigned rows)
+{
+   for (unsigned x = 0; x < dst_width; x++)
+   {
+      unsigned cols = x + 1 < dst_width ? factor : src_width - x * factor;
+      uint32_t count = cols * rows;
+      for (unsigned c = 0; c < 4; c++)
+         data[x * 4 + c] = (box[x * 4 + c] + count / 2) / count;
+   }
+   memset(box, 0, dst_width * 4 * sizeof(uint32_t));
+}
+
+static bool png_load_scaled(rpng_stream_t *stream, unsigned factor,
+      rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image)
+{
+   unsigned src_width  = stream->ihdr.width;
+   unsigned src_height = stream->ihdr.height;
+
+   bool ret = true;
+   unsigned dst_width  = (src_width + factor - 1) / factor;
+   unsigned dst_height = (src_height + factor - 1) / factor;
+   unsigned column_rows = 0;
+   unsigned box_rows = 0;
+   unsigned dst_y = 0;
+
+   uint8_t *row     = (uint8_t*)malloc(src_width * 4);
+   uint16_t *column = (uint16_t*)calloc(src_width * 4, sizeof(uint16_t));
+   uint32_t *box    = (uint32_t*)calloc(dst_width * 4, sizeof(uint32_t));
+   if (!row || !column || !box)
+      GOTO_END_ERROR();
+
+   image->width  = dst_width;
+   image->height = dst_height;
+   image->format = RPNG_FORMAT_RGBA8;
+   *data = alloc(image, userdata);
+   if (!*data)
+      GOTO_END_ERROR();
+
+   for (unsigned y = 0; y < src_height; y++)
+   {
+      if (!rpng_stream_read_row(stream, row))
+         GOTO_END_ERROR();
+
+      accumulate_row(column, row, src_width * 4);
+      column_rows++;
+      box_rows++;
+
+      bool box_done = box_rows == factor || y + 1 == src_height;
+      if (column_rows == COLUMN_ROWS || box_done)
+      {
+         fold_columns(box, column, src_width, factor);
+         column_rows = 0;
+      }
+
+      // Rows arrive top first, output has bottom-left origin.
+      if (box_done)
+      {
+         emit_box_row(*data + (dst_height - 1 - dst_y) * dst_width * 4, box,
+               src_width, dst_width, factor, box_rows);
+         box_rows = 0;
+         dst_y++;
+      }
+   }
+
+end:
+   free(row);
+   free(column);
+   free(box);
+   return ret;
+}
+
+rpng_decoder_t *rpng_decoder_new(void)
+{
+   return (rpng_decoder_t*)calloc(1, sizeof(rpng_decoder_t));
+}
+
+static void png_decoder_release(struct rpng_decoder *decoder)
+{
+   png_buffer_free(&decoder->idat);
+   png_buffer_free(&decoder->inflated);
+   png_buffer_free(&decoder->scanlines);
+   png_buffer_free(&decoder->bands);
+   rinflate_free(decoder->inflater);
+   decoder->inflater = NULL;
+   if (decoder->band_cond)
+      scond_free(decoder->band_cond);
+   if (decoder->band_lock)
+      slock_free(decoder->band_lock);
+   decoder->band_cond = NULL;
+   decoder->band_lock = NULL;
+}
+
+void rpng_decoder_free(rpng_decoder_t *decoder)
+{
+   if (!decoder)
+      return;
+
+   png_decoder_release(decoder);
+   free(decoder);
+}
+
+bool rpng_decoder_load_image(rpng_decoder_t *decoder, const char *path,
+      unsigned formats, unsigned max_size, rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image)
+{
+   if (!decoder)
+      return rpng_load_image(path, formats, max_size, alloc, userdata, data, image);
+
+   *data = NULL;
+   memset(image, 0, sizeof(*image));
+
+   unsigned factor = 1;
+   if (png_load_whole(decoder, path, formats, max_size, alloc, userdata, data, image, &factor))
+      return true;
+   if (factor <= 1)
+      return false;
+
+   unsigned width, height;
+   rpng_stream_t *stream = rpng_stream_open(path, &width, &height);
+   if (!stream)
+      return false;
+
+   bool ret = png_load_scaled(stream, factor, alloc, userdata, data, image);
+   rpng_stream_close(stream);
    return ret;
 }
 
+bool rpng_load_image(const char *path, unsigned formats, unsigned max_size,
+      rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image)
+{
+   struct rpng_decoder decoder;
+   memset(&decoder, 0, sizeof(decoder));
+   bool ret = rpng_decoder_load_image(&decoder, path, formats, max_size, alloc, userdata, data, image);
+   png_decoder_release(&decoder);
+   return ret;
+}
@@ -16,6 +16,7 @@
 #ifndef RPNG_H__
 #define RPNG_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include "boolean.h"
 
@@ -27,8 +28,101 @@
 extern "C" {
 #endif
 
+enum rpng_format
+{
+   RPNG_FORMAT_RGBA8 = 0,
+   RPNG_FORMAT_L8,      // Grayscale.
+   RPNG_FORMAT_LA8,     // Grayscale + alpha.
+   RPNG_FORMAT_INDEX8   // Indices into rpng_image::palette.
+};
+
+#define RPNG_FORMAT_BIT(format) (1u << (format))
+
+struct rpng_image
+{
+   unsigned width;
+   unsigned height;
+   enum rpng_format format;
+   uint8_t palette[256 * 4]; // RGBA with tRNS alpha, for RPNG_FORMAT_INDEX8.
+};
+
+unsigned rpng_format_bpp(enum rpng_format format);
+
+// Called once the size and output format are known. Must return a buffer of at least
+// width * height * rpng_format_bpp(format) bytes, or NULL to abort. The buffer is owned
+// by the caller and is returned through *data even if decoding fails later on.
+typedef uint8_t *(*rpng_alloc_image_t)(const struct rpng_image *image, void *userdata);
+
+// Decodes into the most compact of formats (a mask of RPNG_FORMAT_BITs) that
+// holds the image in 8 bits per channel: grayscale as L8 (LA8 with an alpha
+// channel or a tRNS key), palette images as INDEX8. Everything else comes
+// out as RGBA8, which must always be in formats.
+// max_size works as in rpng_load_image_rgba_scaled(), a shrunk image is always RGBA8.
+bool rpng_load_image(const char *path, unsigned formats, unsigned max_size,
+      rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image);
+
+// Keeps the scratch memory and inflate state of whole-image decodes between
+// loads, so decoding a sequence of images stops allocating once it has seen
+// the largest. Shrinking decodes (see max_size) stream and still allocate.
+// Not thread-safe, use one per thread.
+typedef struct rpng_decoder rpng_decoder_t;
+
+rpng_decoder_t *rpng_decoder_new(void);
+void rpng_decoder_free(rpng_decoder_t *decoder);
+
+// rpng_load_image() with a decoder, which may be NULL.
+bool rpng_decoder_load_image(rpng_decoder_t *decoder, const char *path,
+      unsigned formats, unsigned max_size, rpng_alloc_image_t alloc, void *userdata,
+      uint8_t **data, struct rpng_image *image);
+
+// Checks the CRC of every chunk that is decoded and fails the load on a
+// mismatch. On by default.
+void rpng_set_crc_check(bool enable);
+
+// The loaders below expand every image to RGBA8.
 bool rpng_load_image_rgba(const char *path, uint8_t **data, unsigned *width, unsigned *height);
 
+// Called once the image size is known. Must return a buffer of at least
+// width * height * 4 bytes, or NULL to abort. The buffer is owned by the caller
+// and is returned through *data even if decoding fails later on.
+typedef uint8_t *(*rpng_alloc_t)(unsigned width, unsigned height, void *userdata);
+
+// Decodes straight into caller-provided memory, e.g. a mapped pixel unpack buffer.
+bool rpng_load_image_rgba_into(const char *path, rpng_alloc_t alloc, void *userdata,
+      uint8_t **data, unsigned *width, unsigned *height);
+
+// Like rpng_load_image_rgba_into(), but an image larger than max_size in
+// either dimension is shrunk by a whole-number factor while it is decoded:
+// every output texel is the average of a factor x factor box of source
+// texels. Only a few rows are held at a time, never the full-size image.
+// width and height receive the output size. A max_size of 0 means no limit.
+bool rpng_load_image_rgba_scaled(const char *path, unsigned max_size,
+      rpng_alloc_t alloc, void *userdata,
+      uint8_t **data, unsigned *width, unsigned *height);
+
+// Writes RGBA8 pixels, rows pitch bytes apart, as a PNG. With bottom_left the
+// first row in data is the bottom of the image (as glReadPixels() leaves an
+// upright frame), else the top. Without alpha the A channel is
+// dropped and an RGB image written. level is a zlib level; 1 is the fastest
+// and only tries run-length matches, which suits filtered rendered frames.
+//
+// Row bands are filtered and deflated on up to sthread_cpu_count() threads
+// and recorded as restart points, so the file also decodes in parallel.
+bool rpng_save_image_rgba(const char *path, const uint8_t *data,
+      unsigned width, unsigned height, size_t pitch, bool bottom_left, bool alpha, int level);
+
+// Row by row decoding for images too large to hold in memory.
+// Rows come out top row first (unlike the loaders above), as RGBA.
+typedef struct rpng_stream rpng_stream_t;
+
+rpng_stream_t *rpng_stream_open(const char *path, unsigned *width, unsigned *height);
+
+// Decodes the next row into data, which holds width * 4 bytes.
+bool rpng_stream_read_row(rpng_stream_t *stream, uint8_t *data);
+
+void rpng_stream_close(rpng_stream_t *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,489 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpng.h"
+#include "crc32.h"
+#include "rthreads.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Banded PNG writer. Rows are split into bands that are filtered and
+// deflated independently, each one ending in a full flush, so any number of
+// threads can work on them. The bands are then written out in order as one
+// zlib stream, with an rfLP chunk (see rpng.cpp) listing where each starts.
+//
+// A band's first row only uses None or Sub so that the parallel decoder never
+// has to wait for the band above.
+
+#undef GOTO_END_ERROR
+#define GOTO_END_ERROR() do { \
+   fprintf(stderr, "[RPNG]: Error in line %d.\n", __LINE__); \
+   ret = false; \
+   goto end; \
+} while(0)
+
+// Fewer rows than this per band cost more in compression than they win.
+#define ENCODE_BAND_ROWS_MIN 32
+
+// rfLP holds 256 entries, the first band doesn't need one.
+#define ENCODE_BANDS_MAX 257
+
+#define ADLER_BASE 65521u
+
+static const uint8_t png_magic[8] = {
+   0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a,
+};
+
+struct encode_band
+{
+   unsigned first_row;
+   unsigned rows;
+   uint8_t *out;     // Raw deflate data, with the zlib header in front of band 0.
+   size_t out_size;
+   uint32_t adler;   // Of this band's filtered rows.
+   bool ok;
+};
+
+struct encode_job
+{
+   const uint8_t *data;
+   unsigned width;
+   unsigned height;
+   size_t pitch;
+   bool bottom_left;
+   unsigned channels;
+   int level;
+   struct encode_band *bands;
+   unsigned count;
+   unsigned next;
+   slock_t *lock;
+};
+
+static void store_be32(uint8_t *buf, uint32_t v)
+{
+   buf[0] = v >> 24;
+   buf[1] = v >> 16;
+   buf[2] = v >> 8;
+   buf[3] = v;
+}
+
+// adler32_combine() from zlib, which miniz lacks.
+static uint32_t adler32_join(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+   uint32_t rem  = len2 % ADLER_BASE;
+   uint32_t sum1 = adler1 & 0xffff;
+   uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+   sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+   sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+   if (sum1 >= ADLER_BASE)
+      sum1 -= ADLER_BASE;
+   if (sum1 >= ADLER_BASE)
+      sum1 -= ADLER_BASE;
+   if (sum2 >= ADLER_BASE << 1)
+      sum2 -= ADLER_BASE << 1;
+   if (sum2 >= ADLER_BASE)
+      sum2 -= ADLER_BASE;
+   return sum1 | (sum2 << 16);
+}
+
+static inline int paeth(int a, int b, int c)
+{
+   int p  = a + b - c;
+   int pa = abs(p - a);
+   int pb = abs(p - b);
+   int pc = abs(p - c);
+
+   if (pa <= pb && pa <= pc)
+      return a;
+   else if (pb <= pc)
+      return b;
+   return c;
+}
+
+// Filters line into out and returns the sum of the residuals taken as signed
+// bytes, the usual estimate of how well a row will compress.
+static unsigned long filter_line(unsigned filter, uint8_t *out, const uint8_t *line,
+      const uint8_t *prev, size_t size, unsigned bpp)
+{
+   size_t i;
+
+   // One loop per filter so Sub and Up vectorize.
+   switch (filter)
+   {
+      case 0: // None
+         memcpy(out, line, size);
+         break;
+
+      case 1: // Sub
+         for (i = 0; i < bpp; i++)
+            out[i] = line[i];
+         for (; i < size; i++)
+            out[i] = line[i] - line[i - bpp];
+         break;
+
+      case 2: // Up
+         for (i = 0; i < size; i++)
+            out[i] = line[i] - prev[i];
+         break;
+
+      case 3: // Average
+         for (i = 0; i < bpp; i++)
+            out[i] = line[i] - (prev[i] >> 1);
+         for (; i < size; i++)
+            out[i] = line[i] - ((line[i - bpp] + prev[i]) >> 1);
+         break;
+
+      case 4: // Paeth
+         for (i = 0; i < bpp; i++)
+            out[i] = line[i] - prev[i];
+         for (; i < size; i++)
+            out[i] = line[i] - paeth(line[i - bpp], prev[i], prev[i - bpp]);
+         break;
+   }
+
+   unsigned long sum = 0;
+   for (i = 0; i < size; i++)
+   {
+      int8_t res = (int8_t)out[i];
+      sum += res < 0 ? -res : res;
+   }
+   return sum;
+}
+
+// Picks the filter with the smallest residual sum. Fast levels only try
+// Sub and Up, which win on most rendered frames; band starts only None and Sub.
+static void filter_row(uint8_t *out, const uint8_t *line, const uint8_t *prev,
+      size_t size, unsigned bpp, bool band_start, int level, uint8_t *scratch)
+{
+   static const unsigned filters_start[] = { 0, 1 };
+   static const unsigned filters_fast[]  = { 1, 2 };
+   static const unsigned filters_all[]   = { 0, 1, 2, 3, 4 };
+
+   const unsigned *filters = filters_all;
+   unsigned count = 5;
+   if (band_start)
+   {
+      filters = filters_start;
+      count   = 2;
+   }
+   else if (level <= 3)
+   {
+      filters = filters_fast;
+      count   = 2;
+   }
+
+   // The first candidate goes straight to out, later ones only if they're better.
+   unsigned long best = ~0ul;
+   for (unsigned i = 0; i < count; i++)
+   {
+      uint8_t *dst = best == ~0ul ? out + 1 : scratch;
+      unsigned long sum = filter_line(filters[i], dst, line, prev, size, bpp);
+      if (sum < best)
+      {
+         if (dst == scratch)
+            memcpy(out + 1, scratch, size);
+         best   = sum;
+         out[0] = filters[i];
+      }
+   }
+}
+
+static uint8_t zlib_header_flags(int level)
+{
+   // FLEVEL, with FCHECK making the header a multiple of 31.
+   if (level <= 1)
+      return 0x01;
+   if (level <= 5)
+      return 0x5e;
+   if (level == 6)
+      return 0x9c;
+   return 0xda;
+}
+
+static bool encode_band(struct encode_job *job, unsigned index)
+{
+   bool ret = true;
+   struct encode_band *band = &job->bands[index];
+   bool last = index + 1 == job->count;
+   size_t row_size = (size_t)job->width * job->channels;
+   size_t filtered_size = (row_size + 1) * band->rows;
+   size_t header = index == 0 ? 2 : 0;
+
+   uint8_t *filtered = (uint8_t*)malloc(filtered_size);
+   uint8_t *lines    = (uint8_t*)calloc(3, row_size); // prev, current, candidate.
+   bool stream_init  = false;
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));
+
+   if (!filtered || !lines)
+      GOTO_END_ERROR();
+
+   {
+      uint8_t *prev    = lines;
+      uint8_t *line    = lines + row_size;
+      uint8_t *scratch = lines + 2 * row_size;
+
+      for (unsigned r = 0; r < band->rows; r++)
+      {
+         // Top row first out.
+         unsigned y = band->first_row + r;
+         if (job->bottom_left)
+            y = job->height - 1 - y;
+         const uint8_t *src = job->data + (size_t)y * job->pitch;
+
+         if (job->channels == 4)
+            memcpy(line, src, row_size);
+         else
+         {
+            for (unsigned x = 0; x < job->width; x++)
+            {
+               line[3 * x + 0] = src[4 * x + 0];
+               line[3 * x + 1] = src[4 * x + 1];
+               line[3 * x + 2] = src[4 * x + 2];
+            }
+         }
+
+         filter_row(filtered + r * (row_size + 1), line, prev, row_size, job->channels,
+               r == 0, job->level, scratch);
+
+         uint8_t *tmp = prev;
+         prev = line;
+         line = tmp;
+      }
+   }
+
+   band->adler = adler32(1, filtered, filtered_size);
+
+   if (deflateInit2(&stream, job->level, Z_DEFLATED, -MAX_WBITS, 8,
+            job->level <= 1 ? Z_RLE : Z_DEFAULT_STRATEGY) != Z_OK)
+      GOTO_END_ERROR();
+   stream_init = true;
+
+   {
+      // Bound plus room for the empty stored block of the flush, and 4
+      // bytes at the end for the Adler-32 trailer.
+      size_t capacity = header + deflateBound(&stream, filtered_size) + 16 + 4;
+      band->out = (uint8_t*)malloc(capacity);
+      if (!band->out)
+         GOTO_END_ERROR();
+
+      if (header)
+      {
+         band->out[0] = 0x78;
+         band->out[1] = zlib_header_flags(job->level);
+      }
+
+      stream.next_in   = filtered;
+      stream.avail_in  = filtered_size;
+      stream.next_out  = band->out + header;
+      stream.avail_out = capacity - header - 4;
+
+      int err = deflate(&stream, last ? Z_FINISH : Z_FULL_FLUSH);
+      if (last ? (err != Z_STREAM_END) : (err != Z_OK || stream.avail_in || !stream.avail_out))
+         GOTO_END_ERROR();
+      band->out_size = capacity - 4 - stream.avail_out;
+   }
+
+end:
+   if (stream_init)
+      deflateEnd(&stream);
+   free(filtered);
+   free(lines);
+   return ret;
+}
+
+static void encode_work(struct encode_job *job)
+{
+   for (;;)
+   {
+      slock_lock(job->lock);
+      unsigned index = job->next++;
+      slock_unlock(job->lock);
+
+      if (index >= job->count)
+         break;
+      job->bands[index].ok = encode_band(job, index);
+   }
+}
+
+static void encode_worker(void *userdata)
+{
+   encode_work((struct encode_job*)userdata);
+}
+
+static bool write_chunk(FILE *file, const char *type, const uint8_t *data, size_t size)
+{
+   uint8_t header[8];
+   store_be32(header, size);
+   memcpy(header + 4, type, 4);
+
+   uint8_t crc[4];
+   store_be32(crc, crc32_update(crc32_update(0, header + 4, 4), data, size));
+
+   return fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+      (!size || fwrite(data, 1, size, file) == size) &&
+      fwrite(crc, 1, sizeof(crc), file) == sizeof(crc);
+}
+
+static bool write_png(const char *path, const struct encode_job *job)
+{
+   bool ret = true;
+   FILE *file = fopen(path, "wb");
+   if (!file)
+      return false;
+
+   uint8_t ihdr[13];
+   store_be32(ihdr + 0, job->width);
+   store_be32(ihdr + 4, job->height);
+   ihdr[8]  = 8;
+   ihdr[9]  = job->channels == 4 ? 6 : 2;
+   ihdr[10] = 0;
+   ihdr[11] = 0;
+   ihdr[12] = 0;
+
+   if (fwrite(png_magic, 1, sizeof(png_magic), file) != sizeof(png_magic))
+      GOTO_END_ERROR();
+   if (!write_chunk(file, "IHDR", ihdr, sizeof(ihdr)))
+      GOTO_END_ERROR();
+
+   if (job->count > 1)
+   {
+      uint8_t restarts[(ENCODE_BANDS_MAX - 1) * 8];
+      uint32_t offset = 0;
+      for (unsigned i = 1; i < job->count; i++)
+      {
+         offset += job->bands[i - 1].out_size;
+         store_be32(restarts + 8 * (i - 1), job->bands[i].first_row);
+         store_be32(restarts + 8 * (i - 1) + 4, offset);
+      }
+      if (!write_chunk(file, "rfLP", restarts, 8 * (job->count - 1)))
+         GOTO_END_ERROR();
+   }
+
+   // One IDAT per band. The last one carries the Adler-32 trailer.
+   for (unsigned i = 0; i < job->count; i++)
+   {
+      if (!write_chunk(file, "IDAT", job->bands[i].out, job->bands[i].out_size))
+         GOTO_END_ERROR();
+   }
+
+   if (!write_chunk(file, "IEND", NULL, 0))
+      GOTO_END_ERROR();
+
+end:
+   if (fclose(file) != 0)
+      ret = false;
+   if (!ret)
+      remove(path);
+   return ret;
+}
+
+bool rpng_save_image_rgba(const char *path, const uint8_t *data,
+      unsigned width, unsigned height, size_t pitch, bool bottom_left, bool alpha, int level)
+{
+   bool ret = true;
+   struct encode_job job;
+   sthread_t *threads[ENCODE_BANDS_MAX];
+   unsigned thread_count = 0;
+
+   if (!width || !height)
+      return false;
+
+   memset(&job, 0, sizeof(job));
+   job.data     = data;
+   job.width    = width;
+   job.height   = height;
+   job.pitch    = pitch;
+   job.bottom_left = bottom_left;
+   job.channels = alpha ? 4 : 3;
+   job.level    = level < 1 ? 1 : level > 9 ? 9 : level;
+
+   // A couple of bands per CPU balances uneven rows, as long as they stay tall.
+   unsigned cpus = sthread_cpu_count();
+   job.count = 2 * cpus;
+   if (job.count > height / ENCODE_BAND_ROWS_MIN)
+      job.count = height / ENCODE_BAND_ROWS_MIN;
+   if (job.count > ENCODE_BANDS_MAX)
+      job.count = ENCODE_BANDS_MAX;
+   if (job.count < 1)
+      job.count = 1;
+
+   job.bands = (struct encode_band*)calloc(job.count, sizeof(*job.bands));
+   if (!job.bands)
+      return false;
+
+   for (unsigned i = 0; i < job.count; i++)
+   {
+      job.bands[i].first_row = (uint64_t)height * i / job.count;
+      job.bands[i].rows = (uint64_t)height * (i + 1) / job.count - job.bands[i].first_row;
+   }
+
+   if (job.count > 1)
+      job.lock = slock_new();
+   if (job.lock)
+   {
+      unsigned want = cpus < job.count ? cpus : job.count;
+      for (unsigned i = 1; i < want; i++)
+      {
+         threads[thread_count] = sthread_create(encode_worker, &job);
+         if (!threads[thread_count])
+            break;
+         thread_count++;
+      }
+      encode_work(&job);
+   }
+   else
+   {
+      for (unsigned i = 0; i < job.count; i++)
+         job.bands[i].ok = encode_band(&job, i);
+   }
+
+   for (unsigned i = 0; i < thread_count; i++)
+      sthread_join(threads[i]);
+
+   {
+      uint32_t adler = 1;
+      for (unsigned i = 0; i < job.count; i++)
+      {
+         struct encode_band *band = &job.bands[i];
+         if (!band->ok)
+            GOTO_END_ERROR();
+         adler = adler32_join(adler, band->adler,
+               ((size_t)width * job.channels + 1) * band->rows);
+      }
+
+      // encode_band() left room for it.
+      struct encode_band *last = &job.bands[job.count - 1];
+      store_be32(last->out + last->out_size, adler);
+      last->out_size += 4;
+   }
+
+   if (!write_png(path, &job))
+      GOTO_END_ERROR();
+
+end:
+   if (job.lock)
+      slock_free(job.lock);
+   for (unsigned i = 0; i < job.count; i++)
+      free(job.bands[i].out);
+   free(job.bands);
+   return ret;
+}
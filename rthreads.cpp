@@ -0,0 +1,314 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rthreads.h"
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef __MACH__
+#include <sys/time.h>
+#endif
+#endif
+
+struct thread_data
+{
+   void (*func)(void*);
+   void *userdata;
+};
+
+#ifdef _WIN32
+
+struct sthread
+{
+   HANDLE thread;
+};
+
+struct slock
+{
+   CRITICAL_SECTION lock;
+};
+
+struct scond
+{
+   CONDITION_VARIABLE cond;
+};
+
+static DWORD CALLBACK thread_wrap(void *data_)
+{
+   struct thread_data *data = (struct thread_data*)data_;
+   data->func(data->userdata);
+   free(data);
+   return 0;
+}
+
+sthread_t *sthread_create(void (*thread_func)(void*), void *userdata)
+{
+   sthread_t *thread = (sthread_t*)calloc(1, sizeof(*thread));
+   struct thread_data *data = (struct thread_data*)calloc(1, sizeof(*data));
+   if (!thread || !data)
+      goto error;
+
+   data->func = thread_func;
+   data->userdata = userdata;
+
+   thread->thread = CreateThread(NULL, 0, thread_wrap, data, 0, NULL);
+   if (!thread->thread)
+      goto error;
+
+   return thread;
+
+error:
+   free(data);
+   free(thread);
+   return NULL;
+}
+
+void sthread_join(sthread_t *thread)
+{
+   WaitForSingleObject(thread->thread, INFINITE);
+   CloseHandle(thread->thread);
+   free(thread);
+}
+
+unsigned sthread_cpu_count(void)
+{
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+slock_t *slock_new(void)
+{
+   slock_t *lock = (slock_t*)calloc(1, sizeof(*lock));
+   if (!lock)
+      return NULL;
+
+   InitializeCriticalSection(&lock->lock);
+   return lock;
+}
+
+void slock_free(slock_t *lock)
+{
+   if (!lock)
+      return;
+   DeleteCriticalSection(&lock->lock);
+   free(lock);
+}
+
+void slock_lock(slock_t *lock)
+{
+   EnterCriticalSection(&lock->lock);
+}
+
+void slock_unlock(slock_t *lock)
+{
+   LeaveCriticalSection(&lock->lock);
+}
+
+scond_t *scond_new(void)
+{
+   scond_t *cond = (scond_t*)calloc(1, sizeof(*cond));
+   if (!cond)
+      return NULL;
+
+   InitializeConditionVariable(&cond->cond);
+   return cond;
+}
+
+void scond_free(scond_t *cond)
+{
+   free(cond);
+}
+
+void scond_wait(scond_t *cond, slock_t *lock)
+{
+   SleepConditionVariableCS(&cond->cond, &lock->lock, INFINITE);
+}
+
+bool scond_wait_timeout(scond_t *cond, slock_t *lock, int64_t timeout_us)
+{
+   DWORD ms = timeout_us > 0 ? (DWORD)((timeout_us + 999) / 1000) : 0;
+   return SleepConditionVariableCS(&cond->cond, &lock->lock, ms) != 0;
+}
+
+void scond_signal(scond_t *cond)
+{
+   WakeConditionVariable(&cond->cond);
+}
+
+void scond_broadcast(scond_t *cond)
+{
+   WakeAllConditionVariable(&cond->cond);
+}
+
+#else
+
+struct sthread
+{
+   pthread_t id;
+};
+
+struct slock
+{
+   pthread_mutex_t lock;
+};
+
+struct scond
+{
+   pthread_cond_t cond;
+};
+
+static void *thread_wrap(void *data_)
+{
+   struct thread_data *data = (struct thread_data*)data_;
+   data->func(data->userdata);
+   free(data);
+   return NULL;
+}
+
+sthread_t *sthread_create(void (*thread_func)(void*), void *userdata)
+{
+   sthread_t *thread = (sthread_t*)calloc(1, sizeof(*thread));
+   struct thread_data *data = (struct thread_data*)calloc(1, sizeof(*data));
+   if (!thread || !data)
+      goto error;
+
+   data->func = thread_func;
+   data->userdata = userdata;
+
+   if (pthread_create(&thread->id, NULL, thread_wrap, data) != 0)
+      goto error;
+
+   return thread;
+
+error:
+   free(data);
+   free(thread);
+   return NULL;
+}
+
+void sthread_join(sthread_t *thread)
+{
+   pthread_join(thread->id, NULL);
+   free(thread);
+}
+
+unsigned sthread_cpu_count(void)
+{
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count > 0 ? count : 1;
+}
+
+slock_t *slock_new(void)
+{
+   slock_t *lock = (slock_t*)calloc(1, sizeof(*lock));
+   if (!lock)
+      return NULL;
+
+   if (pthread_mutex_init(&lock->lock, NULL) != 0)
+   {
+      free(lock);
+      return NULL;
+   }
+
+   return lock;
+}
+
+void slock_free(slock_t *lock)
+{
+   if (!lock)
+      return;
+   pthread_mutex_destroy(&lock->lock);
+   free(lock);
+}
+
+void slock_lock(slock_t *lock)
+{
+   pthread_mutex_lock(&lock->lock);
+}
+
+void slock_unlock(slock_t *lock)
+{
+   pthread_mutex_unlock(&lock->lock);
+}
+
+scond_t *scond_new(void)
+{
+   scond_t *cond = (scond_t*)calloc(1, sizeof(*cond));
+   if (!cond)
+      return NULL;
+
+   if (pthread_cond_init(&cond->cond, NULL) != 0)
+   {
+      free(cond);
+      return NULL;
+   }
+
+   return cond;
+}
+
+void scond_free(scond_t *cond)
+{
+   if (!cond)
+      return;
+   pthread_cond_destroy(&cond->cond);
+   free(cond);
+}
+
+void scond_wait(scond_t *cond, slock_t *lock)
+{
+   pthread_cond_wait(&cond->cond, &lock->lock);
+}
+
+bool scond_wait_timeout(scond_t *cond, slock_t *lock, int64_t timeout_us)
+{
+   struct timespec now;
+#ifdef __MACH__
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   now.tv_sec  = tv.tv_sec;
+   now.tv_nsec = tv.tv_usec * 1000;
+#else
+   clock_gettime(CLOCK_REALTIME, &now);
+#endif
+
+   if (timeout_us < 0)
+      timeout_us = 0;
+   int64_t nsec = now.tv_nsec + (timeout_us % 1000000) * 1000;
+   struct timespec deadline;
+   deadline.tv_sec  = now.tv_sec + timeout_us / 1000000 + nsec / 1000000000;
+   deadline.tv_nsec = nsec % 1000000000;
+
+   return pthread_cond_timedwait(&cond->cond, &lock->lock, &deadline) == 0;
+}
+
+void scond_signal(scond_t *cond)
+{
+   pthread_cond_signal(&cond->cond);
+}
+
+void scond_broadcast(scond_t *cond)
+{
+   pthread_cond_broadcast(&cond->cond);
+}
+
+#endif
+
@@ -0,0 +1,57 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2013 - Hans-Kristian Arntzen
+ * 
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTHREADS_H__
+#define RTHREADS_H__
+
+#include "boolean.h"
+#include <stdint.h>
+
+// Trimmed down version of RetroArch's portable threading wrappers.
+// pthreads everywhere except Windows.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sthread sthread_t;
+typedef struct slock slock_t;
+typedef struct scond scond_t;
+
+sthread_t *sthread_create(void (*thread_func)(void*), void *userdata);
+void sthread_join(sthread_t *thread);
+
+// Number of online CPUs, at least 1.
+unsigned sthread_cpu_count(void);
+
+slock_t *slock_new(void);
+void slock_free(slock_t *lock);
+void slock_lock(slock_t *lock);
+void slock_unlock(slock_t *lock);
+
+scond_t *scond_new(void);
+void scond_free(scond_t *cond);
+void scond_wait(scond_t *cond, slock_t *lock);
+// Returns false if timeout_us passed without a signal.
+bool scond_wait_timeout(scond_t *cond, slock_t *lock, int64_t timeout_us);
+void scond_signal(scond_t *cond);
+void scond_broadcast(scond_t *cond);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
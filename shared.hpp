@@ -37,5 +37,8 @@ namespace std1 = std::tr1;
 
 extern retro_log_printf_t log_cb;
 
+// Monotonic time in microseconds.
+retro_time_t get_time_usec(void);
+
 #endif
 
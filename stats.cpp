@@ -0,0 +1,67 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+void stats_add(struct stats_window *stats, float sample)
+{
+   stats->samples[stats->next] = sample;
+   stats->next = (stats->next + 1) % STATS_WINDOW;
+   if (stats->count < STATS_WINDOW)
+      stats->count++;
+}
+
+void stats_clear(struct stats_window *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+}
+
+bool stats_mean(const struct stats_window *stats, float *mean)
+{
+   if (!stats->count)
+      return false;
+
+   float sum = 0.0f;
+   for (unsigned i = 0; i < stats->count; i++)
+      sum += stats->samples[i];
+   *mean = sum / stats->count;
+   return true;
+}
+
+static float rank(const float *sorted, unsigned count, unsigned percent)
+{
+   unsigned index = (count * percent + 99) / 100;
+   return sorted[index ? index - 1 : 0];
+}
+
+bool stats_percentiles(const struct stats_window *stats, float *p50, float *p95, float *p99)
+{
+   if (!stats->count)
+      return false;
+
+   float sorted[STATS_WINDOW];
+   memcpy(sorted, stats->samples, stats->count * sizeof(float));
+   std::sort(sorted, sorted + stats->count);
+
+   *p50 = rank(sorted, stats->count, 50);
+   *p95 = rank(sorted, stats->count, 95);
+   *p99 = rank(sorted, stats->count, 99);
+   return true;
+}
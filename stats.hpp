@@ -0,0 +1,42 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_HPP__
+#define STATS_HPP__
+
+// Percentiles over the last STATS_WINDOW samples, so they follow what
+// happens now rather than everything since load.
+
+#define STATS_WINDOW 512
+
+struct stats_window
+{
+   float samples[STATS_WINDOW];
+   unsigned count;
+   unsigned next;
+};
+
+void stats_add(struct stats_window *stats, float sample);
+void stats_clear(struct stats_window *stats);
+
+// Mean of the window. Returns false without samples.
+bool stats_mean(const struct stats_window *stats, float *mean);
+
+// Nearest-rank p50, p95 and p99. Returns false without samples.
+bool stats_percentiles(const struct stats_window *stats, float *p50, float *p95, float *p99);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Round trips through rpng_save_image_rgba(), run by "make test" once per
+// inflate backend. Every row of the source is tagged with its index. The
+// written file is read back twice: row by row through the stream decoder,
+// and whole through rpng_load_image_rgba(), which decodes the bands between
+// the encoder's restart points in parallel. Both must give back every texel
+// of the row its origin says it should.
+
+#include "../rpng.h"
+#include "../rinflate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+// Tall enough to be split into several bands.
+#define TEST_WIDTH  37
+#define TEST_HEIGHT 600
+
+// Source texel. R and G hold the row, the rest changes from texel to texel
+// so every filter type gets used.
+static void source_texel(unsigned x, unsigned y, uint8_t *px)
+{
+   px[0] = y & 0xff;
+   px[1] = y >> 8;
+   px[2] = x * 7 + y * 13;
+   px[3] = (x ^ y) | 0x80;
+}
+
+static bool check_row(const char *what, const uint8_t *row, unsigned y, unsigned source_y, bool alpha)
+{
+   for (unsigned x = 0; x < TEST_WIDTH; x++)
+   {
+      uint8_t expected[4];
+      source_texel(x, source_y, expected);
+      if (!alpha)
+         expected[3] = 0xff;
+
+      const uint8_t *px = &row[4 * x];
+      if (memcmp(px, expected, 4) != 0)
+      {
+         fprintf(stderr, "%s: row %u pixel %u is %02x%02x%02x%02x, expected %02x%02x%02x%02x from row %u.\n",
+               what, y, x, px[0], px[1], px[2], px[3],
+               expected[0], expected[1], expected[2], expected[3], source_y);
+         return false;
+      }
+   }
+   return true;
+}
+
+static bool check_stream(const char *path, const char *what, bool bottom_left, bool alpha)
+{
+   unsigned width = 0, height = 0;
+   rpng_stream_t *stream = rpng_stream_open(path, &width, &height);
+   if (!stream || width != TEST_WIDTH || height != TEST_HEIGHT)
+   {
+      fprintf(stderr, "%s: couldn't stream %s.\n", what, path);
+      if (stream)
+         rpng_stream_close(stream);
+      return false;
+   }
+
+   // Top row first.
+   bool ok = true;
+   std::vector<uint8_t> row(4 * TEST_WIDTH);
+   for (unsigned y = 0; ok && y < TEST_HEIGHT; y++)
+   {
+      if (!rpng_stream_read_row(stream, &row[0]))
+      {
+         fprintf(stderr, "%s: row %u is missing.\n", what, y);
+         ok = false;
+      }
+      else
+         ok = check_row(what, &row[0], y, bottom_left ? TEST_HEIGHT - 1 - y : y, alpha);
+   }
+
+   rpng_stream_close(stream);
+   return ok;
+}
+
+// Number of entries in the rfLP chunk, 0 if there is none.
+static unsigned count_restarts(const char *path)
+{
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return 0;
+
+   unsigned count = 0;
+   uint8_t header[8];
+   fseek(file, 8, SEEK_SET);
+   while (fread(header, 1, sizeof(header), file) == sizeof(header))
+   {
+      uint32_t size = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+      if (!memcmp(header + 4, "rfLP", 4))
+      {
+         count = size / 8;
+         break;
+      }
+      if (!memcmp(header + 4, "IEND", 4) || fseek(file, size + 4, SEEK_CUR) < 0)
+         break;
+   }
+
+   fclose(file);
+   return count;
+}
+
+static bool check_load(const char *path, const char *what, bool bottom_left, bool alpha)
+{
+   if (!count_restarts(path))
+   {
+      fprintf(stderr, "%s: no restart points, nothing to decode in parallel.\n", what);
+      return false;
+   }
+
+   // rpng falls back to a serial decode if the bands don't work out, and
+   // only says so on stderr.
+   FILE *log = tmpfile();
+   int saved = dup(STDERR_FILENO);
+   if (!log || saved < 0)
+      return false;
+   fflush(stderr);
+   dup2(fileno(log), STDERR_FILENO);
+
+   uint8_t *data = NULL;
+   unsigned width = 0, height = 0;
+   bool loaded = rpng_load_image_rgba(path, &data, &width, &height);
+
+   fflush(stderr);
+   dup2(saved, STDERR_FILENO);
+   close(saved);
+
+   char message[256] = {0};
+   rewind(log);
+   size_t message_size = fread(message, 1, sizeof(message) - 1, log);
+   fclose(log);
+
+   bool ok = true;
+   if (!loaded || width != TEST_WIDTH || height != TEST_HEIGHT)
+   {
+      fprintf(stderr, "%s: couldn't load %s.\n", what, path);
+      ok = false;
+   }
+   else if (message_size)
+   {
+      fprintf(stderr, "%s: %s", what, message);
+      ok = false;
+   }
+
+   // Bottom row first.
+   for (unsigned y = 0; ok && y < TEST_HEIGHT; y++)
+   {
+      unsigned image_y = TEST_HEIGHT - 1 - y;
+      ok = check_row(what, data + 4 * TEST_WIDTH * y, image_y,
+            bottom_left ? TEST_HEIGHT - 1 - image_y : image_y, alpha);
+   }
+
+   free(data);
+   return ok;
+}
+
+static bool check(const char *path, bool bottom_left, bool alpha, size_t pitch, int level)
+{
+   char what[96];
+   snprintf(what, sizeof(what), "%s origin, %s, pitch %u, level %d",
+         bottom_left ? "Bottom-left" : "Top-left", alpha ? "RGBA" : "RGB",
+         (unsigned)pitch, level);
+
+   std::vector<uint8_t> pixels(pitch * TEST_HEIGHT, 0xee);
+   for (unsigned y = 0; y < TEST_HEIGHT; y++)
+      for (unsigned x = 0; x < TEST_WIDTH; x++)
+         source_texel(x, y, &pixels[y * pitch + 4 * x]);
+
+   if (!rpng_save_image_rgba(path, &pixels[0], TEST_WIDTH, TEST_HEIGHT, pitch,
+            bottom_left, alpha, level))
+   {
+      fprintf(stderr, "%s: couldn't write %s.\n", what, path);
+      return false;
+   }
+
+   bool streamed = check_stream(path, what, bottom_left, alpha);
+   bool loaded   = check_load(path, what, bottom_left, alpha);
+   return streamed && loaded;
+}
+
+int main(void)
+{
+   char path[] = "/tmp/rpng_encode_test-XXXXXX";
+   int fd = mkstemp(path);
+   if (fd < 0)
+      return 1;
+   close(fd);
+
+   static const int levels[] = { 6, 9 };
+   unsigned failed = 0;
+   for (unsigned origin = 0; origin < 2; origin++)
+   {
+      for (unsigned alpha = 0; alpha < 2; alpha++)
+      {
+         failed += !check(path, origin, alpha, 4 * TEST_WIDTH, 1);
+         failed += !check(path, origin, alpha, 4 * TEST_WIDTH + 12, 1);
+      }
+   }
+   // Level 1 only tries run-length matches, the others go through zlib's deflate.
+   for (unsigned i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+      failed += !check(path, true, true, 4 * TEST_WIDTH, levels[i]);
+
+   unlink(path);
+   printf("rpng_encode_test (%s inflate): %s\n", rinflate_backend(), failed ? "FAILED" : "ok");
+   return failed != 0;
+}
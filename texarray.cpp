@@ -0,0 +1,431 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texarray.hpp"
+#include "mipmap.hpp"
+#include "rthreads.h"
+#include "rpng.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+
+// Upper bound on layers handed to GL per frame.
+#define LAYERS_PER_FRAME 16
+
+#define LAYER_BYTES (TEXARRAY_LAYER_SIZE * TEXARRAY_LAYER_SIZE * 4)
+
+static std::vector<std::string> paths;
+static std::vector<uint8_t*> layers; // NULL where an image failed to decode.
+
+// Worker state. Entries of layers below decoded are final.
+// decoded and stop_decode are guarded by lock.
+static sthread_t *thread;
+static slock_t *lock;
+static unsigned decoded;
+static bool stop_decode;
+
+// Render thread state.
+static bool use_array;
+static GLuint texture;
+static unsigned uploaded;
+static bool complete;
+static unsigned atlas_cols;
+static unsigned atlas_rows;
+static unsigned atlas_tile;
+
+static bool has_png_extension(const std::string &name)
+{
+   if (name.size() < 4)
+      return false;
+
+   std::string ext = name.substr(name.size() - 4);
+   for (size_t i = 0; i < ext.size(); i++)
+      ext[i] = tolower((unsigned char)ext[i]);
+   return ext == ".png";
+}
+
+bool texarray_read_playlist(const char *path, std::vector<std::string> *out)
+{
+   FILE *file = fopen(path, "r");
+   if (!file)
+      return false;
+
+   std::string dir = path;
+   size_t slash = dir.find_last_of("/\\");
+   dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+   char line[4096];
+   while (fgets(line, sizeof(line), file))
+   {
+      std::string entry = line;
+      while (!entry.empty() && isspace((unsigned char)entry[entry.size() - 1]))
+         entry.erase(entry.size() - 1);
+
+      size_t start = entry.find_first_not_of(" \t");
+      if (start == std::string::npos)
+         continue;
+      entry = entry.substr(start);
+
+      if (entry[0] == '#' || !has_png_extension(entry))
+         continue;
+
+      bool absolute = entry[0] == '/' || entry[0] == '\\' ||
+         (entry.size() > 1 && entry[1] == ':');
+      out->push_back(absolute ? entry : dir + entry);
+   }
+
+   fclose(file);
+   return !out->empty();
+}
+
+bool texarray_list_directory(const char *dir, std::vector<std::string> *out)
+{
+   std::vector<std::string> names;
+
+#ifdef _WIN32
+   WIN32_FIND_DATAA data;
+   HANDLE find = FindFirstFileA((std::string(dir) + "\\*.png").c_str(), &data);
+   if (find == INVALID_HANDLE_VALUE)
+      return false;
+   do
+   {
+      if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+         names.push_back(data.cFileName);
+   } while (FindNextFileA(find, &data));
+   FindClose(find);
+#else
+   DIR *handle = opendir(dir);
+   if (!handle)
+      return false;
+
+   struct dirent *entry;
+   while ((entry = readdir(handle)))
+   {
+      if (has_png_extension(entry->d_name))
+         names.push_back(entry->d_name);
+   }
+   closedir(handle);
+#endif
+
+   std::sort(names.begin(), names.end());
+   for (size_t i = 0; i < names.size(); i++)
+      out->push_back(std::string(dir) + "/" + names[i]);
+   return !names.empty();
+}
+
+// Averages the source texels covering each destination texel. Upscaling
+// degrades to nearest neighbour.
+static void resample(const uint8_t *src, unsigned width, unsigned height, uint8_t *dst, unsigned size)
+{
+   for (unsigned y = 0; y < size; y++)
+   {
+      unsigned y0 = y * height / size;
+      unsigned y1 = std::max((y + 1) * height / size, y0 + 1);
+
+      for (unsigned x = 0; x < size; x++)
+      {
+         unsigned x0 = x * width / size;
+         unsigned x1 = std::max((x + 1) * width / size, x0 + 1);
+
+         unsigned sum[4] = {0};
+         for (unsigned sy = y0; sy < y1; sy++)
+         {
+            const uint8_t *p = src + 4 * ((size_t)sy * width + x0);
+            for (unsigned sx = x0; sx < x1; sx++, p += 4)
+            {
+               sum[0] += p[0];
+               sum[1] += p[1];
+               sum[2] += p[2];
+               sum[3] += p[3];
+            }
+         }
+
+         unsigned count = (y1 - y0) * (x1 - x0);
+         uint8_t *out = dst + 4 * (y * size + x);
+         for (unsigned c = 0; c < 4; c++)
+            out[c] = (sum[c] + count / 2) / count;
+      }
+   }
+}
+
+// Decodes into a buffer that is reused for every image.
+static uint8_t *pixels_alloc(const struct rpng_image *image, void *userdata)
+{
+   std::vector<uint8_t> *pixels = (std::vector<uint8_t>*)userdata;
+   pixels->resize((size_t)image->width * image->height * 4);
+   return &(*pixels)[0];
+}
+
+static void worker_func(void *data)
+{
+   (void)data;
+
+   // After the largest image so far, decoding allocates nothing.
+   rpng_decoder_t *decoder = rpng_decoder_new();
+   std::vector<uint8_t> pixels;
+
+   for (unsigned i = 0; i < paths.size(); i++)
+   {
+      if (lock)
+      {
+         slock_lock(lock);
+         bool stop = stop_decode;
+         slock_unlock(lock);
+         if (stop)
+            break;
+      }
+
+      uint8_t *layer = NULL;
+      uint8_t *image_data;
+      struct rpng_image image;
+      if (rpng_decoder_load_image(decoder, paths[i].c_str(), RPNG_FORMAT_BIT(RPNG_FORMAT_RGBA8), 0,
+               pixels_alloc, &pixels, &image_data, &image))
+      {
+         layer = (uint8_t*)malloc(LAYER_BYTES);
+         if (layer)
+            resample(image_data, image.width, image.height, layer, TEXARRAY_LAYER_SIZE);
+      }
+      else if (log_cb)
+         log_cb(RETRO_LOG_WARN, "Couldn't load image: %s\n", paths[i].c_str());
+
+      if (lock)
+         slock_lock(lock);
+      layers[i] = layer;
+      decoded   = i + 1;
+      if (lock)
+         slock_unlock(lock);
+   }
+
+   rpng_decoder_free(decoder);
+}
+
+unsigned texarray_start(const std::vector<std::string> &paths_)
+{
+   texarray_unload();
+
+   paths.assign(paths_.begin(), paths_.begin() +
+         std::min<size_t>(paths_.size(), TEXARRAY_MAX_LAYERS));
+   layers.assign(paths.size(), (uint8_t*)NULL);
+   decoded     = 0;
+   stop_decode = false;
+
+   lock   = slock_new();
+   thread = lock ? sthread_create(worker_func, NULL) : NULL;
+
+   // No threads, decode everything up front.
+   if (!thread)
+   {
+      slock_free(lock);
+      lock = NULL;
+      worker_func(NULL);
+   }
+
+   return paths.size();
+}
+
+static bool query_array_support(void)
+{
+#ifdef GLES
+   return false;
+#else
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   const char *ext     = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   unsigned major = 0;
+   if (version)
+      sscanf(version, "%u.", &major);
+   return major >= 3 || (ext && strstr(ext, "GL_EXT_texture_array"));
+#endif
+}
+
+GLuint texarray_context_reset(GLenum *target)
+{
+   unsigned count = std::max<unsigned>(paths.size(), 1);
+   std::vector<uint8_t> grey(LAYER_BYTES, 0x80);
+   for (size_t i = 3; i < grey.size(); i += 4)
+      grey[i] = 0xff;
+
+   use_array = query_array_support();
+   uploaded  = 0;
+   complete  = false;
+
+   SYM(glGenTextures)(1, &texture);
+
+#ifndef GLES
+   if (use_array)
+   {
+      *target = GL_TEXTURE_2D_ARRAY;
+      SYM(glBindTexture)(GL_TEXTURE_2D_ARRAY, texture);
+      SYM(glTexImage3D)(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, TEXARRAY_LAYER_SIZE, TEXARRAY_LAYER_SIZE,
+            count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      for (unsigned i = 0; i < count; i++)
+         SYM(glTexSubImage3D)(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, TEXARRAY_LAYER_SIZE, TEXARRAY_LAYER_SIZE,
+               1, GL_RGBA, GL_UNSIGNED_BYTE, &grey[0]);
+      SYM(glTexParameteri)(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      SYM(glTexParameteri)(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      SYM(glTexParameteri)(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      SYM(glTexParameteri)(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      SYM(glBindTexture)(GL_TEXTURE_2D_ARRAY, 0);
+      return texture;
+   }
+#endif
+
+   // Square-ish grid of tiles, halved until it fits. Atlases aren't mipmapped,
+   // neighbouring tiles would bleed into each other.
+   GLint max_size = 0;
+   SYM(glGetIntegerv)(GL_MAX_TEXTURE_SIZE, &max_size);
+   atlas_cols = (unsigned)ceil(sqrt((double)count));
+   atlas_rows = (count + atlas_cols - 1) / atlas_cols;
+   atlas_tile = TEXARRAY_LAYER_SIZE;
+   while (atlas_tile > 1 && (atlas_tile * atlas_cols > (unsigned)max_size ||
+            atlas_tile * atlas_rows > (unsigned)max_size))
+      atlas_tile >>= 1;
+
+   *target = GL_TEXTURE_2D;
+   SYM(glBindTexture)(GL_TEXTURE_2D, texture);
+   SYM(glTexImage2D)(GL_TEXTURE_2D, 0, GL_RGBA, atlas_tile * atlas_cols, atlas_tile * atlas_rows,
+         0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+   for (unsigned i = 0; i < atlas_cols * atlas_rows; i++)
+      SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, (i % atlas_cols) * atlas_tile, (i / atlas_cols) * atlas_tile,
+            atlas_tile, atlas_tile, GL_RGBA, GL_UNSIGNED_BYTE, &grey[0]);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+   return texture;
+}
+
+void texarray_context_destroy(void)
+{
+   if (texture)
+      SYM(glDeleteTextures)(1, &texture);
+   texture  = 0;
+   uploaded = 0;
+   complete = false;
+}
+
+static void upload_layer(unsigned index)
+{
+   const uint8_t *layer = layers[index];
+   if (!layer)
+      return;
+
+#ifndef GLES
+   if (use_array)
+   {
+      SYM(glTexSubImage3D)(GL_TEXTURE_2D_ARRAY, 0, 0, 0, index, TEXARRAY_LAYER_SIZE, TEXARRAY_LAYER_SIZE,
+            1, GL_RGBA, GL_UNSIGNED_BYTE, layer);
+      return;
+   }
+#endif
+
+   // Shrink to the atlas tile size.
+   std::vector<uint8_t> scratch[2];
+   unsigned size = TEXARRAY_LAYER_SIZE;
+   for (unsigned i = 0; size > atlas_tile; i ^= 1)
+   {
+      scratch[i].resize((size / 2) * (size / 2) * 4);
+      mipmap_downsample_rgba8(layer, size, size, &scratch[i][0], true);
+      layer = &scratch[i][0];
+      size /= 2;
+   }
+
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, (index % atlas_cols) * atlas_tile,
+         (index / atlas_cols) * atlas_tile, atlas_tile, atlas_tile,
+         GL_RGBA, GL_UNSIGNED_BYTE, layer);
+}
+
+bool texarray_update(GLuint *tex)
+{
+   if (complete || !texture)
+      return false;
+
+   if (lock)
+      slock_lock(lock);
+   unsigned ready = decoded;
+   if (lock)
+      slock_unlock(lock);
+
+   GLenum target = use_array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+   unsigned end  = std::min(ready, uploaded + LAYERS_PER_FRAME);
+
+   SYM(glBindTexture)(target, texture);
+   for (; uploaded < end; uploaded++)
+      upload_layer(uploaded);
+
+   if (uploaded == paths.size())
+   {
+      complete = true;
+#ifndef GLES
+      if (use_array)
+      {
+         SYM(glGenerateMipmap)(GL_TEXTURE_2D_ARRAY);
+         SYM(glTexParameteri)(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      }
+#endif
+   }
+   SYM(glBindTexture)(target, 0);
+
+   *tex = texture;
+   return complete;
+}
+
+bool texarray_atlas(float *grid)
+{
+   if (use_array)
+      return false;
+
+   grid[0] = atlas_cols;
+   grid[1] = atlas_rows;
+   grid[2] = grid[3] = 0.5f / atlas_tile;
+   return true;
+}
+
+void texarray_unload(void)
+{
+   if (thread)
+   {
+      slock_lock(lock);
+      stop_decode = true;
+      slock_unlock(lock);
+      sthread_join(thread);
+      thread = NULL;
+   }
+   slock_free(lock);
+   lock = NULL;
+
+   for (size_t i = 0; i < layers.size(); i++)
+      free(layers[i]);
+   layers.clear();
+   paths.clear();
+
+   decoded  = 0;
+   texture  = 0;
+   uploaded = 0;
+   complete = false;
+}
@@ -0,0 +1,65 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXARRAY_HPP__
+#define TEXARRAY_HPP__
+
+#include "gl.hpp"
+#include <string>
+#include <vector>
+
+// Many images in one texture, for the image wall.
+//
+// Images are decoded one after another on a worker thread and scaled to
+// TEXARRAY_LAYER_SIZE squared. Each frame, the render thread uploads the
+// layers that are ready, so the wall fills in progressively. Where the
+// context has texture arrays, every image is a layer of a
+// GL_TEXTURE_2D_ARRAY. Otherwise (GLES2) the images are tiled into a
+// 2D atlas, shrunk by powers of two if the grid wouldn't fit.
+
+#define TEXARRAY_LAYER_SIZE 256
+#define TEXARRAY_MAX_LAYERS 256
+
+// Lines of a playlist that name .png files, relative to the playlist's directory.
+bool texarray_read_playlist(const char *path, std::vector<std::string> *paths);
+
+// Every .png in dir, sorted by name.
+bool texarray_list_directory(const char *dir, std::vector<std::string> *paths);
+
+// Starts decoding. Returns the number of layers, at most TEXARRAY_MAX_LAYERS.
+unsigned texarray_start(const std::vector<std::string> &paths);
+
+// Call from context_reset(). Every GL object from before is considered lost.
+// Returns the texture to bind and its target.
+GLuint texarray_context_reset(GLenum *target);
+
+// Deletes the texture. Call with the context current, before a
+// texarray_context_reset() that doesn't follow a real context loss.
+void texarray_context_destroy(void);
+
+// Call once per frame on the render thread. Returns true when *tex holds every image.
+bool texarray_update(GLuint *tex);
+
+// True if the images are tiled into a 2D atlas rather than layered.
+// grid receives columns, rows and the half-texel inset of one tile in tile units.
+bool texarray_atlas(float *grid);
+
+// Stops the worker and frees everything. Makes no GL calls.
+void texarray_unload(void);
+
+#endif
+
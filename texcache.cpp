@@ -0,0 +1,293 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texcache.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const char texcache_magic[8] = { 'I', 'V', 'T', 'E', 'X', 'C', 0x0d, 0x0a };
+#define TEXCACHE_VERSION 2
+
+// Anything larger is not an image this core would have stored.
+#define TEXCACHE_MAX_SIZE 65536
+
+struct texcache_level
+{
+   uint32_t width;
+   uint32_t height;
+   uint64_t offset; // Relative to data_offset.
+   uint64_t size;
+};
+
+struct texcache_header
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t data_offset;
+
+   uint64_t hash;
+   uint64_t source_size;
+   int64_t source_mtime;
+   uint32_t variant;
+
+   uint32_t format;
+   uint32_t width;
+   uint32_t height;
+   uint32_t levels;
+   uint32_t pad;
+   uint64_t data_size;
+   struct texcache_level level[TEXTURE_MAX_LEVELS];
+   uint8_t palette[256 * 4];
+};
+
+static inline uint64_t align_up(uint64_t v)
+{
+   return (v + TEXCACHE_ALIGN - 1) & ~(uint64_t)(TEXCACHE_ALIGN - 1);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+   const uint8_t *p = (const uint8_t*)data;
+   for (size_t i = 0; i < size; i++)
+   {
+      hash ^= p[i];
+      hash *= 0x100000001b3ull;
+   }
+   return hash;
+}
+
+static std::string entry_path(const char *dir, const struct texcache_key *key)
+{
+   char name[32];
+   snprintf(name, sizeof(name), "/%016llx.ivt", (unsigned long long)key->hash);
+   return std::string(dir) + name;
+}
+
+bool texcache_make_key(const char *path, uint32_t variant, struct texcache_key *key)
+{
+   struct stat st;
+   if (stat(path, &st) < 0)
+      return false;
+
+   key->source_size  = st.st_size;
+   key->source_mtime = st.st_mtime;
+   key->variant      = variant;
+
+   uint64_t hash = 0xcbf29ce484222325ull;
+   hash = fnv1a(hash, path, strlen(path));
+   hash = fnv1a(hash, &key->source_size, sizeof(key->source_size));
+   hash = fnv1a(hash, &key->source_mtime, sizeof(key->source_mtime));
+   hash = fnv1a(hash, &key->variant, sizeof(key->variant));
+   key->hash = hash;
+   return true;
+}
+
+static bool header_valid(const struct texcache_header *header, const struct texcache_key *key, uint64_t file_size)
+{
+   if (memcmp(header->magic, texcache_magic, sizeof(texcache_magic)) != 0)
+      return false;
+   if (header->version != TEXCACHE_VERSION || header->data_offset != TEXCACHE_ALIGN)
+      return false;
+   if (header->hash != key->hash || header->source_size != key->source_size ||
+         header->source_mtime != key->source_mtime || header->variant != key->variant)
+      return false;
+   if (header->levels == 0 || header->levels > TEXTURE_MAX_LEVELS)
+      return false;
+   if (header->data_offset > file_size || header->data_size > file_size - header->data_offset)
+      return false;
+
+   // Every level must be exactly as large as GL expects it to be, or the
+   // upload would read past the mapping.
+   if (header->format > TEXTURE_FORMAT_INDEX8 || header->width == 0 || header->height == 0 ||
+         header->width > TEXCACHE_MAX_SIZE || header->height > TEXCACHE_MAX_SIZE)
+      return false;
+
+   struct texture_image layout;
+   texture_image_layout(&layout, (enum texture_format)header->format,
+         header->width, header->height, header->levels > 1);
+   if (header->levels > layout.levels)
+      return false;
+
+   for (unsigned i = 0; i < header->levels; i++)
+   {
+      const struct texcache_level *level = &header->level[i];
+      if (level->width != layout.level[i].width || level->height != layout.level[i].height ||
+            level->size != layout.level[i].size)
+         return false;
+      if (level->offset > header->data_size || level->size > header->data_size - level->offset)
+         return false;
+   }
+
+   return true;
+}
+
+bool texcache_load(const char *dir, const struct texcache_key *key, struct texture_image *img)
+{
+   memset(img, 0, sizeof(*img));
+
+   std::string path = entry_path(dir, key);
+   FILE *file = fopen(path.c_str(), "rb");
+   if (!file)
+      return false;
+
+   struct texcache_header header;
+   fseek(file, 0, SEEK_END);
+   long file_size = ftell(file);
+   rewind(file);
+
+   if (file_size < 0 || fread(&header, 1, sizeof(header), file) != sizeof(header) ||
+         !header_valid(&header, key, file_size))
+   {
+      fclose(file);
+      return false;
+   }
+
+#ifdef _WIN32
+   img->owned = (uint8_t*)malloc(header.data_size);
+   if (!img->owned || fseek(file, header.data_offset, SEEK_SET) < 0 ||
+         fread(img->owned, 1, header.data_size, file) != header.data_size)
+   {
+      fclose(file);
+      texture_image_free(img);
+      return false;
+   }
+   img->data = img->owned;
+#else
+   void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+   if (map == MAP_FAILED)
+   {
+      fclose(file);
+      return false;
+   }
+   img->map      = map;
+   img->map_size = file_size;
+   img->data     = (const uint8_t*)map + header.data_offset;
+#endif
+   fclose(file);
+
+   img->format = (enum texture_format)header.format;
+   img->width  = header.width;
+   img->height = header.height;
+   img->levels = header.levels;
+   img->size   = header.data_size;
+   memcpy(img->palette, header.palette, sizeof(img->palette));
+   for (unsigned i = 0; i < header.levels; i++)
+   {
+      img->level[i].width  = header.level[i].width;
+      img->level[i].height = header.level[i].height;
+      img->level[i].offset = header.level[i].offset;
+      img->level[i].size   = header.level[i].size;
+   }
+
+   return true;
+}
+
+static bool write_padding(FILE *file, uint64_t size)
+{
+   static const uint8_t zero[256] = {0};
+   while (size)
+   {
+      size_t chunk = size < sizeof(zero) ? size : sizeof(zero);
+      if (fwrite(zero, 1, chunk, file) != chunk)
+         return false;
+      size -= chunk;
+   }
+   return true;
+}
+
+bool texcache_store(const char *dir, const struct texcache_key *key, const struct texture_image *img)
+{
+   if (img->levels == 0 || img->levels > TEXTURE_MAX_LEVELS)
+      return false;
+
+#ifdef _WIN32
+   _mkdir(dir);
+#else
+   mkdir(dir, 0755);
+#endif
+
+   struct texcache_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, texcache_magic, sizeof(texcache_magic));
+   header.version      = TEXCACHE_VERSION;
+   header.data_offset  = TEXCACHE_ALIGN;
+   header.hash         = key->hash;
+   header.source_size  = key->source_size;
+   header.source_mtime = key->source_mtime;
+   header.variant      = key->variant;
+   header.format       = img->format;
+   header.width        = img->width;
+   header.height       = img->height;
+   header.levels       = img->levels;
+   memcpy(header.palette, img->palette, sizeof(header.palette));
+
+   uint64_t offset = 0;
+   for (unsigned i = 0; i < img->levels; i++)
+   {
+      header.level[i].width  = img->level[i].width;
+      header.level[i].height = img->level[i].height;
+      header.level[i].offset = offset;
+      header.level[i].size   = img->level[i].size;
+      offset = align_up(offset + img->level[i].size);
+   }
+   header.data_size = offset;
+
+   std::string path = entry_path(dir, key);
+   std::string tmp_path = path + ".tmp";
+   FILE *file = fopen(tmp_path.c_str(), "wb");
+   if (!file)
+      return false;
+
+   bool ret = fwrite(&header, 1, sizeof(header), file) == sizeof(header) &&
+      write_padding(file, TEXCACHE_ALIGN - sizeof(header));
+
+   for (unsigned i = 0; ret && i < img->levels; i++)
+   {
+      const struct texture_level *level = &img->level[i];
+      ret = fwrite(img->data + level->offset, 1, level->size, file) == level->size &&
+         write_padding(file, align_up(level->size) - level->size);
+   }
+
+   if (fclose(file) != 0)
+      ret = false;
+
+   if (ret)
+   {
+#ifdef _WIN32
+      remove(path.c_str());
+#endif
+      ret = rename(tmp_path.c_str(), path.c_str()) == 0;
+   }
+
+   if (!ret)
+      remove(tmp_path.c_str());
+   return ret;
+}
+
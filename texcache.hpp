@@ -0,0 +1,54 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXCACHE_HPP__
+#define TEXCACHE_HPP__
+
+#include <stdint.h>
+#include "texture.hpp"
+
+// On-disk cache of decoded textures.
+//
+// Each entry is a single file: a small header followed by raw level data.
+// Data and every level start on a TEXCACHE_ALIGN boundary, so a hit is just
+// an mmap() of the file; level pointers can go straight to glTexImage2D
+// or be copied into a pixel unpack buffer without any decoding.
+//
+// Entries are keyed on source path, size and mtime, plus a caller-defined
+// variant word which must change whenever the processing applied before
+// storing (mipmaps, compression, ...) changes.
+
+#define TEXCACHE_ALIGN 4096
+
+struct texcache_key
+{
+   uint64_t hash;
+   uint64_t source_size;
+   int64_t source_mtime;
+   uint32_t variant;
+};
+
+bool texcache_make_key(const char *path, uint32_t variant, struct texcache_key *key);
+
+// Returns false on miss, stale or corrupt entry.
+bool texcache_load(const char *dir, const struct texcache_key *key, struct texture_image *img);
+
+// Creates dir if needed. Writes are atomic (temp file + rename).
+bool texcache_store(const char *dir, const struct texcache_key *key, const struct texture_image *img);
+
+#endif
+
@@ -0,0 +1,530 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texcompress.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static inline int clamp_byte(int v)
+{
+   return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline int sq(int v)
+{
+   return v * v;
+}
+
+// Copies a 4x4 block out of an RGBA8 level, repeating edge texels.
+// Texel (x, y) ends up at block[4 * (4 * y + x)].
+static void fetch_block(const uint8_t *src, unsigned width, unsigned height,
+      unsigned bx, unsigned by, uint8_t *block)
+{
+   for (unsigned y = 0; y < 4; y++)
+   {
+      unsigned sy = std::min(by + y, height - 1);
+      for (unsigned x = 0; x < 4; x++)
+      {
+         unsigned sx = std::min(bx + x, width - 1);
+         memcpy(block + 4 * (4 * y + x), src + 4 * ((size_t)sy * width + sx), 4);
+      }
+   }
+}
+
+static void put_le16(uint8_t *out, unsigned v)
+{
+   out[0] = v & 0xff;
+   out[1] = (v >> 8) & 0xff;
+}
+
+static void put_be32(uint8_t *out, uint32_t v)
+{
+   out[0] = v >> 24;
+   out[1] = (v >> 16) & 0xff;
+   out[2] = (v >> 8) & 0xff;
+   out[3] = v & 0xff;
+}
+
+/* BC1 / BC3 */
+
+static inline unsigned pack_565(int r, int g, int b)
+{
+   return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255);
+}
+
+static inline void unpack_565(unsigned c, int *rgb)
+{
+   int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+   rgb[0] = (r << 3) | (r >> 2);
+   rgb[1] = (g << 2) | (g >> 4);
+   rgb[2] = (b << 3) | (b >> 2);
+}
+
+static void encode_bc1_color(const uint8_t *block, uint8_t *out)
+{
+   int mean[3] = {0};
+   for (unsigned i = 0; i < 16; i++)
+      for (unsigned c = 0; c < 3; c++)
+         mean[c] += block[4 * i + c];
+   for (unsigned c = 0; c < 3; c++)
+      mean[c] = (mean[c] + 8) / 16;
+
+   // Principal axis of the colours by power iteration on the covariance.
+   float cov[6] = {0};
+   for (unsigned i = 0; i < 16; i++)
+   {
+      float r = block[4 * i + 0] - mean[0];
+      float g = block[4 * i + 1] - mean[1];
+      float b = block[4 * i + 2] - mean[2];
+      cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+      cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+   }
+
+   float axis[3] = { 1.0f, 1.0f, 1.0f };
+   for (unsigned iter = 0; iter < 4; iter++)
+   {
+      float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+      float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+      float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+      float m = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+      if (m < 1e-4f)
+         break;
+      axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+   }
+
+   // Extremes along the axis, pulled in by 1/16 of the range to favour the interior.
+   float lo = 1e30f, hi = -1e30f;
+   for (unsigned i = 0; i < 16; i++)
+   {
+      float d = (block[4 * i + 0] - mean[0]) * axis[0] +
+         (block[4 * i + 1] - mean[1]) * axis[1] +
+         (block[4 * i + 2] - mean[2]) * axis[2];
+      lo = std::min(lo, d);
+      hi = std::max(hi, d);
+   }
+   float len = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+   float inset = (hi - lo) / 16.0f;
+   lo = (lo + inset) / len;
+   hi = (hi - inset) / len;
+
+   int e0[3], e1[3];
+   for (unsigned c = 0; c < 3; c++)
+   {
+      e0[c] = clamp_byte((int)(mean[c] + axis[c] * hi + 0.5f));
+      e1[c] = clamp_byte((int)(mean[c] + axis[c] * lo + 0.5f));
+   }
+
+   unsigned c0 = pack_565(e0[0], e0[1], e0[2]);
+   unsigned c1 = pack_565(e1[0], e1[1], e1[2]);
+   if (c0 < c1)
+      std::swap(c0, c1);
+
+   uint32_t indices = 0;
+   if (c0 != c1)
+   {
+      // Four-colour mode, needs c0 > c1.
+      int palette[4][3];
+      unpack_565(c0, palette[0]);
+      unpack_565(c1, palette[1]);
+      for (unsigned c = 0; c < 3; c++)
+      {
+         palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+         palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+      }
+
+      for (unsigned i = 0; i < 16; i++)
+      {
+         const uint8_t *p = block + 4 * i;
+         unsigned best = 0;
+         int best_err = 1 << 30;
+         for (unsigned j = 0; j < 4; j++)
+         {
+            int err = sq(p[0] - palette[j][0]) + sq(p[1] - palette[j][1]) + sq(p[2] - palette[j][2]);
+            if (err < best_err)
+            {
+               best_err = err;
+               best = j;
+            }
+         }
+         indices |= best << (2 * i);
+      }
+   }
+
+   put_le16(out + 0, c0);
+   put_le16(out + 2, c1);
+   put_le16(out + 4, indices & 0xffff);
+   put_le16(out + 6, indices >> 16);
+}
+
+static void encode_bc3_alpha(const uint8_t *block, uint8_t *out)
+{
+   int a0 = 0, a1 = 255;
+   for (unsigned i = 0; i < 16; i++)
+   {
+      a0 = std::max<int>(a0, block[4 * i + 3]);
+      a1 = std::min<int>(a1, block[4 * i + 3]);
+   }
+
+   uint64_t indices = 0;
+   if (a0 != a1)
+   {
+      // Eight-value mode, needs a0 > a1.
+      int palette[8] = { a0, a1 };
+      for (unsigned j = 1; j < 7; j++)
+         palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+
+      for (unsigned i = 0; i < 16; i++)
+      {
+         int a = block[4 * i + 3];
+         unsigned best = 0;
+         int best_err = 1 << 30;
+         for (unsigned j = 0; j < 8; j++)
+         {
+            int err = abs(a - palette[j]);
+            if (err < best_err)
+            {
+               best_err = err;
+               best = j;
+            }
+         }
+         indices |= (uint64_t)best << (3 * i);
+      }
+   }
+
+   out[0] = a0;
+   out[1] = a1;
+   for (unsigned i = 0; i < 6; i++)
+      out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+/* ETC1 / ETC2 */
+
+static const int etc1_modifiers[8][2] = {
+   {  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+   { 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 },
+};
+
+static const int eac_modifiers[16][8] = {
+   { -3, -6,  -9, -15, 2, 5, 8, 14 },
+   { -3, -7, -10, -13, 2, 6, 9, 12 },
+   { -2, -5,  -8, -13, 1, 4, 7, 12 },
+   { -2, -4,  -6, -13, 1, 3, 5, 12 },
+   { -3, -6,  -8, -12, 2, 5, 7, 11 },
+   { -3, -7,  -9, -11, 2, 6, 8, 10 },
+   { -4, -7,  -8, -11, 3, 6, 7, 10 },
+   { -3, -5,  -8, -11, 2, 4, 7, 10 },
+   { -2, -6,  -8, -10, 1, 5, 7,  9 },
+   { -2, -5,  -8, -10, 1, 4, 7,  9 },
+   { -2, -4,  -8, -10, 1, 3, 7,  9 },
+   { -2, -5,  -7, -10, 1, 4, 6,  9 },
+   { -3, -4,  -7, -10, 2, 3, 6,  9 },
+   { -1, -2,  -3, -10, 0, 1, 2,  9 },
+   { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+   { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+};
+
+struct etc1_subblock
+{
+   unsigned table;
+   uint32_t msb, lsb; // Already shifted into place.
+   int err;
+};
+
+// Texels of sub-block 0 or 1 for the given flip. ETC numbers texels
+// column-major, i = 4 * x + y.
+static void etc1_subblock_texels(unsigned flip, unsigned sub, unsigned *texels)
+{
+   unsigned n = 0;
+   for (unsigned x = 0; x < 4; x++)
+   {
+      for (unsigned y = 0; y < 4; y++)
+      {
+         unsigned s = flip ? (y >= 2) : (x >= 2);
+         if (s == sub)
+            texels[n++] = 4 * x + y;
+      }
+   }
+}
+
+// Picks the modifier table and per-texel modifiers for a fixed base colour.
+static void etc1_fit_subblock(const uint8_t *block, const unsigned *texels,
+      const int *base, struct etc1_subblock *out)
+{
+   out->err = 1 << 30;
+
+   for (unsigned t = 0; t < 8; t++)
+   {
+      // Modifier index 0..3 maps to +a, +b, -a, -b.
+      int mods[4] = {
+         etc1_modifiers[t][0], etc1_modifiers[t][1],
+         -etc1_modifiers[t][0], -etc1_modifiers[t][1],
+      };
+      int palette[4][3];
+      for (unsigned j = 0; j < 4; j++)
+         for (unsigned c = 0; c < 3; c++)
+            palette[j][c] = clamp_byte(base[c] + mods[j]);
+
+      int err = 0;
+      uint32_t msb = 0, lsb = 0;
+      for (unsigned k = 0; k < 8 && err < out->err; k++)
+      {
+         unsigned i = texels[k];
+         unsigned x = i >> 2, y = i & 3;
+         const uint8_t *p = block + 4 * (4 * y + x);
+
+         unsigned best = 0;
+         int best_err = 1 << 30;
+         for (unsigned j = 0; j < 4; j++)
+         {
+            int e = sq(p[0] - palette[j][0]) + sq(p[1] - palette[j][1]) + sq(p[2] - palette[j][2]);
+            if (e < best_err)
+            {
+               best_err = e;
+               best = j;
+            }
+         }
+
+         err += best_err;
+         msb |= (best >> 1) << (16 + i);
+         lsb |= (best & 1) << i;
+      }
+
+      if (err < out->err)
+      {
+         out->table = t;
+         out->msb   = msb;
+         out->lsb   = lsb;
+         out->err   = err;
+      }
+   }
+}
+
+static void encode_etc1(const uint8_t *block, uint8_t *out)
+{
+   uint32_t best_hi = 0, best_lo = 0;
+   int best_err = 1 << 30;
+
+   for (unsigned flip = 0; flip < 2; flip++)
+   {
+      unsigned texels[2][8];
+      int avg[2][3];
+      for (unsigned s = 0; s < 2; s++)
+      {
+         etc1_subblock_texels(flip, s, texels[s]);
+         int sum[3] = {0};
+         for (unsigned k = 0; k < 8; k++)
+         {
+            unsigned i = texels[s][k];
+            const uint8_t *p = block + 4 * (4 * (i & 3) + (i >> 2));
+            for (unsigned c = 0; c < 3; c++)
+               sum[c] += p[c];
+         }
+         for (unsigned c = 0; c < 3; c++)
+            avg[s][c] = (sum[c] + 4) / 8;
+      }
+
+      // Differential mode if the 5-bit averages are close enough, individual 4-bit otherwise.
+      int q5[2][3], q4[2][3];
+      bool diff = true;
+      for (unsigned c = 0; c < 3; c++)
+      {
+         q5[0][c] = (avg[0][c] * 31 + 127) / 255;
+         q5[1][c] = (avg[1][c] * 31 + 127) / 255;
+         int d = q5[1][c] - q5[0][c];
+         if (d < -4 || d > 3)
+            diff = false;
+         q4[0][c] = (avg[0][c] * 15 + 127) / 255;
+         q4[1][c] = (avg[1][c] * 15 + 127) / 255;
+      }
+
+      int base[2][3];
+      for (unsigned s = 0; s < 2; s++)
+         for (unsigned c = 0; c < 3; c++)
+            base[s][c] = diff ? (q5[s][c] << 3) | (q5[s][c] >> 2) : (q4[s][c] << 4) | q4[s][c];
+
+      struct etc1_subblock sub[2];
+      etc1_fit_subblock(block, texels[0], base[0], &sub[0]);
+      etc1_fit_subblock(block, texels[1], base[1], &sub[1]);
+
+      int err = sub[0].err + sub[1].err;
+      if (err >= best_err)
+         continue;
+
+      uint32_t hi;
+      if (diff)
+      {
+         hi = q5[0][0] << 27 | ((q5[1][0] - q5[0][0]) & 7) << 24 |
+            q5[0][1] << 19 | ((q5[1][1] - q5[0][1]) & 7) << 16 |
+            q5[0][2] << 11 | ((q5[1][2] - q5[0][2]) & 7) << 8 | 1 << 1;
+      }
+      else
+      {
+         hi = q4[0][0] << 28 | q4[1][0] << 24 |
+            q4[0][1] << 20 | q4[1][1] << 16 |
+            q4[0][2] << 12 | q4[1][2] << 8;
+      }
+      hi |= sub[0].table << 5 | sub[1].table << 2 | flip;
+
+      best_err = err;
+      best_hi  = hi;
+      best_lo  = sub[0].msb | sub[1].msb | sub[0].lsb | sub[1].lsb;
+   }
+
+   put_be32(out + 0, best_hi);
+   put_be32(out + 4, best_lo);
+}
+
+static void encode_eac_alpha(const uint8_t *block, uint8_t *out)
+{
+   int lo = 255, hi = 0;
+   for (unsigned i = 0; i < 16; i++)
+   {
+      lo = std::min<int>(lo, block[4 * i + 3]);
+      hi = std::max<int>(hi, block[4 * i + 3]);
+   }
+
+   int best_err = 1 << 30;
+   unsigned best_base = 0, best_mul = 0, best_table = 0;
+   uint64_t best_indices = 0;
+
+   for (unsigned t = 0; t < 16 && best_err; t++)
+   {
+      const int *mods = eac_modifiers[t];
+      int span = mods[7] - mods[3];
+      int guess = std::max((hi - lo + span / 2) / span, 1);
+
+      for (int mul = std::max(guess - 1, 1); mul <= std::min(guess + 1, 15); mul++)
+      {
+         // Centre the table's range on the block's.
+         int base = clamp_byte((hi + lo - (mods[7] + mods[3]) * mul + 1) / 2);
+
+         int err = 0;
+         uint64_t indices = 0;
+         for (unsigned i = 0; i < 16 && err < best_err; i++)
+         {
+            unsigned x = i >> 2, y = i & 3;
+            int a = block[4 * (4 * y + x) + 3];
+
+            unsigned best = 0;
+            int e_best = 1 << 30;
+            for (unsigned j = 0; j < 8; j++)
+            {
+               int e = abs(a - clamp_byte(base + mods[j] * mul));
+               if (e < e_best)
+               {
+                  e_best = e;
+                  best = j;
+               }
+            }
+
+            err += e_best * e_best;
+            indices |= (uint64_t)best << (45 - 3 * i);
+         }
+
+         if (err < best_err)
+         {
+            best_err     = err;
+            best_base    = base;
+            best_mul     = mul;
+            best_table   = t;
+            best_indices = indices;
+         }
+      }
+   }
+
+   uint64_t bits = (uint64_t)best_base << 56 | (uint64_t)best_mul << 52 |
+      (uint64_t)best_table << 48 | best_indices;
+   put_be32(out + 0, bits >> 32);
+   put_be32(out + 4, bits & 0xffffffff);
+}
+
+static void encode_block(enum texture_format format, const uint8_t *block, uint8_t *out)
+{
+   switch (format)
+   {
+      case TEXTURE_FORMAT_BC1:
+         encode_bc1_color(block, out);
+         break;
+      case TEXTURE_FORMAT_BC3:
+         encode_bc3_alpha(block, out);
+         encode_bc1_color(block, out + 8);
+         break;
+      case TEXTURE_FORMAT_ETC1:
+         encode_etc1(block, out);
+         break;
+      case TEXTURE_FORMAT_ETC2_RGBA8:
+         // Valid ETC1 blocks decode the same way under ETC2.
+         encode_eac_alpha(block, out);
+         encode_etc1(block, out + 8);
+         break;
+      default:
+         break;
+   }
+}
+
+bool texcompress_has_alpha(const struct texture_image *src)
+{
+   const uint8_t *p = src->data + src->level[0].offset;
+   size_t texels = (size_t)src->width * src->height;
+   for (size_t i = 0; i < texels; i++)
+   {
+      if (p[4 * i + 3] != 0xff)
+         return true;
+   }
+   return false;
+}
+
+bool texcompress_encode(const struct texture_image *src, enum texture_format format,
+      struct texture_image *dst)
+{
+   unsigned block_size = texture_format_block_size(format);
+   if (!block_size || src->format != TEXTURE_FORMAT_RGBA8)
+      return false;
+
+   texture_image_layout(dst, format, src->width, src->height, src->levels > 1);
+   dst->levels = std::min(dst->levels, src->levels);
+   dst->owned  = (uint8_t*)malloc(dst->size);
+   dst->data   = dst->owned;
+   if (!dst->owned)
+   {
+      texture_image_free(dst);
+      return false;
+   }
+
+   for (unsigned l = 0; l < dst->levels; l++)
+   {
+      const struct texture_level *level = &src->level[l];
+      const uint8_t *pixels = src->data + level->offset;
+      uint8_t *out = dst->owned + dst->level[l].offset;
+
+      for (unsigned by = 0; by < level->height; by += 4)
+      {
+         for (unsigned bx = 0; bx < level->width; bx += 4)
+         {
+            uint8_t block[64];
+            fetch_block(pixels, level->width, level->height, bx, by, block);
+            encode_block(format, block, out);
+            out += block_size;
+         }
+      }
+   }
+
+   return true;
+}
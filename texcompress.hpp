@@ -0,0 +1,40 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXCOMPRESS_HPP__
+#define TEXCOMPRESS_HPP__
+
+#include "texture.hpp"
+
+// Load-time block compression of RGBA8 images.
+//
+// The encoders favour speed over quality: BC1 fits endpoints along the
+// principal axis of each block, BC3 adds a min/max alpha block, ETC1 picks
+// the better flip and the best modifier table per sub-block around the
+// sub-block average, and ETC2 RGBA8 pairs that with an EAC alpha block.
+// Blocks that hang off the right or top edge repeat the edge texels.
+
+// True if any texel of level 0 has alpha below 255.
+bool texcompress_has_alpha(const struct texture_image *src);
+
+// Encodes every level of src (RGBA8) into dst, which gets its own storage.
+// Returns false if format isn't a block format or memory runs out.
+bool texcompress_encode(const struct texture_image *src, enum texture_format format,
+      struct texture_image *dst);
+
+#endif
+
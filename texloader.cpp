@@ -0,0 +1,921 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texloader.hpp"
+#include "texture.hpp"
+#include "texcache.hpp"
+#include "mipmap.hpp"
+#include "texcompress.hpp"
+#include "rthreads.h"
+#include "rpng.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+
+#define FORMAT_BIT(format) (1u << (format))
+
+// Block formats to assume before a context has been queried.
+#ifdef GLES
+#define DEFAULT_FORMATS FORMAT_BIT(TEXTURE_FORMAT_ETC1)
+#else
+#define DEFAULT_FORMATS (FORMAT_BIT(TEXTURE_FORMAT_BC1) | FORMAT_BIT(TEXTURE_FORMAT_BC3))
+#endif
+
+// Size limit to assume before a context has been queried.
+#ifdef GLES
+#define DEFAULT_MAX_SIZE 4096
+#else
+#define DEFAULT_MAX_SIZE 16384
+#endif
+
+// Bits of the texture cache variant word.
+#define VARIANT_MIPMAPS (1 << 0)
+#define VARIANT_FORMATS_SHIFT 8
+#define VARIANT_MAX_SIZE_SHIFT 16
+
+// Upper bound on texel data handed to glTexSubImage2D per frame.
+#define UPLOAD_BYTES_PER_FRAME (4 * 1024 * 1024)
+
+enum buffer_state
+{
+   BUFFER_NONE = 0,
+   BUFFER_REQUESTED,
+   BUFFER_GRANTED
+};
+
+static std::string path;
+static std::string cache_dir;
+static bool use_pbo = true;
+static bool pbo_supported;
+static enum texloader_mipmaps mipmaps = TEXLOADER_MIPMAPS_CPU;
+static bool compress;
+static bool options_dirty;
+static unsigned gl_formats; // FORMAT_BITs the current context can sample.
+static bool gl_formats_known;
+static unsigned max_size;    // 0 for GL_MAX_TEXTURE_SIZE.
+static unsigned gl_max_size;
+static GLuint palette_tex;  // Lookup for the current texture, if it holds palette indices.
+
+// Loader thread state. While loader_thread runs, everything from
+// loader_done down is guarded by loader_lock.
+static sthread_t *loader_thread;
+static slock_t *loader_lock;
+static scond_t *loader_cond;
+static bool loader_async;
+static bool loader_pending;
+static enum texloader_mipmaps loader_mipmaps;
+static unsigned loader_formats; // Block formats to encode to, if any.
+static unsigned loader_max_size;
+static bool loader_done;
+static bool loader_ok;
+static enum buffer_state loader_buffer_state;
+static size_t loader_buffer_size;
+static bool loader_buffer_read;  // The loader reads back what it writes.
+static uint8_t *loader_buffer;
+static bool loader_buffer_filled;
+static struct texture_image loader_image;
+static rpng_decoder_t *loader_decoder; // Only touched by whoever runs loader_decode().
+
+// Render thread state.
+static GLuint pbo;
+static struct texture_image image; // Layout only (data == NULL) if pixels live in pbo.
+static bool image_in_pbo;
+static bool placeholder;
+static bool uploading;
+static GLuint upload_tex;
+static unsigned upload_level;
+static unsigned upload_row;
+
+// Loader thread. Asks the render thread for a mapped unpack buffer and blocks
+// until the next frame hands one out. NULL means stay in client memory.
+static uint8_t *loader_request_buffer(size_t size, bool read)
+{
+   if (!loader_async)
+      return NULL;
+
+   slock_lock(loader_lock);
+   loader_buffer_size  = size;
+   loader_buffer_read  = read;
+   loader_buffer_state = BUFFER_REQUESTED;
+   scond_signal(loader_cond);
+   while (loader_buffer_state == BUFFER_REQUESTED)
+      scond_wait(loader_cond, loader_lock);
+   uint8_t *buffer = loader_buffer;
+   slock_unlock(loader_lock);
+
+   return buffer;
+}
+
+static uint8_t *loader_alloc(const struct rpng_image *info, void *userdata)
+{
+   size_t size = (size_t)info->width * info->height * rpng_format_bpp(info->format);
+   uint8_t *buffer = loader_request_buffer(size, false);
+   *(bool*)userdata = buffer != NULL;
+   return buffer ? buffer : (uint8_t*)malloc(size);
+}
+
+// Compressed textures can't use glGenerateMipmap, so they always get a CPU chain.
+// Neither can palette indices, which are averaged through the palette.
+static bool loader_cpu_mipmaps(enum texture_format format)
+{
+   return loader_mipmaps == TEXLOADER_MIPMAPS_CPU ||
+      (loader_mipmaps == TEXLOADER_MIPMAPS_GPU &&
+       (loader_formats || format == TEXTURE_FORMAT_INDEX8));
+}
+
+static enum texture_format image_format(enum rpng_format format)
+{
+   switch (format)
+   {
+      case RPNG_FORMAT_L8:
+         return TEXTURE_FORMAT_L8;
+      case RPNG_FORMAT_LA8:
+         return TEXTURE_FORMAT_LA8;
+      case RPNG_FORMAT_INDEX8:
+         return TEXTURE_FORMAT_INDEX8;
+      default:
+         return TEXTURE_FORMAT_RGBA8;
+   }
+}
+
+// Grayscale and palette images keep 1 or 2 bytes per texel. The block
+// encoders only take RGBA8, so everything is expanded when compressing.
+static unsigned loader_rpng_formats(bool chain)
+{
+   unsigned formats = RPNG_FORMAT_BIT(RPNG_FORMAT_RGBA8);
+   if (loader_formats)
+      return formats;
+
+   formats |= RPNG_FORMAT_BIT(RPNG_FORMAT_L8) | RPNG_FORMAT_BIT(RPNG_FORMAT_LA8);
+   // Without a CPU chain, palette indices would get no mipmaps at all.
+   if (chain || loader_mipmaps == TEXLOADER_MIPMAPS_DISABLED)
+      formats |= RPNG_FORMAT_BIT(RPNG_FORMAT_INDEX8);
+   return formats;
+}
+
+struct chain_target
+{
+   struct texture_image *img;
+   bool *filled;
+   bool asked; // For an unpack buffer.
+};
+
+// Without compression the chain is what gets uploaded, so it is built right
+// in the unpack buffer; mipmaps and the cache read level 0 back from there.
+static uint8_t *chain_alloc(const struct rpng_image *info, void *userdata)
+{
+   struct chain_target *target = (struct chain_target*)userdata;
+   struct texture_image *img = target->img;
+   enum texture_format format = image_format(info->format);
+   texture_image_layout(img, format, info->width, info->height, loader_cpu_mipmaps(format));
+   memcpy(img->palette, info->palette, sizeof(img->palette));
+
+   uint8_t *buffer = NULL;
+   if (!loader_formats)
+   {
+      buffer = loader_request_buffer(img->size, true);
+      target->asked   = true;
+      *target->filled = buffer != NULL;
+   }
+
+   img->owned = buffer ? buffer : (uint8_t*)malloc(img->size);
+   img->data  = img->owned;
+   return img->owned;
+}
+
+// Replaces an RGBA8 image with a block-compressed copy, if one of
+// loader_formats suits it. Opaque images prefer the 4 bpp formats.
+static void compress_image(struct texture_image *img)
+{
+   bool alpha = texcompress_has_alpha(img);
+   enum texture_format format;
+
+   if (alpha && (loader_formats & FORMAT_BIT(TEXTURE_FORMAT_BC3)))
+      format = TEXTURE_FORMAT_BC3;
+   else if (alpha && (loader_formats & FORMAT_BIT(TEXTURE_FORMAT_ETC2_RGBA8)))
+      format = TEXTURE_FORMAT_ETC2_RGBA8;
+   else if (!alpha && (loader_formats & FORMAT_BIT(TEXTURE_FORMAT_BC1)))
+      format = TEXTURE_FORMAT_BC1;
+   else if (!alpha && (loader_formats & FORMAT_BIT(TEXTURE_FORMAT_ETC1)))
+      format = TEXTURE_FORMAT_ETC1;
+   else if (!alpha && (loader_formats & FORMAT_BIT(TEXTURE_FORMAT_ETC2_RGBA8)))
+      format = TEXTURE_FORMAT_ETC2_RGBA8;
+   else
+      return;
+
+   struct texture_image compressed;
+   if (!texcompress_encode(img, format, &compressed))
+      return;
+
+   texture_image_free(img);
+   *img = compressed;
+}
+
+static bool loader_decode(struct texture_image *img, bool *filled)
+{
+   memset(img, 0, sizeof(*img));
+   *filled = false;
+
+   // Kept until unload, so reloading for an option change or a context
+   // reset reuses its buffers.
+   if (!loader_decoder)
+      loader_decoder = rpng_decoder_new();
+
+   bool cpu_mipmaps = loader_cpu_mipmaps(TEXTURE_FORMAT_RGBA8);
+   uint32_t variant = (cpu_mipmaps ? VARIANT_MIPMAPS : 0) |
+      loader_formats << VARIANT_FORMATS_SHIFT |
+      std::min(loader_max_size, 0xffffu) << VARIANT_MAX_SIZE_SHIFT;
+   struct texcache_key key;
+   bool use_cache = !cache_dir.empty() &&
+      texcache_make_key(path.c_str(), variant, &key);
+   struct chain_target target = { img, filled, false };
+
+   if (use_cache && texcache_load(cache_dir.c_str(), &key, img))
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Texture cache hit: %s\n", path.c_str());
+   }
+   else if (use_cache || cpu_mipmaps || loader_formats)
+   {
+      // Level 0 is decoded straight into the start of the chain.
+      uint8_t *data;
+      struct rpng_image info;
+      bool ret = rpng_decoder_load_image(loader_decoder, path.c_str(), loader_rpng_formats(true),
+            loader_max_size, chain_alloc, &target, &data, &info);
+
+      if (ret && img->levels > 1)
+         mipmap_generate(img, true);
+      if (ret && loader_formats)
+         compress_image(img);
+
+      if (ret && use_cache && !texcache_store(cache_dir.c_str(), &key, img) && log_cb)
+         log_cb(RETRO_LOG_WARN, "Couldn't write texture cache for: %s\n", path.c_str());
+
+      if (*filled)
+      {
+         // The unpack buffer is the only copy; a context reset loads it again,
+         // from the cache if there is one.
+         img->owned = NULL;
+         img->data  = NULL;
+         return ret;
+      }
+      if (!ret)
+      {
+         texture_image_free(img);
+         return false;
+      }
+   }
+   else
+   {
+      // Nothing needs a CPU copy, so decode straight into the unpack buffer.
+      uint8_t *data;
+      struct rpng_image info;
+      bool ret = rpng_decoder_load_image(loader_decoder, path.c_str(), loader_rpng_formats(false),
+            loader_max_size, loader_alloc, filled, &data, &info);
+      if (*filled)
+      {
+         texture_image_wrap(img, NULL, image_format(info.format), info.width, info.height);
+         memcpy(img->palette, info.palette, sizeof(img->palette));
+         return ret;
+      }
+
+      if (!ret)
+      {
+         free(data);
+         return false;
+      }
+      texture_image_wrap(img, data, image_format(info.format), info.width, info.height);
+      memcpy(img->palette, info.palette, sizeof(img->palette));
+      return true;
+   }
+
+   // A CPU copy is kept for context resets. Stage it into the unpack buffer
+   // from here so the render thread never touches the pixels.
+   uint8_t *buffer = target.asked ? NULL : loader_request_buffer(img->size, false);
+   if (buffer)
+   {
+      memcpy(buffer, img->data, img->size);
+      *filled = true;
+   }
+   return true;
+}
+
+static void loader_thread_func(void *data)
+{
+   (void)data;
+   struct texture_image img;
+   bool filled;
+   bool ok = loader_decode(&img, &filled);
+
+   slock_lock(loader_lock);
+   loader_image         = img;
+   loader_buffer_filled = filled;
+   loader_ok            = ok;
+   loader_done          = true;
+   scond_signal(loader_cond);
+   slock_unlock(loader_lock);
+}
+
+static void loader_start(void)
+{
+   if (loader_pending || image.data || path.empty())
+      return;
+
+   if (!loader_lock)
+      loader_lock = slock_new();
+   if (!loader_cond)
+      loader_cond = scond_new();
+
+   loader_pending       = true;
+   loader_mipmaps       = mipmaps;
+   loader_formats       = compress ? (gl_formats_known ? gl_formats : DEFAULT_FORMATS) : 0;
+   loader_max_size      = gl_max_size ? gl_max_size : DEFAULT_MAX_SIZE;
+   if (max_size)
+      loader_max_size = std::min(loader_max_size, max_size);
+   loader_done          = false;
+   loader_ok            = false;
+   loader_buffer_state  = BUFFER_NONE;
+   loader_buffer        = NULL;
+   loader_buffer_filled = false;
+
+   loader_async  = loader_lock && loader_cond;
+   loader_thread = loader_async ? sthread_create(loader_thread_func, NULL) : NULL;
+
+   // No threads, decode inline.
+   if (!loader_thread)
+   {
+      loader_async = false;
+      loader_ok    = loader_decode(&loader_image, &loader_buffer_filled);
+      loader_done  = true;
+   }
+}
+
+// Render thread, loader_lock held.
+static void grant_buffer(bool gl)
+{
+   uint8_t *ptr = NULL;
+
+#ifndef GLES
+   if (gl && use_pbo && pbo_supported)
+   {
+      SYM(glGenBuffers)(1, &pbo);
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, pbo);
+      SYM(glBufferData)(GL_PIXEL_UNPACK_BUFFER, loader_buffer_size, NULL, GL_STREAM_DRAW);
+      ptr = (uint8_t*)SYM(glMapBuffer)(GL_PIXEL_UNPACK_BUFFER,
+            loader_buffer_read ? GL_READ_WRITE : GL_WRITE_ONLY);
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      if (!ptr)
+      {
+         SYM(glDeleteBuffers)(1, &pbo);
+         pbo = 0;
+      }
+   }
+#else
+   (void)gl;
+#endif
+
+   loader_buffer       = ptr;
+   loader_buffer_state = BUFFER_GRANTED;
+   scond_signal(loader_cond);
+}
+
+static void drop_pbo(bool gl)
+{
+#ifndef GLES
+   if (pbo && gl)
+      SYM(glDeleteBuffers)(1, &pbo);
+#else
+   (void)gl;
+#endif
+   pbo = 0;
+   image_in_pbo = false;
+}
+
+// Services buffer requests and adopts the loader's result once it is done.
+// With gl == false, no GL calls are made and any buffer the loader got is forgotten.
+// Returns true when a result (or a failure) has been adopted.
+static bool loader_poll(bool wait, bool gl)
+{
+   if (!loader_pending)
+      return false;
+
+   if (loader_async)
+   {
+      slock_lock(loader_lock);
+      for (;;)
+      {
+         if (loader_buffer_state == BUFFER_REQUESTED)
+            grant_buffer(gl && !wait);
+         if (loader_done || !wait)
+            break;
+         scond_wait(loader_cond, loader_lock);
+      }
+      bool done = loader_done;
+      slock_unlock(loader_lock);
+
+      if (!done)
+         return false;
+
+      sthread_join(loader_thread);
+      loader_thread = NULL;
+   }
+   loader_pending = false;
+
+#ifndef GLES
+   if (pbo && gl)
+   {
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, pbo);
+      SYM(glUnmapBuffer)(GL_PIXEL_UNPACK_BUFFER);
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+   }
+#endif
+
+   if (loader_ok && loader_buffer_filled && pbo && gl)
+      image_in_pbo = true;
+   else
+      drop_pbo(gl);
+
+   if (!loader_ok && log_cb)
+      log_cb(RETRO_LOG_ERROR, "Couldn't load texture: %s\n", path.c_str());
+
+   if (loader_ok && (image_in_pbo || loader_image.data))
+      image = loader_image;
+   else
+      texture_image_free(&loader_image);
+   memset(&loader_image, 0, sizeof(loader_image));
+
+   return true;
+}
+
+static bool loader_buffer_mapped(void)
+{
+   if (!loader_pending || !loader_async)
+      return false;
+
+   slock_lock(loader_lock);
+   bool mapped = loader_buffer != NULL;
+   slock_unlock(loader_lock);
+   return mapped;
+}
+
+static GLenum compressed_format(enum texture_format format)
+{
+   switch (format)
+   {
+      case TEXTURE_FORMAT_BC1:
+         return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+      case TEXTURE_FORMAT_BC3:
+         return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+      case TEXTURE_FORMAT_ETC1:
+         return GL_ETC1_RGB8_OES;
+      case TEXTURE_FORMAT_ETC2_RGBA8:
+         return GL_COMPRESSED_RGBA8_ETC2_EAC;
+      default:
+         return 0;
+   }
+}
+
+static unsigned query_formats(void)
+{
+   const char *ext = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   unsigned formats = 0;
+#ifdef GLES
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   if (ext && strstr(ext, "GL_OES_compressed_ETC1_RGB8_texture"))
+      formats |= FORMAT_BIT(TEXTURE_FORMAT_ETC1);
+   if (version && strstr(version, "OpenGL ES 3"))
+      formats |= FORMAT_BIT(TEXTURE_FORMAT_ETC2_RGBA8);
+#else
+   if (ext && strstr(ext, "GL_EXT_texture_compression_s3tc"))
+      formats |= FORMAT_BIT(TEXTURE_FORMAT_BC1) | FORMAT_BIT(TEXTURE_FORMAT_BC3);
+#endif
+   return formats;
+}
+
+static bool format_usable(enum texture_format format)
+{
+   return texture_format_bpp(format) || (gl_formats & FORMAT_BIT(format));
+}
+
+// Unsized formats GLES2 takes as well. Palette indices go in the red channel.
+static GLenum pixel_format(enum texture_format format)
+{
+   switch (format)
+   {
+      case TEXTURE_FORMAT_L8:
+      case TEXTURE_FORMAT_INDEX8:
+         return GL_LUMINANCE;
+      case TEXTURE_FORMAT_LA8:
+         return GL_LUMINANCE_ALPHA;
+      default:
+         return GL_RGBA;
+   }
+}
+
+static bool size_usable(const struct texture_image *img)
+{
+   return img->width <= gl_max_size && img->height <= gl_max_size;
+}
+
+// Without data, only storage for uncompressed levels is allocated.
+// Compressed levels are specified whole by upload_step().
+static GLuint upload_texture(const struct texture_image *img)
+{
+   GLuint tex;
+   SYM(glGenTextures)(1, &tex);
+   SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+
+   GLenum compressed = compressed_format(img->format);
+   GLenum format = pixel_format(img->format);
+
+   // L8 and LA8 rows aren't padded to 4 bytes.
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 1);
+   for (unsigned i = 0; i < img->levels; i++)
+   {
+      const struct texture_level *level = &img->level[i];
+      if (compressed && img->data)
+         SYM(glCompressedTexImage2D)(GL_TEXTURE_2D, i, compressed, level->width, level->height,
+               0, level->size, img->data + level->offset);
+      else if (!compressed)
+         SYM(glTexImage2D)(GL_TEXTURE_2D, i, format, level->width, level->height,
+               0, format, GL_UNSIGNED_BYTE, img->data ? img->data + level->offset : NULL);
+   }
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 4);
+
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+   return tex;
+}
+
+static inline bool is_pot(unsigned v)
+{
+   return (v & (v - 1)) == 0;
+}
+
+static GLuint upload_palette(const struct texture_image *img)
+{
+   GLuint tex;
+   SYM(glGenTextures)(1, &tex);
+   SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+   SYM(glTexImage2D)(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, img->palette);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+   return tex;
+}
+
+// Called once every level of img is in tex. Uses the CPU chain if there is one,
+// falls back to glGenerateMipmap otherwise.
+// Palette indices can't be blended, they only ever get nearest filtering.
+static void finish_texture(GLuint tex, const struct texture_image *img)
+{
+   bool mipmapped = img->levels > 1;
+   bool indexed   = img->format == TEXTURE_FORMAT_INDEX8;
+
+   if (indexed)
+      palette_tex = upload_palette(img);
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, tex);
+
+#ifdef GLES
+   // GLES2 can't mipmap NPOT textures.
+   bool can_generate = is_pot(img->width) && is_pot(img->height);
+#else
+   bool can_generate = true;
+   if (mipmapped)
+      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img->levels - 1);
+#endif
+
+   if (!mipmapped && mipmaps != TEXLOADER_MIPMAPS_DISABLED && can_generate &&
+         !compressed_format(img->format) && !indexed)
+   {
+      SYM(glGenerateMipmap)(GL_TEXTURE_2D);
+      mipmapped = true;
+   }
+
+   if (mipmapped)
+      SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+            indexed ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+}
+
+static GLuint upload_placeholder_texture(void)
+{
+   static const uint8_t grey[4] = { 0x80, 0x80, 0x80, 0xff };
+   struct texture_image img;
+   texture_image_wrap_rgba(&img, NULL, 1, 1);
+   img.data = grey;
+   return upload_texture(&img);
+}
+
+static void upload_begin(void)
+{
+   struct texture_image layout = image;
+   layout.data = NULL;
+   upload_tex   = upload_texture(&layout);
+   upload_level = 0;
+   upload_row   = 0;
+   uploading    = true;
+}
+
+// Uploads up to UPLOAD_BYTES_PER_FRAME worth of rows.
+// Returns true once the last row of the last level is in.
+static bool upload_step(void)
+{
+   size_t budget = UPLOAD_BYTES_PER_FRAME;
+   uintptr_t base = (uintptr_t)image.data;
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, upload_tex);
+#ifndef GLES
+   if (image_in_pbo)
+   {
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, pbo);
+      base = 0;
+   }
+#endif
+
+   GLenum compressed = compressed_format(image.format);
+   GLenum format = pixel_format(image.format);
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 1);
+
+   while (upload_level < image.levels && budget)
+   {
+      const struct texture_level *level = &image.level[upload_level];
+
+      if (compressed)
+      {
+         // Whole levels only, GLES2 can't update part of an ETC1 texture.
+         SYM(glCompressedTexImage2D)(GL_TEXTURE_2D, upload_level, compressed,
+               level->width, level->height, 0, level->size, (const GLvoid*)(base + level->offset));
+         budget -= std::min(budget, level->size);
+         upload_level++;
+         continue;
+      }
+
+      size_t pitch = level->width * texture_format_bpp(image.format);
+      unsigned rows = std::min<size_t>(level->height - upload_row, std::max<size_t>(budget / pitch, 1));
+
+      SYM(glTexSubImage2D)(GL_TEXTURE_2D, upload_level, 0, upload_row, level->width, rows,
+            format, GL_UNSIGNED_BYTE, (const GLvoid*)(base + level->offset + upload_row * pitch));
+
+      budget -= std::min(budget, rows * pitch);
+      upload_row += rows;
+      if (upload_row == level->height)
+      {
+         upload_level++;
+         upload_row = 0;
+      }
+   }
+
+   SYM(glPixelStorei)(GL_UNPACK_ALIGNMENT, 4);
+#ifndef GLES
+   if (image_in_pbo)
+      SYM(glBindBuffer)(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+
+   return upload_level == image.levels;
+}
+
+static bool query_pbo_support(void)
+{
+#ifdef GLES
+   return false;
+#else
+   const char *version = (const char*)SYM(glGetString)(GL_VERSION);
+   const char *ext     = (const char*)SYM(glGetString)(GL_EXTENSIONS);
+   unsigned major = 0, minor = 0;
+   if (version)
+      sscanf(version, "%u.%u", &major, &minor);
+   return major > 2 || (major == 2 && minor >= 1) ||
+      (ext && strstr(ext, "GL_ARB_pixel_buffer_object"));
+#endif
+}
+
+void texloader_start(const char *path_, const char *cache_dir_)
+{
+   if (loader_pending)
+      return;
+
+   path      = path_ ? path_ : "";
+   cache_dir = cache_dir_ ? cache_dir_ : "";
+   loader_start();
+}
+
+GLuint texloader_context_reset(void)
+{
+   pbo_supported    = query_pbo_support();
+   gl_formats       = query_formats();
+   gl_formats_known = true;
+
+   GLint limit = 0;
+   SYM(glGetIntegerv)(GL_MAX_TEXTURE_SIZE, &limit);
+   gl_max_size = std::max<GLint>(limit, 64);
+
+   // Names from the old context are gone. If the loader is writing into a
+   // buffer that was mapped there, let it finish before that memory goes away.
+   if (loader_buffer_mapped())
+      loader_poll(true, false);
+
+   drop_pbo(false);
+   uploading   = false;
+   upload_tex  = 0;
+   palette_tex = 0;
+
+   if (options_dirty)
+   {
+      loader_poll(true, false);
+      texture_image_free(&image);
+      options_dirty = false;
+   }
+
+   if (!image.data || !format_usable(image.format) || !size_usable(&image))
+      texture_image_free(&image);
+
+   if (image.data)
+   {
+      placeholder = false;
+      GLuint tex = upload_texture(&image);
+      finish_texture(tex, &image);
+      return tex;
+   }
+
+   loader_start();
+   placeholder = true;
+   return upload_placeholder_texture();
+}
+
+void texloader_context_destroy(void)
+{
+   // A buffer the loader is writing into is unmapped once it is done.
+   if (loader_buffer_mapped())
+      loader_poll(true, true);
+
+   drop_pbo(true);
+   if (upload_tex)
+      SYM(glDeleteTextures)(1, &upload_tex);
+   if (palette_tex)
+      SYM(glDeleteTextures)(1, &palette_tex);
+   uploading   = false;
+   upload_tex  = 0;
+   palette_tex = 0;
+}
+
+bool texloader_update(GLuint *tex)
+{
+   if (!placeholder)
+      return false;
+
+   if (!uploading)
+   {
+      if (!loader_poll(false, true))
+         return false;
+
+      if (!image.data && !image_in_pbo)
+      {
+         // Decode failed, keep the placeholder.
+         placeholder = false;
+         return false;
+      }
+
+      if (!format_usable(image.format))
+      {
+         // Encoded before the context could be asked. Redo it for what it supports.
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "Compressed texture format not supported, re-encoding.\n");
+         drop_pbo(true);
+         texture_image_free(&image);
+         loader_start();
+         return false;
+      }
+
+      if (!size_usable(&image))
+      {
+         // Decoded before the context could be asked. Shrink it to what it supports.
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "Texture larger than %u texels, decoding again.\n", gl_max_size);
+         drop_pbo(true);
+         texture_image_free(&image);
+         loader_start();
+         return false;
+      }
+
+      upload_begin();
+   }
+
+   if (!upload_step())
+      return false;
+
+   if (palette_tex)
+      SYM(glDeleteTextures)(1, &palette_tex);
+   palette_tex = 0;
+   finish_texture(upload_tex, &image);
+   SYM(glDeleteTextures)(1, tex);
+   *tex        = upload_tex;
+   upload_tex  = 0;
+   uploading   = false;
+   placeholder = false;
+
+   if (image_in_pbo)
+   {
+      // A CPU copy, if there is one, stays for context resets. Pixels decoded
+      // straight into the unpack buffer are gone; a later reset decodes again.
+      drop_pbo(true);
+      if (!image.data)
+         texture_image_free(&image);
+   }
+
+   return true;
+}
+
+void texloader_unload(void)
+{
+   loader_poll(true, false);
+   drop_pbo(false);
+   texture_image_free(&image);
+
+   uploading   = false;
+   upload_tex  = 0;
+   palette_tex = 0;
+   placeholder = false;
+   path.clear();
+   cache_dir.clear();
+
+   slock_free(loader_lock);
+   scond_free(loader_cond);
+   loader_lock = NULL;
+   loader_cond = NULL;
+
+   rpng_decoder_free(loader_decoder);
+   loader_decoder = NULL;
+}
+
+GLuint texloader_palette(void)
+{
+   return palette_tex;
+}
+
+void texloader_set_pbo(bool enable)
+{
+   use_pbo = enable;
+}
+
+void texloader_set_compression(bool enable)
+{
+   if (enable != compress && (loader_pending || image.data || image_in_pbo))
+      options_dirty = true;
+   compress = enable;
+}
+
+void texloader_set_max_size(unsigned size)
+{
+   if (size != max_size && (loader_pending || image.data || image_in_pbo))
+      options_dirty = true;
+   max_size = size;
+}
+
+void texloader_set_mipmaps(enum texloader_mipmaps mode)
+{
+   // Anything decoded or in flight was built for the old mode.
+   if (mode != mipmaps && (loader_pending || image.data || image_in_pbo))
+      options_dirty = true;
+   mipmaps = mode;
+}
+
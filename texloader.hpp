@@ -0,0 +1,89 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXLOADER_HPP__
+#define TEXLOADER_HPP__
+
+#include "gl.hpp"
+
+// Background texture decoding with incremental upload.
+//
+// The PNG is decoded (or mapped from the texture cache) on a worker thread.
+// Until it is ready a 1x1 placeholder is bound. Once ready, the image is
+// uploaded on the render thread in bands of rows so a single frame never
+// pays for the whole transfer. Where pixel buffer objects are available,
+// rpng decodes straight into a mapped GL_PIXEL_UNPACK_BUFFER.
+//
+// With CPU mipmaps, the full gamma-correct chain is built on the loader thread
+// (and cached along with level 0), in the unpack buffer if there is one.
+// Otherwise glGenerateMipmap fills it in.
+//
+// With compression enabled, the loader thread also encodes every level to a
+// block format the context can sample (BC1/BC3 on desktop, ETC1/ETC2 on
+// GLES) and the texture cache keeps the encoded result.
+//
+// Grayscale PNGs stay one or two bytes per texel (GL_LUMINANCE and
+// GL_LUMINANCE_ALPHA) and palette PNGs become a GL_LUMINANCE texture of
+// indices plus a 256x1 palette texture, unless they are to be compressed.
+// Index textures only take GL_NEAREST filtering; their mipmaps are filtered
+// on the CPU and mapped back onto the palette.
+//
+// Images larger than GL_MAX_TEXTURE_SIZE (or a smaller limit set by the
+// caller) are box filtered down while they are decoded, so the full-size
+// pixels never exist in memory.
+
+enum texloader_mipmaps
+{
+   TEXLOADER_MIPMAPS_DISABLED = 0,
+   TEXLOADER_MIPMAPS_CPU,
+   TEXLOADER_MIPMAPS_GPU
+};
+
+// cache_dir may be NULL or empty to bypass the texture cache.
+void texloader_start(const char *path, const char *cache_dir);
+
+// Call from context_reset(). Every GL object from before is considered lost.
+// Returns the texture to bind, which may be a placeholder.
+GLuint texloader_context_reset(void);
+
+// Deletes every GL object made so far, apart from the textures handed out.
+// Call with the context current, before a texloader_context_reset() that
+// doesn't follow a real context loss.
+void texloader_context_destroy(void);
+
+// Call once per frame on the render thread, before drawing.
+// Returns true when *tex has been replaced by the full-quality texture.
+bool texloader_update(GLuint *tex);
+
+// Palette of the current texture if it holds palette indices, 0 otherwise.
+// The index is the red channel scaled to 0..1; look it up with GL_NEAREST.
+GLuint texloader_palette(void);
+
+// Waits for any pending decode and frees everything. Makes no GL calls.
+void texloader_unload(void);
+
+void texloader_set_pbo(bool enable);
+
+// These take effect on the next context reset.
+void texloader_set_mipmaps(enum texloader_mipmaps mode);
+void texloader_set_compression(bool enable);
+
+// Largest width or height to keep, 0 for GL_MAX_TEXTURE_SIZE.
+void texloader_set_max_size(unsigned size);
+
+#endif
+
@@ -0,0 +1,115 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texture.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+unsigned texture_format_bpp(enum texture_format format)
+{
+   switch (format)
+   {
+      case TEXTURE_FORMAT_RGBA8:
+         return 4;
+      case TEXTURE_FORMAT_LA8:
+         return 2;
+      case TEXTURE_FORMAT_L8:
+      case TEXTURE_FORMAT_INDEX8:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+unsigned texture_format_block_size(enum texture_format format)
+{
+   switch (format)
+   {
+      case TEXTURE_FORMAT_BC1:
+      case TEXTURE_FORMAT_ETC1:
+         return 8;
+      case TEXTURE_FORMAT_BC3:
+      case TEXTURE_FORMAT_ETC2_RGBA8:
+         return 16;
+      default:
+         return 0;
+   }
+}
+
+size_t texture_image_layout(struct texture_image *img, enum texture_format format,
+      unsigned width, unsigned height, bool mipmaps)
+{
+   memset(img, 0, sizeof(*img));
+   img->format = format;
+   img->width  = width;
+   img->height = height;
+
+   size_t offset = 0;
+   unsigned bpp  = texture_format_bpp(format);
+   unsigned block_size = texture_format_block_size(format);
+   for (unsigned i = 0; i < TEXTURE_MAX_LEVELS; i++)
+   {
+      struct texture_level *level = &img->level[i];
+      level->width  = width;
+      level->height = height;
+      level->offset = offset;
+      if (block_size)
+         level->size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_size;
+      else
+         level->size = (size_t)width * height * bpp;
+      offset += level->size;
+      img->levels++;
+
+      if (!mipmaps || (width == 1 && height == 1))
+         break;
+
+      width  = width  > 1 ? width  >> 1 : 1;
+      height = height > 1 ? height >> 1 : 1;
+   }
+
+   img->size = offset;
+   return offset;
+}
+
+void texture_image_wrap(struct texture_image *img, uint8_t *data, enum texture_format format,
+      unsigned width, unsigned height)
+{
+   texture_image_layout(img, format, width, height, false);
+   img->owned = data;
+   img->data  = data;
+}
+
+void texture_image_wrap_rgba(struct texture_image *img, uint8_t *data, unsigned width, unsigned height)
+{
+   texture_image_wrap(img, data, TEXTURE_FORMAT_RGBA8, width, height);
+}
+
+void texture_image_free(struct texture_image *img)
+{
+#ifndef _WIN32
+   if (img->map)
+      munmap(img->map, img->map_size);
+#endif
+   free(img->owned);
+   memset(img, 0, sizeof(*img));
+}
+
@@ -0,0 +1,87 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXTURE_HPP__
+#define TEXTURE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEXTURE_MAX_LEVELS 16
+
+enum texture_format
+{
+   TEXTURE_FORMAT_RGBA8 = 0,
+   TEXTURE_FORMAT_BC1,       // DXT1, opaque.
+   TEXTURE_FORMAT_BC3,       // DXT5.
+   TEXTURE_FORMAT_ETC1,      // Opaque.
+   TEXTURE_FORMAT_ETC2_RGBA8, // ETC2 colour with EAC alpha.
+   TEXTURE_FORMAT_L8,         // Grayscale.
+   TEXTURE_FORMAT_LA8,        // Grayscale + alpha.
+   TEXTURE_FORMAT_INDEX8      // Indices into texture_image::palette.
+};
+
+struct texture_level
+{
+   unsigned width;
+   unsigned height;
+   size_t offset; // Relative to texture_image::data.
+   size_t size;
+};
+
+// Decoded texture, bottom-left origin, laid out so each level
+// can be handed to glTexImage2D as-is.
+// Storage is either owned heap memory or a read-only file mapping
+// (see texcache.hpp). Either way, data stays valid until texture_image_free().
+struct texture_image
+{
+   enum texture_format format;
+   unsigned width;
+   unsigned height;
+   unsigned levels;
+   struct texture_level level[TEXTURE_MAX_LEVELS];
+   uint8_t palette[256 * 4]; // RGBA, TEXTURE_FORMAT_INDEX8 only.
+
+   const uint8_t *data;
+   size_t size;
+
+   uint8_t *owned;
+   void *map;
+   size_t map_size;
+};
+
+// Bytes per texel, 0 for block-compressed formats.
+unsigned texture_format_bpp(enum texture_format format);
+
+// Bytes per 4x4 block, 0 for uncompressed formats.
+unsigned texture_format_block_size(enum texture_format format);
+
+// Fills in format, size and level layout, without any storage.
+// With mipmaps, levels go all the way down to 1x1 (capped at TEXTURE_MAX_LEVELS).
+// Returns the total size in bytes.
+size_t texture_image_layout(struct texture_image *img, enum texture_format format,
+      unsigned width, unsigned height, bool mipmaps);
+
+// Takes ownership of a malloc()-ed single level image (as returned by rpng).
+void texture_image_wrap(struct texture_image *img, uint8_t *data, enum texture_format format,
+      unsigned width, unsigned height);
+void texture_image_wrap_rgba(struct texture_image *img, uint8_t *data, unsigned width, unsigned height);
+
+void texture_image_free(struct texture_image *img);
+
+#endif
+
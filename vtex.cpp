@@ -0,0 +1,469 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vtex.hpp"
+#include "pyramid.hpp"
+#include "rthreads.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Physical cache edge in texels. Slots are PYRAMID_TILE_SIZE squared.
+#ifdef GLES
+#define CACHE_SIZE 1024
+#else
+#define CACHE_SIZE 2048
+#endif
+
+// Feedback target. The projection has a fixed 4:3 aspect, so this matches
+// the main pass at any resolution.
+#define FEEDBACK_WIDTH 80
+#define FEEDBACK_HEIGHT 60
+
+// Upper bound on tiles handed to GL per frame.
+#define TILES_PER_FRAME 8
+
+struct cache_slot
+{
+   int tile;           // Pyramid tile index, -1 if free.
+   unsigned last_used; // Feedback pass that last saw it.
+};
+
+static std::string path;
+static std::string cache_dir;
+
+// Worker state. pyr is final once opened is set, which is guarded by lock.
+static sthread_t *thread;
+static slock_t *lock;
+static struct pyramid pyr;
+static bool opened;
+
+// Render thread state.
+static GLuint cache_texture;
+static GLuint page_texture;
+static GLuint feedback_fbo;
+static GLuint feedback_texture;
+static GLuint feedback_depth;
+static unsigned cache_size;
+static unsigned cache_slots_x;
+static unsigned table_pages; // P: level 0 fits in P x P pages, the table is 2P x P.
+static bool resident;        // Cache and page table are set up for pyr.
+static bool table_dirty;
+static bool settled;
+static unsigned frame;
+static unsigned feedback_pass;
+static std::vector<cache_slot> slots;
+static std::vector<int> tile_slot;
+static std::vector<uint8_t> table;
+static std::vector<uint8_t> feedback;
+static std::vector<uint32_t> pending; // Sorted coarsest last, consumed from the back.
+
+static void worker_func(void *data)
+{
+   (void)data;
+
+   struct pyramid result;
+   bool ok = pyramid_open(path.c_str(), cache_dir.c_str(), &result);
+   if (!ok && log_cb)
+      log_cb(RETRO_LOG_ERROR, "Couldn't build tile pyramid for %s\n", path.c_str());
+
+   if (lock)
+      slock_lock(lock);
+   pyr    = result;
+   opened = ok;
+   if (lock)
+      slock_unlock(lock);
+}
+
+void vtex_start(const char *path_, const char *cache_dir_)
+{
+   vtex_unload();
+
+   path      = path_;
+   cache_dir = cache_dir_ ? cache_dir_ : "";
+   if (cache_dir.empty())
+      cache_dir = ".";
+
+   lock   = slock_new();
+   thread = lock ? sthread_create(worker_func, NULL) : NULL;
+
+   if (!thread)
+   {
+      slock_free(lock);
+      lock = NULL;
+      worker_func(NULL);
+   }
+}
+
+static bool pyramid_ready(void)
+{
+   if (lock)
+      slock_lock(lock);
+   bool ret = opened;
+   if (lock)
+      slock_unlock(lock);
+   return ret;
+}
+
+static GLuint create_texture(unsigned width, unsigned height, GLenum filter, const void *data)
+{
+   GLuint texture;
+   SYM(glGenTextures)(1, &texture);
+   SYM(glBindTexture)(GL_TEXTURE_2D, texture);
+   SYM(glTexImage2D)(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   SYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   return texture;
+}
+
+GLuint vtex_context_reset(void)
+{
+   GLint max_size = 0;
+   SYM(glGetIntegerv)(GL_MAX_TEXTURE_SIZE, &max_size);
+   cache_size = CACHE_SIZE;
+   while (cache_size > PYRAMID_TILE_SIZE && cache_size > (unsigned)max_size)
+      cache_size >>= 1;
+   cache_slots_x = cache_size / PYRAMID_TILE_SIZE;
+
+   // Slot 0 starts out grey, and a one entry page table points everything at it
+   // until the pyramid is ready.
+   std::vector<uint8_t> grey(PYRAMID_TILE_BYTES, 0x80);
+   for (size_t i = 3; i < grey.size(); i += 4)
+      grey[i] = 0xff;
+   static const uint8_t entry[8] = { 0, 0, 0, 255, 0, 0, 0, 255 };
+
+   cache_texture = create_texture(cache_size, cache_size, GL_LINEAR, NULL);
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, 0, 0, PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE,
+         GL_RGBA, GL_UNSIGNED_BYTE, &grey[0]);
+   page_texture = create_texture(2, 1, GL_NEAREST, entry);
+   table_pages  = 1;
+
+   feedback_texture = create_texture(FEEDBACK_WIDTH, FEEDBACK_HEIGHT, GL_NEAREST, NULL);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+
+   SYM(glGenRenderbuffers)(1, &feedback_depth);
+   SYM(glBindRenderbuffer)(GL_RENDERBUFFER, feedback_depth);
+   SYM(glRenderbufferStorage)(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, FEEDBACK_WIDTH, FEEDBACK_HEIGHT);
+   SYM(glBindRenderbuffer)(GL_RENDERBUFFER, 0);
+
+   SYM(glGenFramebuffers)(1, &feedback_fbo);
+   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, feedback_fbo);
+   SYM(glFramebufferTexture2D)(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedback_texture, 0);
+   SYM(glFramebufferRenderbuffer)(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedback_depth);
+   if (SYM(glCheckFramebufferStatus)(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_ERROR, "Virtual texture feedback target is incomplete.\n");
+      SYM(glDeleteFramebuffers)(1, &feedback_fbo);
+      feedback_fbo = 0;
+   }
+   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, 0);
+
+   feedback.resize(FEEDBACK_WIDTH * FEEDBACK_HEIGHT * 4);
+   resident = false;
+   settled  = false;
+   return cache_texture;
+}
+
+void vtex_context_destroy(void)
+{
+   if (feedback_fbo)
+      SYM(glDeleteFramebuffers)(1, &feedback_fbo);
+   if (feedback_depth)
+      SYM(glDeleteRenderbuffers)(1, &feedback_depth);
+   GLuint textures[] = { cache_texture, page_texture, feedback_texture };
+   SYM(glDeleteTextures)(3, textures);
+
+   cache_texture    = 0;
+   page_texture     = 0;
+   feedback_fbo     = 0;
+   feedback_texture = 0;
+   feedback_depth   = 0;
+   resident         = false;
+}
+
+static void upload_tile(unsigned slot, unsigned index)
+{
+   unsigned level = 0;
+   while (level + 1 < pyr.levels && pyr.level[level + 1].first_tile <= index)
+      level++;
+   const struct pyramid_level *info = &pyr.level[level];
+   unsigned local = index - info->first_tile;
+
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0,
+         (slot % cache_slots_x) * PYRAMID_TILE_SIZE, (slot / cache_slots_x) * PYRAMID_TILE_SIZE,
+         PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+         pyramid_tile(&pyr, level, local % info->pages_x, local / info->pages_x));
+
+   slots[slot].tile = index;
+   tile_slot[index] = slot;
+}
+
+// Sets up residency once the pyramid is available: empty cache with the
+// single tile of the last level pinned in slot 0.
+static void init_residency(void)
+{
+   table_pages = 1;
+   while (table_pages < std::max(pyr.level[0].pages_x, pyr.level[0].pages_y))
+      table_pages <<= 1;
+
+   cache_slot free_slot = { -1, 0 };
+   slots.assign(cache_slots_x * cache_slots_x, free_slot);
+   tile_slot.assign(pyr.level[pyr.levels - 1].first_tile + 1, -1);
+   table.assign(2 * table_pages * table_pages * 4, 0);
+   pending.clear();
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, cache_texture);
+   upload_tile(0, pyr.level[pyr.levels - 1].first_tile);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+
+   SYM(glDeleteTextures)(1, &page_texture);
+   page_texture = create_texture(2 * table_pages, table_pages, GL_NEAREST, NULL);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+
+   resident    = true;
+   table_dirty = true;
+}
+
+static unsigned table_origin_y(unsigned level)
+{
+   return level ? table_pages - (table_pages >> (level - 1)) : 0;
+}
+
+// Coarse to fine, every page gets its own slot or its parent's entry.
+static void rebuild_table(void)
+{
+   unsigned stride = 2 * table_pages * 4;
+
+   for (int level = pyr.levels - 1; level >= 0; level--)
+   {
+      const struct pyramid_level *info = &pyr.level[level];
+      unsigned ox = level ? table_pages : 0;
+      unsigned oy = table_origin_y(level);
+      unsigned parent_ox = table_pages;
+      unsigned parent_oy = table_origin_y(level + 1);
+
+      for (unsigned y = 0; y < info->pages_y; y++)
+      {
+         uint8_t *dst = &table[(oy + y) * stride + ox * 4];
+         for (unsigned x = 0; x < info->pages_x; x++, dst += 4)
+         {
+            int slot = tile_slot[info->first_tile + y * info->pages_x + x];
+            if (slot >= 0)
+            {
+               dst[0] = slot % cache_slots_x;
+               dst[1] = slot / cache_slots_x;
+               dst[2] = level;
+               dst[3] = 255;
+            }
+            else
+               memcpy(dst, &table[(parent_oy + y / 2) * stride + (parent_ox + x / 2) * 4], 4);
+         }
+      }
+   }
+
+   SYM(glBindTexture)(GL_TEXTURE_2D, page_texture);
+   SYM(glTexSubImage2D)(GL_TEXTURE_2D, 0, 0, 0, 2 * table_pages, table_pages,
+         GL_RGBA, GL_UNSIGNED_BYTE, &table[0]);
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+   table_dirty = false;
+}
+
+// Least recently seen slot that the last feedback pass didn't ask for.
+static int find_slot(void)
+{
+   int best = -1;
+   for (unsigned i = 1; i < slots.size(); i++)
+   {
+      if (slots[i].tile < 0)
+         return i;
+      if (slots[i].last_used != feedback_pass &&
+            (best < 0 || slots[i].last_used < slots[best].last_used))
+         best = i;
+   }
+   return best;
+}
+
+bool vtex_update(GLuint *tex)
+{
+   *tex = cache_texture;
+   if (!cache_texture || !pyramid_ready())
+      return false;
+
+   if (!resident)
+      init_residency();
+
+   unsigned uploads = 0;
+   SYM(glBindTexture)(GL_TEXTURE_2D, cache_texture);
+   while (!pending.empty() && uploads < TILES_PER_FRAME)
+   {
+      uint32_t index = pending.back();
+      pending.pop_back();
+      if (tile_slot[index] >= 0)
+         continue;
+
+      int slot = find_slot();
+      if (slot < 0)
+      {
+         // Everything visible is already cached, drop the rest until next feedback.
+         pending.clear();
+         break;
+      }
+
+      if (slots[slot].tile >= 0)
+         tile_slot[slots[slot].tile] = -1;
+      upload_tile(slot, index);
+      slots[slot].last_used = feedback_pass;
+      uploads++;
+      table_dirty = true;
+   }
+   SYM(glBindTexture)(GL_TEXTURE_2D, 0);
+
+   if (table_dirty)
+      rebuild_table();
+
+   if (!settled && feedback_pass && pending.empty())
+   {
+      settled = true;
+      return true;
+   }
+   return false;
+}
+
+bool vtex_feedback_begin(void)
+{
+   if (!resident || !feedback_fbo || (frame++ & 1))
+      return false;
+
+   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, feedback_fbo);
+   SYM(glViewport)(0, 0, FEEDBACK_WIDTH, FEEDBACK_HEIGHT);
+   SYM(glClearColor)(0, 0, 0, 0);
+   SYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   return true;
+}
+
+void vtex_feedback_end(void)
+{
+   SYM(glReadPixels)(0, 0, FEEDBACK_WIDTH, FEEDBACK_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &feedback[0]);
+   SYM(glBindFramebuffer)(GL_FRAMEBUFFER, 0);
+
+   feedback_pass++;
+
+   // Alpha is level + 1, zero where nothing was drawn.
+   std::vector<uint32_t> requests;
+   for (size_t i = 0; i < feedback.size(); i += 4)
+   {
+      const uint8_t *p = &feedback[i];
+      if (!p[3] || p[3] > pyr.levels)
+         continue;
+
+      unsigned level = p[3] - 1;
+      unsigned x = p[0] | ((p[2] & 15) << 8);
+      unsigned y = p[1] | ((p[2] >> 4) << 8);
+
+      // Ancestors too, so there is always a coarse fallback close by.
+      for (; level < pyr.levels; level++, x >>= 1, y >>= 1)
+      {
+         const struct pyramid_level *info = &pyr.level[level];
+         if (x >= info->pages_x || y >= info->pages_y)
+            break;
+         requests.push_back(info->first_tile + y * info->pages_x + x);
+      }
+   }
+
+   std::sort(requests.begin(), requests.end());
+   requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+   // Levels are stored coarse last, so ascending order pops coarse tiles first.
+   pending.clear();
+   for (size_t i = 0; i < requests.size(); i++)
+   {
+      int slot = tile_slot[requests[i]];
+      if (slot >= 0)
+         slots[slot].last_used = feedback_pass;
+      else
+         pending.push_back(requests[i]);
+   }
+}
+
+void vtex_bind(GLuint prog, bool feedback_program, unsigned viewport_width)
+{
+   SYM(glActiveTexture)(GL_TEXTURE0 + VTEX_UNIT_PAGE_TABLE);
+   SYM(glBindTexture)(GL_TEXTURE_2D, page_texture);
+   SYM(glActiveTexture)(GL_TEXTURE0);
+   SYM(glUniform1i)(SYM(glGetUniformLocation)(prog, "uPageTable"), VTEX_UNIT_PAGE_TABLE);
+
+   float vt0[4], vt1[4];
+   if (resident)
+   {
+      vt0[0] = pyr.width;
+      vt0[1] = pyr.height;
+      vt0[2] = pyr.levels - 1;
+   }
+   else
+   {
+      vt0[0] = vt0[1] = PYRAMID_TILE_CONTENT;
+      vt0[2] = 0;
+   }
+   vt0[3] = table_pages;
+   vt1[0] = PYRAMID_TILE_CONTENT;
+   vt1[1] = PYRAMID_TILE_BORDER;
+   vt1[2] = PYRAMID_TILE_SIZE;
+   vt1[3] = cache_size;
+   SYM(glUniform4fv)(SYM(glGetUniformLocation)(prog, "uVT0"), 1, vt0);
+   SYM(glUniform4fv)(SYM(glGetUniformLocation)(prog, "uVT1"), 1, vt1);
+
+   // The feedback target is smaller, which makes derivatives larger by the same factor.
+   float bias = feedback_program ? log2f((float)FEEDBACK_WIDTH / viewport_width) : 0.0f;
+   SYM(glUniform1f)(SYM(glGetUniformLocation)(prog, "uVTBias"), bias);
+}
+
+void vtex_unload(void)
+{
+   if (thread)
+   {
+      sthread_join(thread);
+      thread = NULL;
+   }
+   slock_free(lock);
+   lock = NULL;
+
+   pyramid_close(&pyr);
+   opened   = false;
+   resident = false;
+   settled  = false;
+
+   cache_texture    = 0;
+   page_texture     = 0;
+   feedback_fbo     = 0;
+   feedback_texture = 0;
+   feedback_depth   = 0;
+   table_pages      = 1;
+   frame            = 0;
+   feedback_pass    = 0;
+
+   slots.clear();
+   tile_slot.clear();
+   table.clear();
+   pending.clear();
+}
@@ -0,0 +1,67 @@
+/*
+ *  InstancingViewer Tech demo
+ *  Copyright (C) 2013 - Hans-Kristian Arntzen
+ *  Copyright (C) 2013 - Daniel De Matteis
+ *
+ *  InstancingViewer is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  InstancingViewer is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with InstancingViewer.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VTEX_HPP__
+#define VTEX_HPP__
+
+#include "gl.hpp"
+
+// Virtual texturing for images too large to be a single texture.
+//
+// A worker thread turns the image into a tile pyramid on disk (see
+// pyramid.hpp). Every other frame the scene is drawn into a small feedback
+// target where each fragment writes the tile it would sample; the render
+// thread reads that back and pages missing tiles, coarsest first, into a
+// fixed-size physical cache texture, evicting the least recently seen.
+// A page table texture maps every tile of every level to the cache slot of
+// the finest resident tile covering it, so nothing ever samples a hole.
+//
+// GPU memory is the cache plus the page table; CPU memory is the page table
+// and the mapped pyramid file.
+
+// Texture units used by the sampling shader.
+#define VTEX_UNIT_CACHE 0
+#define VTEX_UNIT_PAGE_TABLE 1
+
+// Starts building (or opening) the pyramid for path in cache_dir.
+void vtex_start(const char *path, const char *cache_dir);
+
+// Call from context_reset(). Every GL object from before is considered lost.
+// Returns the physical cache texture, to be bound on VTEX_UNIT_CACHE.
+GLuint vtex_context_reset(void);
+
+// Deletes every GL object made so far. Call with the context current, before
+// a vtex_context_reset() that doesn't follow a real context loss.
+void vtex_context_destroy(void);
+
+// Call once per frame on the render thread. Uploads pending tiles.
+// Returns true once, when every tile requested so far is resident.
+bool vtex_update(GLuint *tex);
+
+// Binds the feedback target and returns true on frames that should render
+// feedback. Draw the scene with the feedback program, then call vtex_feedback_end().
+bool vtex_feedback_begin(void);
+void vtex_feedback_end(void);
+
+// Binds the page table and sets the uniforms of a program using the
+// virtual texture sampler. Call after glUseProgram().
+void vtex_bind(GLuint prog, bool feedback, unsigned viewport_width);
+
+// Stops the worker and frees everything. Makes no GL calls.
+void vtex_unload(void);
+
+#endif